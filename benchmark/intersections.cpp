@@ -0,0 +1,181 @@
+// Micro-benchmarks of the intersection routines of bvh.hip.h built for the host like the CPU backend,
+// the include path of src/cpu_backend/kernels/include replaces the HIP runtime headers.
+//   intersections [tests count] [repetitions]
+// Every test pairs the i-th ray with the i-th primitive of randomized sets, the sets are larger than the caches
+// so the loads are part of the cost like in the traversal. Prints the best and the median ns/test as JSON.
+#include <hip/hip_runtime.h>
+#include "common.hip.h"
+#include "bvh.hip.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#define SEED 100u
+
+// xorshift32, the sets are the same every run
+struct Random
+{
+    uint32_t state = SEED;
+
+    float gen_float(float min, float max)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return min + (max - min) * (float)(state >> 8) / 16777216.0f;
+    }
+
+    float3 gen_float3(float min, float max)
+    {
+        float x = gen_float(min, max);
+        float y = gen_float(min, max);
+        float z = gen_float(min, max);
+        return make_float3(x, y, z);
+    }
+
+    float3 gen_direction()
+    {
+        while (true)
+        {
+            float3 d = gen_float3(-1.0f, 1.0f);
+            float l = length_squared(d);
+            if (l > 1e-4f && l <= 1.0f) { return d / sqrtf(l); }
+        }
+    }
+};
+
+struct TestAabb
+{
+    float3 min;
+    float3 max;
+};
+
+struct TestTriangle
+{
+    float3 v0;
+    float3 v1;
+    float3 v2;
+};
+
+struct Result
+{
+    const char* name;
+    double best_ns;
+    double median_ns;
+    // keeps the compiler from removing the tests
+    double checksum;
+};
+
+// Runs pass(), which does tests_count tests, repetitions times.
+template <typename Pass>
+Result measure(const char* name, size_t tests_count, int repetitions, Pass pass)
+{
+    std::vector<double> ns_per_test;
+    double checksum = 0.0;
+    for (int r = 0; r < repetitions; r++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        checksum += pass();
+        auto end = std::chrono::steady_clock::now();
+        ns_per_test.push_back(std::chrono::duration<double, std::nano>(end - start).count() / (double)tests_count);
+    }
+    std::sort(ns_per_test.begin(), ns_per_test.end());
+    return Result{name, ns_per_test.front(), ns_per_test[ns_per_test.size() / 2], checksum};
+}
+
+int main(int argc, char** argv)
+{
+    size_t tests_count = argc > 1 ? (size_t)strtoull(argv[1], nullptr, 10) : 1u << 22;
+    int repetitions = argc > 2 ? atoi(argv[2]) : 15;
+    if (tests_count == 0 || repetitions <= 0)
+    {
+        fprintf(stderr, "usage: intersections [tests count] [repetitions]\n");
+        return 1;
+    }
+
+    Random rnd;
+    std::vector<Ray> rays(tests_count);
+    for (Ray& ray : rays)
+    {
+        ray = Ray(rnd.gen_float3(-4.0f, 4.0f), rnd.gen_direction());
+    }
+    std::vector<TestAabb> aabbs(tests_count);
+    for (TestAabb& aabb : aabbs)
+    {
+        float3 a = rnd.gen_float3(-2.0f, 2.0f);
+        float3 b = rnd.gen_float3(-2.0f, 2.0f);
+        aabb = TestAabb{min(a, b), max(a, b)};
+    }
+    std::vector<TestTriangle> triangles(tests_count);
+    for (TestTriangle& triangle : triangles)
+    {
+        float3 center = rnd.gen_float3(-1.0f, 1.0f);
+        triangle = TestTriangle{center + rnd.gen_float3(-1.0f, 1.0f), center + rnd.gen_float3(-1.0f, 1.0f), center + rnd.gen_float3(-1.0f, 1.0f)};
+    }
+    // the bvh tests spheres in object space, unit sphere at the origin
+    std::vector<Ray> object_rays(tests_count);
+    for (Ray& ray : object_rays)
+    {
+        ray = Ray(rnd.gen_float3(-3.0f, 3.0f), rnd.gen_direction() * rnd.gen_float(0.5f, 2.0f));
+    }
+
+    // the routines don't use the bvh arrays
+    Bvh bvh = {};
+    const float t_min = 0.001f;
+    const float t_max = 1000.0f;
+    std::vector<float3> invdirs(tests_count);
+    std::vector<Result> results;
+
+    results.push_back(measure("safe_invdir", tests_count, repetitions, [&]() {
+        for (size_t i = 0; i < tests_count; i++)
+        {
+            invdirs[i] = bvh.safe_invdir(rays[i].direction);
+        }
+        return (double)invdirs[tests_count / 2].x;
+    }));
+
+    results.push_back(measure("aabb_hit", tests_count, repetitions, [&]() {
+        uint32_t hits = 0;
+        for (size_t i = 0; i < tests_count; i++)
+        {
+            float3 oxinvdir = -rays[i].origin * invdirs[i];
+            float2 t = bvh.aabb_hit(aabbs[i].min, aabbs[i].max, invdirs[i], oxinvdir, t_min, t_max);
+            hits += t.x <= t.y ? 1 : 0;
+        }
+        return (double)hits;
+    }));
+
+    results.push_back(measure("triangle_hit", tests_count, repetitions, [&]() {
+        uint32_t hits = 0;
+        for (size_t i = 0; i < tests_count; i++)
+        {
+            float2 uv;
+            float t = bvh.triangle_hit(rays[i], triangles[i].v0, triangles[i].v1, triangles[i].v2, t_min, t_max, &uv);
+            hits += t < t_max ? 1 : 0;
+        }
+        return (double)hits;
+    }));
+
+    results.push_back(measure("sphere_hit", tests_count, repetitions, [&]() {
+        uint32_t hits = 0;
+        for (size_t i = 0; i < tests_count; i++)
+        {
+            float t = bvh.sphere_hit(object_rays[i], t_min, t_max);
+            hits += t < t_max ? 1 : 0;
+        }
+        return (double)hits;
+    }));
+
+    printf("{\n  \"tests\": %zu,\n  \"repetitions\": %d,\n  \"results\": [\n", tests_count, repetitions);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result& r = results[i];
+        printf("    { \"name\": \"%s\", \"best_ns_per_test\": %.3f, \"median_ns_per_test\": %.3f, \"checksum\": %.1f }%s\n",
+            r.name, r.best_ns, r.median_ns, r.checksum, i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,350 @@
+const std = @import("std");
+const zstbi = @import("zstbi");
+const ornament = @import("ornament");
+const examples = @import("examples");
+const PeakAllocator = ornament.PeakAllocator;
+const regression = @import("regression.zig");
+
+// Renders the example scenes headlessly and prints the measurements as JSON to stdout.
+// The sweep renders scenes of ornament.scene_generator from 100 objects up to max count, ten times more every step.
+// baseline renders the example scenes repeat times and stores the result as the baseline of the machine,
+// regress compares a new result with the stored baseline and exits with 1 on a regression or without a baseline.
+const usage =
+    \\usage:
+    \\  benchmark [cpu|hip] [samples] [width] [height]
+    \\  benchmark sweep <cpu|hip> <spheres|instances|triangles> <max count> [samples] [width] [height]
+    \\  benchmark baseline <baselines dir> <cpu|hip> [repeat] [samples] [width] [height]
+    \\  benchmark regress <baselines dir> <cpu|hip> [repeat] [samples] [width] [height]
+    \\
+;
+
+// The scenes are built with the same seed every run and the path tracer renders all samples in one render,
+// the ray counts of the render stats are summed over its iterations and read once after it.
+
+const SEED = 100;
+const DEPTH = 10;
+
+// name and init function of the scenes
+const scenes = .{
+    .{ "spheres", examples.init_spheres },
+    .{ "lucy_spheres_with_textures", examples.init_lucy_spheres_with_textures },
+    .{ "spheres_and_3_lucy", examples.init_spheres_and_3_lucy },
+    .{ "empty_cornell_box", examples.init_empty_cornell_box },
+    .{ "cornell_box_with_lucy", examples.init_cornell_box_with_lucy },
+};
+
+const Options = struct {
+    backend: []const u8 = "cpu",
+    samples: u32 = 64,
+    resolution: ornament.Resolution = .{ .width = 1280, .height = 720 },
+
+    fn aspectRatio(self: Options) f32 {
+        return @as(f32, @floatFromInt(self.resolution.width)) / @as(f32, @floatFromInt(self.resolution.height));
+    }
+};
+
+const SceneReport = struct {
+    name: []const u8,
+    bvh_build_ms: f64,
+    // path tracer init, with the bvh build and the upload of the scene
+    setup_ms: f64,
+    render_ms: f64,
+    samples: u32,
+    primary_rays: u64,
+    secondary_rays: u64,
+    primary_rays_per_second: f64,
+    secondary_rays_per_second: f64,
+    mrays_per_second: f64,
+    samples_per_second: f64,
+    // host allocations only, device memory of the HIP backend is not counted
+    peak_host_bytes: usize,
+    // summed over the samples, null unless built with -Dtraversal_stats=true
+    traversal_stats: ?ornament.TraversalTotals,
+    memory: ornament.MemoryReport,
+};
+
+const Report = struct {
+    backend: []const u8,
+    // "examples", or the generator of a sweep
+    scene_set: []const u8,
+    width: u32,
+    height: u32,
+    depth: u32,
+    seed: u64,
+    scenes: []const SceneReport,
+};
+
+pub fn main() !u8 {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer if (gpa.deinit() == .leak) @panic("[benchmark] memory leak");
+    var peak_allocator = PeakAllocator.init(gpa.allocator());
+    const allocator = peak_allocator.allocator();
+
+    zstbi.init(allocator);
+    defer zstbi.deinit();
+    zstbi.setFlipVerticallyOnLoad(true);
+
+    const args = try std.process.argsAlloc(allocator);
+    defer std.process.argsFree(allocator, args);
+    // names of the sweep scenes
+    var arena = std.heap.ArenaAllocator.init(allocator);
+    defer arena.deinit();
+
+    if (args.len > 1 and (std.mem.eql(u8, args[1], "baseline") or std.mem.eql(u8, args[1], "regress"))) {
+        return runRegression(allocator, &peak_allocator, args);
+    }
+
+    var options = Options{};
+    var reports = std.ArrayList(SceneReport).init(allocator);
+    defer reports.deinit();
+    var scene_set: []const u8 = "examples";
+    if (args.len > 1 and std.mem.eql(u8, args[1], "sweep")) {
+        if (args.len < 5) return usageError();
+        options.backend = args[2];
+        scene_set = args[3];
+        const max_count = try std.fmt.parseInt(u32, args[4], 10);
+        try parseRenderOptions(args[5..], &options);
+
+        var count: u32 = 100;
+        while (count <= max_count) : (count = std.math.mul(u32, count, 10) catch break) {
+            const name = try std.fmt.allocPrint(arena.allocator(), "{s}_{d}", .{ scene_set, count });
+            const generator_options = ornament.scene_generator.Options{ .seed = SEED, .aspect_ratio = options.aspectRatio() };
+            std.log.info("[benchmark] {s}", .{name});
+            try reports.append(if (std.mem.eql(u8, scene_set, "spheres"))
+                try runScene(allocator, &peak_allocator, name, ornament.scene_generator.spheres, .{ count, generator_options }, options)
+            else if (std.mem.eql(u8, scene_set, "instances"))
+                try runScene(allocator, &peak_allocator, name, ornament.scene_generator.meshInstances, .{ count, generator_options }, options)
+            else if (std.mem.eql(u8, scene_set, "triangles"))
+                try runScene(allocator, &peak_allocator, name, ornament.scene_generator.triangleMesh, .{ count, generator_options }, options)
+            else
+                return usageError());
+        }
+    } else {
+        if (args.len > 1) options.backend = args[1];
+        try parseRenderOptions(args[@min(args.len, 2)..], &options);
+        try benchmarkExamples(allocator, &peak_allocator, options, &reports);
+    }
+
+    // zig build benchmark -Dtrace=true
+    if (ornament.trace.enabled) try ornament.trace.saveChromeTrace("benchmark_trace.json");
+
+    const report = Report{
+        .backend = options.backend,
+        .scene_set = scene_set,
+        .width = options.resolution.width,
+        .height = options.resolution.height,
+        .depth = DEPTH,
+        .seed = SEED,
+        .scenes = reports.items,
+    };
+    const stdout = std.io.getStdOut().writer();
+    try std.json.stringify(report, .{ .whitespace = .indent_2 }, stdout);
+    try stdout.writeByte('\n');
+    return 0;
+}
+
+fn benchmarkExamples(allocator: std.mem.Allocator, peak_allocator: *PeakAllocator, options: Options, reports: *std.ArrayList(SceneReport)) !void {
+    inline for (scenes) |scene| {
+        std.log.info("[benchmark] {s}", .{scene[0]});
+        // the examples take their random objects from one generator
+        examples.setSeed(SEED);
+        try reports.append(try runScene(allocator, peak_allocator, scene[0], scene[1], .{options.aspectRatio()}, options));
+    }
+}
+
+// <baseline|regress> <baselines dir> <cpu|hip> [repeat] [samples] [width] [height]
+fn runRegression(allocator: std.mem.Allocator, peak_allocator: *PeakAllocator, args: []const []const u8) !u8 {
+    if (args.len < 4) return usageError();
+    const update = std.mem.eql(u8, args[1], "baseline");
+    var options = Options{ .backend = args[3] };
+    const repeat = if (args.len > 4) try std.fmt.parseInt(u32, args[4], 10) else 5;
+    if (repeat == 0) return usageError();
+    try parseRenderOptions(args[@min(args.len, 5)..], &options);
+
+    var arena = std.heap.ArenaAllocator.init(allocator);
+    defer arena.deinit();
+    const arena_allocator = arena.allocator();
+
+    var current = regression.Baseline{
+        .machine = try regression.machineName(arena_allocator),
+        .backend = options.backend,
+        .width = options.resolution.width,
+        .height = options.resolution.height,
+        .samples = options.samples,
+        .repeat = repeat,
+        .scenes = &.{},
+    };
+    const path = try regression.baselinePath(arena_allocator, args[2], current);
+
+    // only baseline writes the file, a missing baseline fails before the runs
+    const parsed = if (update) null else try regression.load(allocator, path) orelse {
+        std.log.err("[benchmark] no baseline at {s}, run the baseline command first", .{path});
+        return 1;
+    };
+    defer if (parsed) |p| p.deinit();
+
+    // the reports of run r are runs[r * scenes.len ..][0..scenes.len]
+    var runs = std.ArrayList(SceneReport).init(allocator);
+    defer runs.deinit();
+    var run: u32 = 0;
+    while (run < repeat) : (run += 1) {
+        std.log.info("[benchmark] run {d} of {d}", .{ run + 1, repeat });
+        try benchmarkExamples(allocator, peak_allocator, options, &runs);
+    }
+
+    const scene_baselines = try arena_allocator.alloc(regression.SceneBaseline, scenes.len);
+    const values = try arena_allocator.alloc(f64, repeat);
+    for (scene_baselines, 0..) |*scene, i| {
+        scene.name = runs.items[i].name;
+        inline for (.{ "bvh_build_ms", "mrays_per_second", "peak_host_bytes" }) |metric| {
+            for (values, 0..) |*value, r| value.* = toF64(@field(runs.items[r * scenes.len + i], metric));
+            @field(scene, metric) = try regression.Stat.init(arena_allocator, values);
+        }
+    }
+    current.scenes = scene_baselines;
+
+    if (update) {
+        try regression.save(path, current);
+        std.log.info("[benchmark] baseline is stored to {s}", .{path});
+        return 0;
+    }
+
+    const comparisons = try regression.compare(arena_allocator, parsed.?.value, current);
+    var regressions: u32 = 0;
+    for (comparisons) |c| {
+        if (!c.regression) continue;
+        regressions += 1;
+        std.log.err("[benchmark] {s} {s} regressed by {d:.1}% ({d:.3} -> {d:.3}), the threshold is {d:.1}%", .{
+            c.scene,
+            c.metric,
+            c.change * 100.0,
+            c.baseline,
+            c.current,
+            c.threshold * 100.0,
+        });
+    }
+    const stdout = std.io.getStdOut().writer();
+    try std.json.stringify(.{ .baseline = path, .regressions = regressions, .comparisons = comparisons }, .{ .whitespace = .indent_2 }, stdout);
+    try stdout.writeByte('\n');
+    return if (regressions > 0) 1 else 0;
+}
+
+fn toF64(value: anytype) f64 {
+    return switch (@typeInfo(@TypeOf(value))) {
+        .Int => @floatFromInt(value),
+        else => value,
+    };
+}
+
+// [samples] [width] [height]
+fn parseRenderOptions(args: []const []const u8, options: *Options) !void {
+    if (args.len > 0) options.samples = try std.fmt.parseInt(u32, args[0], 10);
+    if (args.len > 1) options.resolution.width = try std.fmt.parseInt(u32, args[1], 10);
+    if (args.len > 2) options.resolution.height = try std.fmt.parseInt(u32, args[2], 10);
+}
+
+fn usageError() error{InvalidArguments} {
+    std.io.getStdErr().writeAll(usage) catch {};
+    return error.InvalidArguments;
+}
+
+fn runScene(
+    allocator: std.mem.Allocator,
+    peak_allocator: *PeakAllocator,
+    name: []const u8,
+    comptime initScene: anytype,
+    init_args: anytype,
+    options: Options,
+) !SceneReport {
+    if (std.mem.eql(u8, options.backend, "cpu")) {
+        return benchmarkScene(ornament.CpuPathTracer, allocator, peak_allocator, name, initScene, init_args, options);
+    } else if (std.mem.eql(u8, options.backend, "hip")) {
+        return benchmarkScene(ornament.HipPathTracer, allocator, peak_allocator, name, initScene, init_args, options);
+    }
+    return usageError();
+}
+
+fn benchmarkScene(
+    comptime PathTracer: type,
+    allocator: std.mem.Allocator,
+    peak_allocator: *PeakAllocator,
+    name: []const u8,
+    comptime initScene: anytype,
+    init_args: anytype,
+    options: Options,
+) !SceneReport {
+    peak_allocator.resetPeak();
+    var scene = ornament.Scene.init(allocator);
+    @call(.auto, initScene, .{&scene} ++ init_args) catch |err| {
+        scene.deinit();
+        return err;
+    };
+
+    var timer = try std.time.Timer.start();
+    var bvh = ornament.Bvh.init(allocator, &scene, true) catch |err| {
+        scene.deinit();
+        return err;
+    };
+    const bvh_build_ns = timer.read();
+    bvh.deinit();
+
+    timer.reset();
+    // the path tracer owns the scene
+    var path_tracer = PathTracer.init(allocator, scene) catch |err| {
+        scene.deinit();
+        return err;
+    };
+    defer deinitPathTracer(PathTracer, &path_tracer);
+    const setup_ns = timer.read();
+
+    path_tracer.state.setDepth(DEPTH);
+    path_tracer.state.setIterations(1);
+    try path_tracer.setResolution(options.resolution);
+    // the first sample creates the buffers and, on the GPU, loads the kernels
+    try path_tracer.render();
+
+    const pixel_count = options.resolution.pixel_count();
+    // all samples in one render, so the stats are read and the image is post processed once
+    path_tracer.state.setIterations(options.samples);
+    timer.reset();
+    try path_tracer.render();
+    // waits for the samples to finish
+    const stats = try path_tracer.getRenderStats();
+    const render_ns = timer.read();
+    const secondary_rays = stats.secondaryRayCount();
+    const traversal_stats: ?ornament.TraversalTotals = path_tracer.getTraversalStats() catch |err| switch (err) {
+        error.TraversalStatsDisabled => null,
+        else => return err,
+    };
+
+    const render_s = @as(f64, @floatFromInt(render_ns)) / std.time.ns_per_s;
+    const primary_rays = @as(u64, pixel_count) * options.samples;
+    return .{
+        .name = name,
+        .bvh_build_ms = @as(f64, @floatFromInt(bvh_build_ns)) / std.time.ns_per_ms,
+        .setup_ms = @as(f64, @floatFromInt(setup_ns)) / std.time.ns_per_ms,
+        .render_ms = render_s * std.time.ms_per_s,
+        .samples = options.samples,
+        .primary_rays = primary_rays,
+        .secondary_rays = secondary_rays,
+        .primary_rays_per_second = @as(f64, @floatFromInt(primary_rays)) / render_s,
+        .secondary_rays_per_second = @as(f64, @floatFromInt(secondary_rays)) / render_s,
+        .mrays_per_second = @as(f64, @floatFromInt(primary_rays + secondary_rays)) / render_s / 1e6,
+        .samples_per_second = @as(f64, @floatFromInt(options.samples)) / render_s,
+        .peak_host_bytes = peak_allocator.getPeakBytes(),
+        .traversal_stats = traversal_stats,
+        .memory = path_tracer.memoryReport(),
+    };
+}
+
+// deinit of HipPathTracer returns the errors of the driver
+fn deinitPathTracer(comptime PathTracer: type, path_tracer: *PathTracer) void {
+    const Result = @typeInfo(@TypeOf(PathTracer.deinit)).Fn.return_type.?;
+    if (@typeInfo(Result) == .ErrorUnion) {
+        path_tracer.deinit() catch |err| {
+            std.log.err("[benchmark] path tracer returned an error on deinit: {s}", .{@errorName(err)});
+        };
+    } else {
+        path_tracer.deinit();
+    }
+}
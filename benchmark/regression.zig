@@ -0,0 +1,156 @@
+const std = @import("std");
+
+// Baselines of the benchmark stored per machine and the noise aware comparison of new runs with them.
+// Every metric keeps the median and the median absolute deviation of repeated runs, a run regresses
+// when its median is worse than the baseline by more than the tolerance of the metric and by more than
+// MAD_SIGMAS standard deviations estimated from the deviations of both runs.
+
+const MAD_SIGMAS = 3.0;
+// MAD of normally distributed values times this is their standard deviation
+const MAD_TO_SIGMA = 1.4826;
+
+pub const Stat = struct {
+    median: f64,
+    mad: f64,
+
+    pub fn init(allocator: std.mem.Allocator, values: []const f64) !Stat {
+        var sorted = try allocator.dupe(f64, values);
+        defer allocator.free(sorted);
+        const m = median(sorted);
+        for (sorted) |*v| v.* = @fabs(v.* - m);
+        return .{ .median = m, .mad = median(sorted) };
+    }
+
+    fn median(values: []f64) f64 {
+        std.debug.assert(values.len > 0);
+        std.sort.heap(f64, values, {}, std.sort.asc(f64));
+        const half = values.len / 2;
+        return if (values.len % 2 == 0) (values[half - 1] + values[half]) / 2.0 else values[half];
+    }
+};
+
+pub const SceneBaseline = struct {
+    name: []const u8,
+    bvh_build_ms: Stat,
+    mrays_per_second: Stat,
+    peak_host_bytes: Stat,
+};
+
+pub const Baseline = struct {
+    machine: []const u8,
+    backend: []const u8,
+    width: u32,
+    height: u32,
+    samples: u32,
+    repeat: u32,
+    scenes: []const SceneBaseline,
+};
+
+const Direction = enum { lower_is_better, higher_is_better };
+
+// field of SceneBaseline, direction and the smallest relative change reported as a regression
+const metrics = .{
+    .{ "bvh_build_ms", Direction.lower_is_better, 0.05 },
+    .{ "mrays_per_second", Direction.higher_is_better, 0.05 },
+    .{ "peak_host_bytes", Direction.lower_is_better, 0.02 },
+};
+
+pub const Comparison = struct {
+    scene: []const u8,
+    metric: []const u8,
+    baseline: f64,
+    current: f64,
+    // relative change of the median, positive is worse
+    change: f64,
+    // relative change above which the metric regresses
+    threshold: f64,
+    regression: bool,
+};
+
+// Compares every metric of the scenes of current with the same scene of the baseline,
+// the scenes missing in the baseline are skipped.
+pub fn compare(allocator: std.mem.Allocator, baseline: Baseline, current: Baseline) ![]Comparison {
+    if (!std.mem.eql(u8, baseline.backend, current.backend) or
+        baseline.width != current.width or
+        baseline.height != current.height or
+        baseline.samples != current.samples)
+    {
+        return error.BaselineMismatch;
+    }
+
+    var comparisons = std.ArrayList(Comparison).init(allocator);
+    errdefer comparisons.deinit();
+    for (current.scenes) |scene| {
+        const base_scene = findScene(baseline, scene.name) orelse {
+            std.log.warn("[benchmark] scene {s} is missing in the baseline", .{scene.name});
+            continue;
+        };
+        inline for (metrics) |metric| {
+            const base: Stat = @field(base_scene, metric[0]);
+            const cur: Stat = @field(scene, metric[0]);
+            const change = switch (metric[1]) {
+                .lower_is_better => (cur.median - base.median) / base.median,
+                .higher_is_better => (base.median - cur.median) / base.median,
+            };
+            const noise = MAD_SIGMAS * MAD_TO_SIGMA * @sqrt(base.mad * base.mad + cur.mad * cur.mad) / base.median;
+            const threshold = @max(metric[2], noise);
+            try comparisons.append(.{
+                .scene = scene.name,
+                .metric = metric[0],
+                .baseline = base.median,
+                .current = cur.median,
+                .change = change,
+                .threshold = threshold,
+                .regression = base.median > 0.0 and change > threshold,
+            });
+        }
+    }
+    return comparisons.toOwnedSlice();
+}
+
+fn findScene(baseline: Baseline, name: []const u8) ?SceneBaseline {
+    for (baseline.scenes) |scene| {
+        if (std.mem.eql(u8, scene.name, name)) return scene;
+    }
+    return null;
+}
+
+// ORNAMENT_MACHINE overrides the host name, so the baselines can be shared by identical machines.
+pub fn machineName(allocator: std.mem.Allocator) ![]u8 {
+    for ([_][]const u8{ "ORNAMENT_MACHINE", "COMPUTERNAME", "HOSTNAME" }) |name| {
+        if (std.process.getEnvVarOwned(allocator, name)) |value| {
+            return value;
+        } else |err| switch (err) {
+            error.EnvironmentVariableNotFound => {},
+            else => return err,
+        }
+    }
+    return allocator.dupe(u8, "unknown");
+}
+
+// dir/machine_backend_widthxheight.json
+pub fn baselinePath(allocator: std.mem.Allocator, dir: []const u8, baseline: Baseline) ![]u8 {
+    const file_name = try std.fmt.allocPrint(allocator, "{s}_{s}_{d}x{d}.json", .{ baseline.machine, baseline.backend, baseline.width, baseline.height });
+    defer allocator.free(file_name);
+    return std.fs.path.join(allocator, &.{ dir, file_name });
+}
+
+// Returns null when the machine has no baseline yet.
+pub fn load(allocator: std.mem.Allocator, path: []const u8) !?std.json.Parsed(Baseline) {
+    const source = std.fs.cwd().readFileAlloc(allocator, path, 16 * 1024 * 1024) catch |err| switch (err) {
+        error.FileNotFound => return null,
+        else => return err,
+    };
+    defer allocator.free(source);
+    return try std.json.parseFromSlice(Baseline, allocator, source, .{ .allocate = .alloc_always });
+}
+
+pub fn save(path: []const u8, baseline: Baseline) !void {
+    if (std.fs.path.dirname(path)) |dir| try std.fs.cwd().makePath(dir);
+    var file = try std.fs.cwd().createFile(path, .{});
+    defer file.close();
+    var buffered = std.io.bufferedWriter(file.writer());
+    try std.json.stringify(baseline, .{ .whitespace = .indent_2 }, buffered.writer());
+    try buffered.writer().writeByte('\n');
+    try buffered.flush();
+}
@@ -6,6 +6,8 @@ const zstbi = @import("libs/zig-gamedev/libs/zstbi/build.zig");
 pub fn build(b: *std.Build) void {
     const target = std.zig.CrossTarget{ .os_tag = .windows, .cpu_arch = .x86_64 };
     const optimize = b.standardOptimizeOption(.{});
+    const trace = b.option(bool, "trace", "Record the phases of the path tracers, see src/trace.zig") orelse false;
+    const traversal_stats = b.option(bool, "traversal_stats", "Count the bvh traversal steps of the HIP and CPU kernels") orelse false;
 
     const exe = b.addExecutable(.{
         .name = "glfw_example",
@@ -34,7 +36,7 @@ pub fn build(b: *std.Build) void {
     var zmath_pkg = zmath.package(b, target, optimize, .{ .options = .{ .enable_cross_platform_determinism = true } });
     const zglfw_pkg = zglfw.package(b, target, optimize, .{});
     const zstbi_pkg = zstbi.package(b, target, optimize, .{});
-    const ornament = package(b, .{ .deps = .{ .zmath_pkg = &zmath_pkg } });
+    const ornament = package(b, target, optimize, .{ .deps = .{ .zmath_pkg = &zmath_pkg }, .options = .{ .trace = trace, .traversal_stats = traversal_stats } });
 
     zmath_pkg.link(exe);
     zglfw_pkg.link(exe);
@@ -51,11 +53,81 @@ pub fn build(b: *std.Build) void {
 
     const run_step = b.step("run", "Run the app");
     run_step.dependOn(&run_cmd.step);
+
+    // Benchmark of the glfw example scenes, renders without a window and prints JSON.
+    const benchmark_exe = b.addExecutable(.{
+        .name = "benchmark",
+        .root_source_file = .{ .path = "benchmark/main.zig" },
+        .target = target,
+        .optimize = optimize,
+    });
+    benchmark_exe.addOptions("build_options", exe_options);
+    benchmark_exe.step.dependOn(&install_assets_step.step);
+    benchmark_exe.addIncludePath(std.Build.LazyPath.relative("libs/assimp/include"));
+    benchmark_exe.addLibraryPath(std.Build.LazyPath.relative("libs/assimp"));
+    benchmark_exe.linkSystemLibraryName("assimp-vc143-mt");
+    zmath_pkg.link(benchmark_exe);
+    zstbi_pkg.link(benchmark_exe);
+    ornament.link(benchmark_exe);
+    benchmark_exe.addModule("examples", b.createModule(.{
+        .source_file = .{ .path = "glfw_example/examples.zig" },
+        .dependencies = &.{
+            .{ .name = "zmath", .module = zmath_pkg.zmath },
+            .{ .name = "zstbi", .module = zstbi_pkg.zstbi },
+            .{ .name = "ornament", .module = ornament.ornament },
+            .{ .name = "build_options", .module = exe_options.createModule() },
+        },
+    }));
+
+    const install_benchmark = b.addInstallArtifact(benchmark_exe, .{});
+    const benchmark_cmd = b.addRunArtifact(benchmark_exe);
+    benchmark_cmd.step.dependOn(&install_benchmark.step);
+    if (b.args) |args| {
+        benchmark_cmd.addArgs(args);
+    }
+    const benchmark_step = b.step("benchmark", "Run the benchmark of the example scenes");
+    benchmark_step.dependOn(&benchmark_cmd.step);
+
+    // Headless, only the CPU backend, so it builds for the host and runs without a display or GPU.
+    const headless_target = std.zig.CrossTarget{};
+    const headless_exe = b.addExecutable(.{
+        .name = "headless_example",
+        .root_source_file = .{ .path = "headless_example/main.zig" },
+        .target = headless_target,
+        .optimize = optimize,
+    });
+    var headless_zmath_pkg = zmath.package(b, headless_target, optimize, .{ .options = .{ .enable_cross_platform_determinism = true } });
+    const headless_ornament = package(b, headless_target, optimize, .{ .deps = .{ .zmath_pkg = &headless_zmath_pkg }, .options = .{ .trace = trace, .traversal_stats = traversal_stats } });
+    headless_zmath_pkg.link(headless_exe);
+    headless_ornament.linkCpu(headless_exe);
+
+    const headless_step = b.step("headless", "Build the headless example");
+    headless_step.dependOn(&b.addInstallArtifact(headless_exe, .{}).step);
+
+    // Micro-benchmarks of the intersection routines of the kernels, built for the host like the CPU backend.
+    const intersections_exe = b.addExecutable(.{
+        .name = "intersections",
+        .target = headless_target,
+        // ns/test of a debug build says nothing
+        .optimize = .ReleaseFast,
+    });
+    intersections_exe.linkLibCpp();
+    intersections_exe.addIncludePath(std.Build.LazyPath.relative("src/cpu_backend/kernels/include"));
+    intersections_exe.addIncludePath(std.Build.LazyPath.relative("src/hip_backend/kernels"));
+    intersections_exe.addCSourceFile(.{ .file = .{ .path = "benchmark/intersections.cpp" }, .flags = &.{"-std=c++17"} });
+
+    const intersections_cmd = b.addRunArtifact(intersections_exe);
+    if (b.args) |args| {
+        intersections_cmd.addArgs(args);
+    }
+    const intersections_step = b.step("intersections", "Run the micro-benchmarks of the ray intersection routines");
+    intersections_step.dependOn(&intersections_cmd.step);
 }
 
 pub const Package = struct {
     ornament: *std.Build.Module,
     dep_steps: *std.Build.Step,
+    cpu_kernels: *std.Build.CompileStep,
 
     pub fn link(self: Package, exe: *std.Build.CompileStep) void {
         exe.linkLibC();
@@ -72,18 +144,33 @@ pub const Package = struct {
         exe.defineCMacro("__HIP_PLATFORM_AMD__", null);
         exe.addIncludePath(std.Build.LazyPath.relative("src/hip_backend"));
         exe.addCSourceFile(.{ .file = .{ .path = "src/hip_backend/hip.c" }, .flags = &.{""} });
+        exe.linkLibrary(self.cpu_kernels);
 
         exe.step.dependOn(self.dep_steps);
         exe.addModule("ornament", self.ornament);
     }
+
+    // Links only the CPU backend, the HIP and WGPU backends must not be referenced by exe.
+    pub fn linkCpu(self: Package, exe: *std.Build.CompileStep) void {
+        exe.linkLibC();
+        exe.linkLibCpp();
+        exe.linkLibrary(self.cpu_kernels);
+        exe.addModule("ornament", self.ornament);
+    }
 };
 
 pub fn package(
     b: *std.Build,
+    target: std.zig.CrossTarget,
+    optimize: std.builtin.Mode,
     args: struct {
         deps: struct {
             zmath_pkg: *zmath.Package,
         },
+        options: struct {
+            trace: bool = false,
+            traversal_stats: bool = false,
+        } = .{},
     },
 ) Package {
     // HIP
@@ -110,8 +197,23 @@ pub fn package(
         "-o",
         b.pathJoin(&.{ b.exe_dir, "pathtracer.co" }),
     });
+    if (args.options.traversal_stats) build_hip_kernels.addArg("-DTRAVERSAL_STATS");
     build_hip_kernels.addArgs(hip_kernels_cpp.items);
 
+    // CPU, the HIP kernels built for the host with the runtime headers replaced by src/cpu_backend/kernels/include.
+    // Separate library, so the real HIP headers of the sdk are not on its include path.
+    const cpu_kernels = b.addStaticLibrary(.{
+        .name = "ornament_cpu_kernels",
+        .target = target,
+        // the kernels are always optimized like the hipcc build
+        .optimize = if (optimize == .Debug) .ReleaseSafe else optimize,
+    });
+    cpu_kernels.linkLibCpp();
+    cpu_kernels.addIncludePath(std.Build.LazyPath.relative("src/cpu_backend/kernels/include"));
+    cpu_kernels.addIncludePath(std.Build.LazyPath.relative(hip_kernels_path));
+    if (args.options.traversal_stats) cpu_kernels.defineCMacro("TRAVERSAL_STATS", null);
+    cpu_kernels.addCSourceFile(.{ .file = .{ .path = "src/cpu_backend/kernels/kernels.cpp" }, .flags = &.{"-std=c++17"} });
+
     // WGPU
     const install_wgpu = b.addInstallBinFile(std.build.LazyPath.relative("libs/wgpu-native/wgpu_native.dll"), "wgpu_native.dll");
 
@@ -119,13 +221,19 @@ pub fn package(
     dep_steps.* = std.Build.Step.init(.{ .id = .custom, .name = "ornament. install wgpu. build hip kernels", .owner = b });
     dep_steps.dependOn(&install_wgpu.step);
     dep_steps.dependOn(&build_hip_kernels.step);
+
+    const ornament_options = b.addOptions();
+    ornament_options.addOption(bool, "trace", args.options.trace);
+    ornament_options.addOption(bool, "traversal_stats", args.options.traversal_stats);
     return .{
         .ornament = b.createModule(.{
             .source_file = .{ .path = "src/ornament.zig" },
             .dependencies = &.{
                 .{ .name = "zmath", .module = args.deps.zmath_pkg.zmath },
+                .{ .name = "ornament_options", .module = ornament_options.createModule() },
             },
         }),
         .dep_steps = dep_steps,
+        .cpu_kernels = cpu_kernels,
     };
 }
@@ -5,6 +5,7 @@ const zstbi = @import("zstbi");
 const ornament = @import("ornament");
 const Viewport = @import("viewport.zig").Viewport;
 const FpsCounter = @import("fps_counter.zig").FpsCounter;
+const TripleBuffer = @import("triple_buffer.zig").TripleBuffer;
 const app_config = @import("app_config.zig");
 
 pub fn run() !void {
@@ -39,6 +40,8 @@ pub fn run() !void {
     path_tracer.state.setFlipY(app_config.FLIP_Y);
     path_tracer.state.setDepth(app_config.DEPTH);
     path_tracer.state.setIterations(app_config.ITERATIONS);
+    path_tracer.state.setTemporalReprojection(true);
+    path_tracer.state.setDynamicResolution(true);
     try path_tracer.setResolution(ornament.Resolution{ .width = app_config.WIDTH, .height = app_config.HEIGHT });
 
     var app = try App(@TypeOf(path_tracer)).init(allocator, path_tracer);
@@ -47,17 +50,39 @@ pub fn run() !void {
     try app.renderLoop();
 }
 
+// The path tracer renders on its own thread, so the event loop and the presentation keep the display rate
+// whatever a frame of the scene costs. The camera goes to the render thread through the views mailbox
+// and the frame buffers come back through the frames queue, both are lock-free triple buffers.
 fn App(comptime T: type) type {
     return struct {
         const Self = @This();
+
+        // Camera and resolution written by the event loop.
+        const View = struct {
+            eye: zmath.Vec,
+            target: zmath.Vec,
+            up: zmath.Vec,
+            resolution: ornament.Resolution,
+        };
+
+        const Frame = struct {
+            resolution: ornament.Resolution,
+            pixels: std.ArrayList([4]f32),
+        };
+
         allocator: std.mem.Allocator,
         window: *zglfw.Window,
-        resolution: ornament.Resolution,
+        // owned by the event loop
+        view: View,
+        // owned by the render thread once it is started
         path_tracer: T,
         wgpu_device_state: ornament.wgpu_backend.DeviceState,
         viewport: Viewport,
-        frame_buffer: [][4]f32,
-        recreate_viewport_and_frame_buffer: bool = false,
+        views: TripleBuffer(View),
+        frames: TripleBuffer(Frame),
+        quit: bool = false,
+        render_error: ?anyerror = null,
+        recreate_viewport: bool = false,
 
         pub fn init(allocator: std.mem.Allocator, path_tracer: T) !Self {
             std.log.debug("[glfw_wgpu] init", .{});
@@ -79,20 +104,28 @@ fn App(comptime T: type) type {
                 .{ .next_in_chain = @ptrCast(&surface_descriptor_from_windows) },
             );
 
+            const view = View{
+                .eye = path_tracer.scene.camera.getLookFrom(),
+                .target = path_tracer.scene.camera.getLookAt(),
+                .up = path_tracer.scene.camera.getVUp(),
+                .resolution = path_tracer.state.resolution,
+            };
+            const empty_frame = Frame{ .resolution = .{ .width = 0, .height = 0 }, .pixels = std.ArrayList([4]f32).init(allocator) };
             return .{
                 .allocator = allocator,
                 .window = window,
-                .resolution = path_tracer.state.resolution,
+                .view = view,
                 .path_tracer = path_tracer,
                 .wgpu_device_state = wgpu_device_state,
                 .viewport = try Viewport.init(&wgpu_device_state, path_tracer.state.resolution, null),
-                .frame_buffer = try allocator.alloc([4]f32, path_tracer.state.resolution.pixel_count()),
+                .views = TripleBuffer(View).init(.{ view, view, view }),
+                .frames = TripleBuffer(Frame).init(.{ empty_frame, empty_frame, empty_frame }),
             };
         }
 
         pub fn deinit(self: *Self) void {
             std.log.debug("[glfw_wgpu] deinit", .{});
-            self.allocator.free(self.frame_buffer);
+            for (&self.frames.slots) |*frame| frame.pixels.deinit();
             self.viewport.deinit();
             self.wgpu_device_state.deinit();
             self.window.destroy();
@@ -107,15 +140,23 @@ fn App(comptime T: type) type {
         fn onFramebufferSize(window: *zglfw.Window, width: i32, height: i32) callconv(.C) void {
             var self: *Self = window.getUserPointer(Self) orelse unreachable;
             const new_resolution = ornament.Resolution{ .width = @intCast(width), .height = @intCast(height) };
-            if (!std.meta.eql(self.resolution, new_resolution)) {
+            // a minimized window has no pixels to render
+            if (new_resolution.pixel_count() == 0) return;
+            if (!std.meta.eql(self.view.resolution, new_resolution)) {
                 std.log.debug("[glfw_wgpu] onFramebufferSize width = {d}, height = {d}", .{ width, height });
-                self.resolution = new_resolution;
-                self.path_tracer.scene.camera.setAspectRatio(@as(f32, @floatFromInt(width)) / @as(f32, @floatFromInt(height)));
-                self.path_tracer.setResolution(new_resolution) catch unreachable;
-                self.recreate_viewport_and_frame_buffer = true;
+                self.view.resolution = new_resolution;
+                self.recreate_viewport = true;
+                self.publishView();
             }
         }
 
+        fn publishView(self: *Self) void {
+            self.views.getBack().* = self.view;
+            self.views.publish();
+            // the iterations of the old view are not worth finishing
+            self.path_tracer.cancel();
+        }
+
         pub fn update(self: *Self) void {
             // WSDA
             {
@@ -125,9 +166,9 @@ fn App(comptime T: type) type {
                 const a_pressed = self.window.getKey(.a) == .press;
 
                 if (w_pressed or s_pressed or d_pressed or a_pressed) {
-                    const target = self.path_tracer.scene.camera.getLookAt();
-                    var eye = self.path_tracer.scene.camera.getLookFrom();
-                    const up = self.path_tracer.scene.camera.getVUp();
+                    const target = self.view.target;
+                    var eye = self.view.eye;
+                    const up = self.view.up;
                     var forward = target - eye;
                     const forward_norm = zmath.normalize3(forward);
                     var forward_mag = zmath.length3(forward);
@@ -155,30 +196,78 @@ fn App(comptime T: type) type {
                     if (a_pressed) {
                         eye = target - zmath.normalize3((forward + right * app_config.CAMERA_SPEED)) * forward_mag;
                     }
-                    self.path_tracer.scene.camera.setLookAt(eye, target, up);
+                    self.view.eye = eye;
+                    self.publishView();
                 }
             }
         }
 
         pub fn renderLoop(self: *Self) !void {
             std.log.debug("[glfw_wgpu] renderLoop", .{});
-            var fps_counter = FpsCounter.init();
+            const render_thread = try std.Thread.spawn(.{}, renderThread, .{self});
+            errdefer self.stopRenderThread(render_thread);
+
             while (!self.window.shouldClose() and self.window.getKey(.escape) != .press) {
+                if (@atomicLoad(bool, &self.quit, .Acquire)) break;
                 zglfw.pollEvents();
                 self.update();
-                if (self.recreate_viewport_and_frame_buffer) {
-                    self.recreate_viewport_and_frame_buffer = false;
-                    self.allocator.free(self.frame_buffer);
-                    self.frame_buffer = try self.allocator.alloc([4]f32, self.resolution.pixel_count());
-
+                if (self.recreate_viewport) {
+                    self.recreate_viewport = false;
                     self.viewport.deinit();
-                    self.viewport = try Viewport.init(&self.wgpu_device_state, self.resolution, null);
+                    self.viewport = try Viewport.init(&self.wgpu_device_state, self.view.resolution, null);
                     std.log.debug("[glfw_wgpu] viewport was created", .{});
                 }
 
+                // frames rendered before a resize are dropped, the viewport keeps the last one until the next frame
+                if (self.frames.update()) {
+                    const frame = self.frames.getFront();
+                    if (std.meta.eql(frame.resolution, self.viewport.resolution)) {
+                        try self.viewport.renderFrameBuffer(frame.pixels.items);
+                        continue;
+                    }
+                }
+                // presenting waits for the display
+                try self.viewport.render();
+            }
+            self.stopRenderThread(render_thread);
+            if (self.render_error) |err| return err;
+        }
+
+        fn stopRenderThread(self: *Self, render_thread: std.Thread) void {
+            @atomicStore(bool, &self.quit, true, .Release);
+            // stops the running render at its next cancellation point
+            self.path_tracer.cancel();
+            render_thread.join();
+        }
+
+        fn renderThread(self: *Self) void {
+            self.renderFrames() catch |err| {
+                std.log.err("[glfw_wgpu] render thread failed: {s}", .{@errorName(err)});
+                self.render_error = err;
+                @atomicStore(bool, &self.quit, true, .Release);
+            };
+        }
+
+        fn renderFrames(self: *Self) !void {
+            var fps_counter = FpsCounter.init();
+            while (!@atomicLoad(bool, &self.quit, .Acquire)) {
+                if (self.views.update()) {
+                    const view = self.views.getFront();
+                    const camera = &self.path_tracer.scene.camera;
+                    if (!std.meta.eql(self.path_tracer.state.getResolution(), view.resolution)) {
+                        camera.setAspectRatio(@as(f32, @floatFromInt(view.resolution.width)) / @as(f32, @floatFromInt(view.resolution.height)));
+                        try self.path_tracer.setResolution(view.resolution);
+                    }
+                    camera.setLookAt(view.eye, view.target, view.up);
+                }
+
                 try self.path_tracer.render();
-                try self.path_tracer.getFrameBuffer(self.frame_buffer);
-                try self.viewport.renderFrameBuffer(self.frame_buffer);
+                const frame = self.frames.getBack();
+                const resolution = self.path_tracer.state.getResolution();
+                try frame.pixels.resize(resolution.pixel_count());
+                try self.path_tracer.getFrameBuffer(frame.pixels.items);
+                frame.resolution = resolution;
+                self.frames.publish();
                 fps_counter.endFrames(app_config.ITERATIONS);
             }
         }
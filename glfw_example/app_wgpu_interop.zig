@@ -50,17 +50,29 @@ const App = struct {
         path_tracer.state.setFlipY(app_config.FLIP_Y);
         path_tracer.state.setDepth(app_config.DEPTH);
         path_tracer.state.setIterations(app_config.ITERATIONS);
+        path_tracer.state.setTemporalReprojection(true);
+        path_tracer.state.setDynamicResolution(true);
+        path_tracer.state.setOutputFormat(.rgba32f);
         try path_tracer.setResolution(ornament.Resolution{ .width = app_config.WIDTH, .height = app_config.HEIGHT });
 
-        const target_buffer = try path_tracer.getOrCreateTargetBuffer();
         return .{
             .allocator = allocator,
             .window = window,
             .path_tracer = path_tracer,
-            .viewport = try Viewport.init(&path_tracer.device_state, path_tracer.state.getResolution(), &target_buffer.buffer),
+            .viewport = try createViewport(&path_tracer),
         };
     }
 
+    // The viewport draws the frame buffer of the path tracer in place and reads its pixels as rgba32f.
+    fn createViewport(path_tracer: *ornament.WgpuPathTracer) !Viewport {
+        const target_buffer = try path_tracer.getOrCreateTargetBuffer();
+        if (target_buffer.output_format != .rgba32f) {
+            std.log.err("[glfw_wgpu] the viewport supports only the rgba32f output format, not {s}", .{@tagName(target_buffer.output_format)});
+            return error.UnsupportedOutputFormat;
+        }
+        return Viewport.init(&path_tracer.device_state, path_tracer.state.getResolution(), &target_buffer.buffer);
+    }
+
     pub fn deinit(self: *Self) void {
         std.log.debug("[glfw_wgpu] deinit", .{});
         self.viewport.deinit();
@@ -141,8 +153,7 @@ const App = struct {
             if (self.recreate_viewport) {
                 self.recreate_viewport = false;
                 self.viewport.deinit();
-                const target_buffer = try self.path_tracer.getOrCreateTargetBuffer();
-                self.viewport = try Viewport.init(&self.path_tracer.device_state, self.path_tracer.state.getResolution(), &target_buffer.buffer);
+                self.viewport = try createViewport(&self.path_tracer);
                 std.log.debug("[glfw_wgpu] viewport was created", .{});
             }
             try self.viewport.render();
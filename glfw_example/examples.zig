@@ -12,6 +12,11 @@ const c = @cImport({
 var prng = std.rand.DefaultPrng.init(100);
 const rand = prng.random();
 
+// The scenes take their random spheres and colors from one generator, reseeding it makes a scene reproducible.
+pub fn setSeed(seed: u64) void {
+    prng = std.rand.DefaultPrng.init(seed);
+}
+
 fn randomColor() zmath.Vec {
     return zmath.f32x4(
         rand.float(f32),
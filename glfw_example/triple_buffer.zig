@@ -0,0 +1,45 @@
+const std = @import("std");
+
+// Lock-free exchange of the latest value between one writer thread and one reader thread.
+// The writer fills the back slot and publishes it, the reader takes the last published slot with update,
+// neither of them waits for the other and the values published in between are dropped.
+pub fn TripleBuffer(comptime T: type) type {
+    return struct {
+        const Self = @This();
+        // set in middle while the reader hasn't taken the published slot
+        const FRESH: u8 = 4;
+
+        slots: [3]T,
+        // slot between the writer and the reader, only changed by the atomic swaps
+        middle: u8,
+        // owned by the writer
+        back: u8,
+        // owned by the reader
+        front: u8,
+
+        pub fn init(slots: [3]T) Self {
+            return .{ .slots = slots, .middle = 1, .back = 0, .front = 2 };
+        }
+
+        pub fn getBack(self: *Self) *T {
+            return &self.slots[self.back];
+        }
+
+        pub fn publish(self: *Self) void {
+            const previous = @atomicRmw(u8, &self.middle, .Xchg, self.back | FRESH, .AcqRel);
+            self.back = previous & ~FRESH;
+        }
+
+        // Takes the last published slot, false if nothing was published since the previous update.
+        pub fn update(self: *Self) bool {
+            if (@atomicLoad(u8, &self.middle, .Acquire) & FRESH == 0) return false;
+            const previous = @atomicRmw(u8, &self.middle, .Xchg, self.front, .AcqRel);
+            self.front = previous & ~FRESH;
+            return true;
+        }
+
+        pub fn getFront(self: *Self) *T {
+            return &self.slots[self.front];
+        }
+    };
+}
@@ -0,0 +1,100 @@
+const std = @import("std");
+const zmath = @import("zmath");
+const ornament = @import("ornament");
+
+// Batch rendering of camera jobs over one scene, the bvh and the thread pool of the path tracer are built once.
+// The jobs file is JSON:
+//   {
+//     "scene": "spheres",
+//     "jobs": [
+//       { "output": "front.ppm", "width": 1280, "height": 720, "samples": 256,
+//         "lookfrom": [13, 2, 3], "lookat": [0, 0, 0] },
+//       { "output": "turntable.ppm", "width": 640, "height": 640, "samples": 64,
+//         "lookfrom": [13, 2, 3], "lookat": [0, 0, 0], "vfov": 30, "turntable_frames": 36 }
+//     ]
+//   }
+// A turntable rotates lookfrom around lookat about vup in turntable_frames steps,
+// the frame number is added to the output name: turntable_0000.ppm, turntable_0001.ppm, ...
+
+pub const Job = struct {
+    // binary PPM
+    output: []const u8,
+    width: u32,
+    height: u32,
+    samples: u32,
+    lookfrom: [3]f32,
+    lookat: [3]f32,
+    vup: [3]f32 = .{ 0.0, 1.0, 0.0 },
+    vfov: f32 = 20.0,
+    aperture: f32 = 0.0,
+    focus_dist: f32 = 10.0,
+    depth: u32 = 10,
+    gamma: f32 = 2.2,
+    turntable_frames: u32 = 1,
+};
+
+pub const JobsFile = struct {
+    scene: []const u8,
+    jobs: []const Job,
+};
+
+pub fn run(allocator: std.mem.Allocator, jobs_path: []const u8, loader: ornament.render_server.SceneLoader) !void {
+    const source = try std.fs.cwd().readFileAlloc(allocator, jobs_path, 16 * 1024 * 1024);
+    defer allocator.free(source);
+    const parsed = try std.json.parseFromSlice(JobsFile, allocator, source, .{});
+    defer parsed.deinit();
+    const jobs_file = parsed.value;
+    for (jobs_file.jobs) |job| {
+        if (job.width == 0 or job.height == 0 or job.turntable_frames == 0) return error.InvalidJob;
+    }
+
+    var scene = ornament.Scene.init(allocator);
+    loader(allocator, jobs_file.scene, &scene) catch |err| {
+        scene.deinit();
+        return err;
+    };
+    var timer = try std.time.Timer.start();
+    // the path tracer owns the scene
+    var path_tracer = ornament.CpuPathTracer.init(allocator, scene) catch |err| {
+        scene.deinit();
+        return err;
+    };
+    defer path_tracer.deinit();
+    std.log.info("[headless] scene {s} loaded in {d} ms", .{ jobs_file.scene, timer.lap() / std.time.ns_per_ms });
+
+    for (jobs_file.jobs) |job| {
+        path_tracer.state.setDepth(job.depth);
+        path_tracer.state.setGamma(job.gamma);
+        const lookat = zmath.loadArr3w(job.lookat, 1.0);
+        const vup = zmath.loadArr3(job.vup);
+        const offset = zmath.loadArr3(job.lookfrom) - zmath.loadArr3(job.lookat);
+        var frame: u32 = 0;
+        while (frame < job.turntable_frames) : (frame += 1) {
+            const angle = 2.0 * std.math.pi * @as(f32, @floatFromInt(frame)) / @as(f32, @floatFromInt(job.turntable_frames));
+            const lookfrom = lookat + zmath.mul(offset, zmath.matFromAxisAngle(zmath.normalize3(vup), angle));
+            path_tracer.scene.camera = ornament.Camera.init(
+                lookfrom,
+                lookat,
+                vup,
+                @as(f32, @floatFromInt(job.width)) / @as(f32, @floatFromInt(job.height)),
+                job.vfov,
+                job.aperture,
+                job.focus_dist,
+            );
+
+            const output = if (job.turntable_frames == 1)
+                try allocator.dupe(u8, job.output)
+            else
+                try frameOutput(allocator, job.output, frame);
+            defer allocator.free(output);
+            try path_tracer.renderBuckets(output, .{ .width = job.width, .height = job.height }, job.samples);
+            std.log.info("[headless] {s} rendered in {d} ms", .{ output, timer.lap() / std.time.ns_per_ms });
+        }
+    }
+}
+
+// "dir/name.ppm" -> "dir/name_0007.ppm"
+fn frameOutput(allocator: std.mem.Allocator, output: []const u8, frame: u32) ![]u8 {
+    const extension = std.fs.path.extension(output);
+    return std.fmt.allocPrint(allocator, "{s}_{d:0>4}{s}", .{ output[0 .. output.len - extension.len], frame, extension });
+}
@@ -0,0 +1,63 @@
+const std = @import("std");
+const ornament = @import("ornament");
+const scenes = @import("scenes.zig");
+const batch = @import("batch.zig");
+
+const usage =
+    \\usage:
+    \\  headless_example coordinator <address> <port> <workers> <width> <height> <samples per task> <passes> <output.ppm>
+    \\  headless_example worker <address> <port>
+    \\  headless_example server <socket path>
+    \\  headless_example batch <jobs.json>
+    \\
+;
+
+const DEPTH = 10;
+const GAMMA = 2.2;
+
+pub fn main() !void {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    const allocator = gpa.allocator();
+    defer if (gpa.deinit() == .leak) @panic("[headless] memory leak");
+
+    const args = try std.process.argsAlloc(allocator);
+    defer std.process.argsFree(allocator, args);
+
+    if (args.len == 10 and std.mem.eql(u8, args[1], "coordinator")) {
+        const address = try std.net.Address.parseIp(args[2], try std.fmt.parseInt(u16, args[3], 10));
+        const resolution = ornament.Resolution{
+            .width = try std.fmt.parseInt(u32, args[5], 10),
+            .height = try std.fmt.parseInt(u32, args[6], 10),
+        };
+        try ornament.distributed.runCoordinator(allocator, address, try std.fmt.parseInt(u32, args[4], 10), .{
+            .resolution = resolution,
+            .samples_per_task = try std.fmt.parseInt(u32, args[7], 10),
+            .passes = try std.fmt.parseInt(u32, args[8], 10),
+            .inverted_gamma = 1.0 / GAMMA,
+        }, args[9]);
+    } else if (args.len == 4 and std.mem.eql(u8, args[1], "worker")) {
+        const address = try std.net.Address.parseIp(args[2], try std.fmt.parseInt(u16, args[3], 10));
+        // runWorker sets the aspect ratio of the camera for the resolution of the tasks
+        var scene = ornament.Scene.init(allocator);
+        try scenes.init_spheres(&scene, 1.0);
+        var path_tracer = try ornament.CpuPathTracer.init(allocator, scene);
+        defer path_tracer.deinit();
+        path_tracer.state.setDepth(DEPTH);
+        try ornament.distributed.runWorker(allocator, &path_tracer, address);
+    } else if (args.len == 3 and std.mem.eql(u8, args[1], "server")) {
+        var server = ornament.RenderServer(ornament.CpuPathTracer).init(allocator, loadScene, 4);
+        defer server.deinit();
+        try server.serve(args[2]);
+    } else if (args.len == 3 and std.mem.eql(u8, args[1], "batch")) {
+        try batch.run(allocator, args[2], loadScene);
+    } else {
+        try std.io.getStdErr().writeAll(usage);
+        std.process.exit(1);
+    }
+}
+
+fn loadScene(allocator: std.mem.Allocator, name: []const u8, scene: *ornament.Scene) !void {
+    _ = allocator;
+    if (std.mem.eql(u8, name, "spheres")) return scenes.init_spheres(scene, 1.0);
+    return error.UnknownScene;
+}
@@ -0,0 +1,59 @@
+const std = @import("std");
+const zmath = @import("zmath");
+const ornament = @import("ornament");
+
+// Scenes built only from spheres, so the headless example needs no assets.
+
+pub fn init_spheres(scene: *ornament.Scene, aspect_ratio: f32) !void {
+    // fixed seed, every process of a distributed render builds the same scene
+    var prng = std.rand.DefaultPrng.init(100);
+    const rand = prng.random();
+
+    scene.camera = ornament.Camera.init(
+        zmath.f32x4(13.0, 2.0, 3.0, 1.0),
+        zmath.f32x4(0.0, 0.0, 0.0, 1.0),
+        zmath.f32x4(0.0, 1.0, 0.0, 0.0),
+        aspect_ratio,
+        20.0,
+        0.1,
+        10.0,
+    );
+
+    try scene.attachSphere(try scene.createSphere(
+        zmath.f32x4(0.0, -1000.0, 0.0, 1.0),
+        1000.0,
+        try scene.lambertian(.{ .vec = zmath.f32x4(0.5, 0.5, 0.5, 1.0) }),
+    ));
+
+    var a: f32 = -11.0;
+    while (a < 11.0) : (a += 1.0) {
+        var b: f32 = -11.0;
+        while (b < 11.0) : (b += 1.0) {
+            const choose_mat = rand.float(f32);
+            const center = zmath.f32x4(a + 0.9 * rand.float(f32), 0.2, b + 0.9 * rand.float(f32), 1.0);
+
+            if (zmath.length3(center - zmath.f32x4(4.0, 0.2, 0.0, 0.0))[0] > 0.9) {
+                const color = zmath.f32x4(rand.float(f32), rand.float(f32), rand.float(f32), 1.0);
+                const material = try if (choose_mat < 0.8)
+                    scene.lambertian(.{ .vec = color * color })
+                else if (choose_mat < 0.95)
+                    scene.metal(.{ .vec = zmath.f32x4s(0.5) + color * zmath.f32x4s(0.5) }, 0.5 * rand.float(f32))
+                else
+                    scene.dielectric(1.5);
+                try scene.attachSphere(try scene.createSphere(center, 0.2, material));
+            }
+        }
+    }
+
+    try scene.attachSphere(try scene.createSphere(zmath.f32x4(0.0, 1.0, 0.0, 1.0), 1.0, try scene.dielectric(1.5)));
+    try scene.attachSphere(try scene.createSphere(
+        zmath.f32x4(-4.0, 1.0, 0.0, 1.0),
+        1.0,
+        try scene.lambertian(.{ .vec = zmath.f32x4(0.4, 0.2, 0.1, 1.0) }),
+    ));
+    try scene.attachSphere(try scene.createSphere(
+        zmath.f32x4(4.0, 1.0, 0.0, 1.0),
+        1.0,
+        try scene.metal(.{ .vec = zmath.f32x4(0.7, 0.6, 0.5, 1.0) }, 0.0),
+    ));
+}
@@ -2,7 +2,11 @@ const std = @import("std");
 const zmath = @import("zmath");
 const Material = @import("material.zig").Material;
 const gpu_structs = @import("gpu_structs.zig");
+const math = @import("math.zig");
+const environment_map = @import("environment_map.zig");
 const ornament = @import("ornament.zig");
+const trace = @import("trace.zig");
+const util = @import("util.zig");
 const Scene = ornament.Scene;
 const Aabb = ornament.Aabb;
 const Sphere = ornament.Sphere;
@@ -19,8 +23,13 @@ pub const Bvh = struct {
     // nodes = shapes * 2 - 1
     // BLAS nodes count of one mesh:
     // nodes = triangles * 2 - 1
+    // LIGHT nodes count:
+    // lights = emissive spheres + emissive triangles
+    // nodes = lights * 2 - 1
     tlas_nodes: std.ArrayList(gpu_structs.BvhNode),
     blas_nodes: std.ArrayList(gpu_structs.BvhNode),
+    light_nodes: std.ArrayList(gpu_structs.LightNode),
+    lights: std.ArrayList(gpu_structs.Light),
     normals: std.ArrayList(gpu_structs.Normal),
     normal_indices: std.ArrayList(u32),
     uvs: std.ArrayList(gpu_structs.Uv),
@@ -28,9 +37,13 @@ pub const Bvh = struct {
     transforms: std.ArrayList(gpu_structs.Transform),
     materials: std.ArrayList(gpu_structs.Material),
     textures: std.ArrayList(*ornament.Texture),
+    environment_map: gpu_structs.EnvironmentMap,
+    environment_alias_table: std.ArrayList(gpu_structs.AliasEntry),
     row_major_transforms: bool,
 
     pub fn init(allocator: std.mem.Allocator, scene: *const ornament.Scene, row_major_transforms: bool) std.mem.Allocator.Error!Self {
+        const span = trace.begin("Bvh.init");
+        defer span.end();
         const shapes_count = scene.spheres.items.len + scene.meshes.items.len + scene.mesh_instances.items.len;
         if (shapes_count == 0) {
             @panic("[ornament] scene cannot be empty.");
@@ -52,6 +65,8 @@ pub const Bvh = struct {
         var self = Self{
             .tlas_nodes = try std.ArrayList(gpu_structs.BvhNode).initCapacity(allocator, tlas_nodes_count),
             .blas_nodes = try std.ArrayList(gpu_structs.BvhNode).initCapacity(allocator, blas_nodes_count),
+            .light_nodes = std.ArrayList(gpu_structs.LightNode).init(allocator),
+            .lights = std.ArrayList(gpu_structs.Light).init(allocator),
             .normals = try std.ArrayList(gpu_structs.Normal).initCapacity(allocator, normals_count),
             .normal_indices = try std.ArrayList(u32).initCapacity(allocator, normal_indices_count),
             .uvs = try std.ArrayList(gpu_structs.Uv).initCapacity(allocator, uvs_count),
@@ -59,6 +74,8 @@ pub const Bvh = struct {
             .transforms = try std.ArrayList(gpu_structs.Transform).initCapacity(allocator, shapes_count),
             .materials = std.ArrayList(gpu_structs.Material).init(allocator),
             .textures = std.ArrayList(*ornament.Texture).init(allocator),
+            .environment_map = gpu_structs.EnvironmentMap.none,
+            .environment_alias_table = std.ArrayList(gpu_structs.AliasEntry).init(allocator),
             .row_major_transforms = row_major_transforms,
         };
         std.log.debug("[ornament] bvh building.", .{});
@@ -71,15 +88,24 @@ pub const Bvh = struct {
         std.log.debug("[ornament] actual bvh.tlas_nodes: {d}", .{self.tlas_nodes.items.len});
         std.log.debug("[ornament] expected bvh.blas_nodes: {d}", .{blas_nodes_count});
         std.log.debug("[ornament] actual bvh.blas_nodes: {d}", .{self.blas_nodes.items.len});
+        std.log.debug("[ornament] lights: {d}", .{self.lights.items.len});
+        std.log.debug("[ornament] bvh.light_nodes: {d}", .{self.light_nodes.items.len});
         std.debug.assert(tlas_nodes_count == self.tlas_nodes.items.len);
         std.debug.assert(blas_nodes_count == self.blas_nodes.items.len);
 
         return self;
     }
 
+    // Bytes of the host arrays.
+    pub fn memoryBytes(self: *const Self) usize {
+        return util.arrayListsBytes(self.*);
+    }
+
     pub fn deinit(self: *Self) void {
         self.tlas_nodes.deinit();
         self.blas_nodes.deinit();
+        self.light_nodes.deinit();
+        self.lights.deinit();
         self.normals.deinit();
         self.normal_indices.deinit();
         self.uvs.deinit();
@@ -87,6 +113,7 @@ pub const Bvh = struct {
         self.transforms.deinit();
         self.materials.deinit();
         self.textures.deinit();
+        self.environment_alias_table.deinit();
     }
 
     fn build(allocator: std.mem.Allocator, bvh: *Bvh, scene: *const Scene) std.mem.Allocator.Error!void {
@@ -98,13 +125,26 @@ pub const Bvh = struct {
 
         for (scene.spheres.items) |s| try leafs.append(.{ .sphere = s });
         for (scene.mesh_instances.items) |mi| try leafs.append(.{ .mesh_instance = mi });
+
+        // first global triangle id of every mesh, emissive triangles refer to it
+        var mesh_triangle_offsets = std.AutoHashMap(*const Mesh, u32).init(allocator);
+        defer mesh_triangle_offsets.deinit();
         for (scene.meshes.items) |m| {
             try leafs.append(.{ .mesh = m });
+            try mesh_triangle_offsets.put(m, @as(u32, @truncate(bvh.normal_indices.items.len / 3)));
             try buildMeshBvhRecursive(allocator, bvh, m);
         }
 
         const root = try buildBvhTlasRecursive(allocator, bvh, leafs.items);
         try bvh.tlas_nodes.append(root);
+
+        try buildLightBvh(allocator, bvh, scene, &mesh_triangle_offsets);
+
+        if (scene.environment_map) |texture| {
+            const texture_id = try getTextureId(bvh, texture);
+            bvh.environment_map = .{ .texture_id = texture_id, .width = texture.width, .height = texture.height };
+            try environment_map.buildAliasTable(allocator, texture, &bvh.environment_alias_table);
+        }
     }
 };
 
@@ -361,18 +401,250 @@ fn buildBvhTlasRecursive(allocator: std.mem.Allocator, bvh: *Bvh, leafs: []Leaf)
     }
 }
 
+const LightCone = struct {
+    axis: zmath.Vec,
+    cos_theta_o: f32,
+    cos_theta_e: f32,
+};
+
+const LightLeaf = struct {
+    light: gpu_structs.Light,
+    aabb: Aabb,
+    centroid: zmath.Vec,
+    cone: LightCone,
+    power: f32,
+};
+
+fn centroidCompareLight(axis: usize, a: LightLeaf, b: LightLeaf) bool {
+    return a.centroid[axis] < b.centroid[axis];
+}
+
+fn buildLightBvh(
+    allocator: std.mem.Allocator,
+    bvh: *Bvh,
+    scene: *const Scene,
+    mesh_triangle_offsets: *const std.AutoHashMap(*const Mesh, u32),
+) std.mem.Allocator.Error!void {
+    var leafs = std.ArrayList(LightLeaf).init(allocator);
+    defer leafs.deinit();
+
+    for (scene.spheres.items) |s| {
+        if (s.material.type != .DiffuseLight) continue;
+        const center = (s.aabb.min + s.aabb.max) * zmath.f32x4s(0.5);
+        const radius = (s.aabb.max[0] - s.aabb.min[0]) * 0.5;
+        const area = 4.0 * std.math.pi * radius * radius;
+        try leafs.append(.{
+            .light = .{
+                .v0_or_center = zmath.vecToArr3(center),
+                .light_type = .Sphere,
+                .material_index = try getMaterialIndex(bvh, s.material),
+                .radius = radius,
+                .area = area,
+
+                .v1 = undefined,
+                .v2 = undefined,
+                .triangle_id = undefined,
+            },
+            .aabb = s.aabb,
+            .centroid = center,
+            // normals of a sphere cover the whole sphere of directions
+            .cone = .{ .axis = math.unit_y, .cos_theta_o = -1.0, .cos_theta_e = 0.0 },
+            .power = emittedPower(s.material, area),
+        });
+    }
+
+    for (scene.meshes.items) |m| {
+        if (m.material.type != .DiffuseLight) continue;
+        try appendMeshLights(bvh, &leafs, m, m.transform, m.material, mesh_triangle_offsets.get(m) orelse unreachable);
+    }
+
+    for (scene.mesh_instances.items) |mi| {
+        if (mi.material.type != .DiffuseLight) continue;
+        try appendMeshLights(bvh, &leafs, mi.mesh, mi.transform, mi.material, mesh_triangle_offsets.get(mi.mesh) orelse unreachable);
+    }
+
+    if (leafs.items.len == 0) {
+        return;
+    }
+
+    try bvh.lights.ensureTotalCapacity(leafs.items.len);
+    try bvh.light_nodes.ensureTotalCapacity(leafs.items.len * 2 - 1);
+    const root = try buildLightBvhRecursive(bvh, leafs.items);
+    try bvh.light_nodes.append(root);
+}
+
+fn appendMeshLights(
+    bvh: *Bvh,
+    leafs: *std.ArrayList(LightLeaf),
+    mesh: *const Mesh,
+    transform: zmath.Mat,
+    material: *Material,
+    triangle_offset: u32,
+) std.mem.Allocator.Error!void {
+    const material_index = try getMaterialIndex(bvh, material);
+    const triangles_count = mesh.vertex_indices.items.len / 3;
+    try leafs.ensureUnusedCapacity(triangles_count);
+
+    var mesh_triangle_index: usize = 0;
+    while (mesh_triangle_index < triangles_count) : (mesh_triangle_index += 1) {
+        const v0 = zmath.mul(mesh.vertices.items[mesh.vertex_indices.items[mesh_triangle_index * 3]], transform);
+        const v1 = zmath.mul(mesh.vertices.items[mesh.vertex_indices.items[mesh_triangle_index * 3 + 1]], transform);
+        const v2 = zmath.mul(mesh.vertices.items[mesh.vertex_indices.items[mesh_triangle_index * 3 + 2]], transform);
+        const normal = zmath.cross3(v1 - v0, v2 - v0);
+        const double_area = zmath.length3(normal)[0];
+        // degenerate triangles don't emit anything
+        if (double_area == 0.0) continue;
+
+        var aabb = Aabb.init(v0, v0);
+        aabb.grow(v1);
+        aabb.grow(v2);
+        const area = 0.5 * double_area;
+        const global_triangle_index = @as(u32, @truncate(triangle_offset + mesh_triangle_index));
+        leafs.appendAssumeCapacity(.{
+            .light = .{
+                .v0_or_center = zmath.vecToArr3(v0),
+                .light_type = .Triangle,
+                .v1 = zmath.vecToArr3(v1),
+                .material_index = material_index,
+                .v2 = zmath.vecToArr3(v2),
+                .triangle_id = global_triangle_index * 3,
+                .area = area,
+
+                .radius = undefined,
+            },
+            .aabb = aabb,
+            .centroid = (v0 + v1 + v2) / zmath.f32x4s(3.0),
+            .cone = .{ .axis = normal / zmath.f32x4s(double_area), .cos_theta_o = 1.0, .cos_theta_e = 0.0 },
+            // diffuse lights emit from both sides of a triangle
+            .power = emittedPower(material, 2.0 * area),
+        });
+    }
+}
+
+fn emittedPower(material: *const Material, area: f32) f32 {
+    const luminance = switch (material.albedo) {
+        .vec => |v| 0.2126 * v[0] + 0.7152 * v[1] + 0.0722 * v[2],
+        // textured emitters are not integrated, assume unit luminance
+        .texture => 1.0,
+    };
+    return std.math.pi * luminance * area;
+}
+
+fn buildLightBvhRecursive(bvh: *Bvh, leafs: []LightLeaf) std.mem.Allocator.Error!gpu_structs.LightNode {
+    if (leafs.len == 0) {
+        @panic("don't support empty bvh");
+    } else if (leafs.len == 1) {
+        const l = leafs[0];
+        try bvh.lights.append(l.light);
+        return .{
+            .aabb_min = zmath.vecToArr3(l.aabb.min),
+            .left_or_light_id = @as(u32, @truncate(bvh.lights.items.len - 1)),
+            .aabb_max = zmath.vecToArr3(l.aabb.max),
+            .axis = zmath.vecToArr3(l.cone.axis),
+            .node_type = gpu_structs.LightNodeType.Light,
+            .power = l.power,
+            .cos_theta_o = l.cone.cos_theta_o,
+            .cos_theta_e = l.cone.cos_theta_e,
+
+            .right = undefined,
+        };
+    } else {
+        // Sort emitters along the axis with the largest centroid extent
+        var centroids = Aabb.init(leafs[0].centroid, leafs[0].centroid);
+        for (leafs[1..]) |l| centroids.grow(l.centroid);
+        const extent = centroids.max - centroids.min;
+        var axis: usize = 0;
+        if (extent[1] > extent[axis]) axis = 1;
+        if (extent[2] > extent[axis]) axis = 2;
+        std.sort.heap(LightLeaf, leafs, axis, centroidCompareLight);
+
+        // Partition emitters into left and right subsets
+        const mid = leafs.len / 2;
+        const left_leafs = leafs[0..mid];
+        const right_leafs = leafs[mid..];
+
+        // Recursively build BVH for left and right subsets
+        const left = try buildLightBvhRecursive(bvh, left_leafs);
+        try bvh.light_nodes.append(left);
+        const left_id = bvh.light_nodes.items.len - 1;
+
+        const right = try buildLightBvhRecursive(bvh, right_leafs);
+        try bvh.light_nodes.append(right);
+        const right_id = bvh.light_nodes.items.len - 1;
+
+        const cone = unionCones(lightNodeCone(left), lightNodeCone(right));
+        return .{
+            .aabb_min = zmath.vecToArr3(zmath.min(zmath.loadArr3(left.aabb_min), zmath.loadArr3(right.aabb_min))),
+            .left_or_light_id = @as(u32, @truncate(left_id)),
+            .aabb_max = zmath.vecToArr3(zmath.max(zmath.loadArr3(left.aabb_max), zmath.loadArr3(right.aabb_max))),
+            .right = @as(u32, @truncate(right_id)),
+            .axis = zmath.vecToArr3(cone.axis),
+            .node_type = gpu_structs.LightNodeType.InternalNode,
+            .power = left.power + right.power,
+            .cos_theta_o = cone.cos_theta_o,
+            .cos_theta_e = cone.cos_theta_e,
+        };
+    }
+}
+
+fn lightNodeCone(node: gpu_structs.LightNode) LightCone {
+    return .{ .axis = zmath.loadArr3(node.axis), .cos_theta_o = node.cos_theta_o, .cos_theta_e = node.cos_theta_e };
+}
+
+// Smallest cone that bounds both cones of normals.
+fn unionCones(a: LightCone, b: LightCone) LightCone {
+    const cos_theta_e = @min(a.cos_theta_e, b.cos_theta_e);
+    const theta_a = std.math.acos(std.math.clamp(a.cos_theta_o, -1.0, 1.0));
+    const theta_b = std.math.acos(std.math.clamp(b.cos_theta_o, -1.0, 1.0));
+    const theta_d = std.math.acos(std.math.clamp(zmath.dot3(a.axis, b.axis)[0], -1.0, 1.0));
+    const entire_sphere = LightCone{ .axis = a.axis, .cos_theta_o = -1.0, .cos_theta_e = cos_theta_e };
+
+    if (@min(theta_d + theta_b, std.math.pi) <= theta_a) {
+        return .{ .axis = a.axis, .cos_theta_o = a.cos_theta_o, .cos_theta_e = cos_theta_e };
+    }
+
+    if (@min(theta_d + theta_a, std.math.pi) <= theta_b) {
+        return .{ .axis = b.axis, .cos_theta_o = b.cos_theta_o, .cos_theta_e = cos_theta_e };
+    }
+
+    const theta_o = (theta_a + theta_d + theta_b) / 2.0;
+    if (theta_o >= std.math.pi) {
+        return entire_sphere;
+    }
+
+    const rotation_axis = zmath.cross3(a.axis, b.axis);
+    if (zmath.lengthSq3(rotation_axis)[0] == 0.0) {
+        return entire_sphere;
+    }
+
+    // rotate a.axis towards b.axis (Rodrigues' formula, k is orthogonal to a.axis)
+    const k = zmath.normalize3(rotation_axis);
+    const theta_r = theta_o - theta_a;
+    const axis = a.axis * zmath.f32x4s(@cos(theta_r)) + zmath.cross3(k, a.axis) * zmath.f32x4s(@sin(theta_r));
+    return .{ .axis = zmath.normalize3(axis), .cos_theta_o = @cos(theta_o), .cos_theta_e = cos_theta_e };
+}
+
 fn appendTransform(bvh: *Bvh, transform: zmath.Mat) !void {
     const t = if (bvh.row_major_transforms) zmath.transpose(transform) else transform;
     try bvh.transforms.append(zmath.matToArr(t));
 }
 
+// A texture shared by materials and the environment map is uploaded once.
+// texture_id may be left from an earlier build, so the textures of this bvh are searched.
+fn getTextureId(bvh: *Bvh, texture: *ornament.Texture) std.mem.Allocator.Error!u32 {
+    for (bvh.textures.items, 0..) |t, i| {
+        if (t == texture) return @as(u32, @truncate(i));
+    }
+    try bvh.textures.append(texture);
+    const texture_id = @as(u32, @truncate(bvh.textures.items.len - 1));
+    texture.texture_id = texture_id;
+    return texture_id;
+}
+
 fn getMaterialIndex(bvh: *Bvh, material: *Material) std.mem.Allocator.Error!u32 {
     return material.material_index orelse {
         switch (material.albedo) {
-            .texture => |texture| {
-                try bvh.textures.append(texture);
-                texture.texture_id = @as(u32, @truncate(bvh.textures.items.len - 1));
-            },
+            .texture => |texture| _ = try getTextureId(bvh, texture),
             else => {},
         }
         try bvh.materials.append(gpu_structs.Material.from(material));
@@ -0,0 +1,297 @@
+const std = @import("std");
+const util = @import("util.zig");
+const gpu_structs = @import("gpu_structs.zig");
+const ornament = @import("ornament.zig");
+const State = @import("state.zig").State;
+const Bvh = @import("bvh.zig").Bvh;
+
+pub const CheckpointError = error{
+    InvalidCheckpoint,
+    ResolutionMismatch,
+    SceneMismatch,
+};
+
+// Per pixel state of a progressive render, enough to continue it after a restart with the same result.
+// The file is the header followed by the arrays in the order of the fields.
+pub const Checkpoint = struct {
+    const Self = @This();
+    const Vector4 = gpu_structs.Vector4;
+    pub const MAGIC = [8]u8{ 'O', 'R', 'N', 'C', 'K', 'P', 'T', 0 };
+    pub const VERSION: u32 = 1;
+    // bytes of the arrays per pixel
+    const PIXEL_BYTES = 3 * @sizeOf(Vector4) + @sizeOf(f32) + @sizeOf(u32);
+
+    pub const Header = extern struct {
+        magic: [8]u8 = MAGIC,
+        version: u32 = VERSION,
+        width: u32,
+        height: u32,
+        current_iteration: f32,
+        // see renderHash
+        render_hash: u64,
+    };
+
+    allocator: std.mem.Allocator,
+    header: Header,
+    accumulation: []Vector4,
+    second_moment: []f32,
+    albedo: []Vector4,
+    normal: []Vector4,
+    rng_state: []u32,
+
+    pub fn init(allocator: std.mem.Allocator, resolution: util.Resolution) !Self {
+        const pixels_count = resolution.pixel_count();
+        var self = Self{
+            .allocator = allocator,
+            .header = .{ .width = resolution.width, .height = resolution.height, .current_iteration = 0.0, .render_hash = 0 },
+            .accumulation = &.{},
+            .second_moment = &.{},
+            .albedo = &.{},
+            .normal = &.{},
+            .rng_state = &.{},
+        };
+        errdefer self.deinit();
+        self.accumulation = try allocator.alloc(Vector4, pixels_count);
+        self.second_moment = try allocator.alloc(f32, pixels_count);
+        self.albedo = try allocator.alloc(Vector4, pixels_count);
+        self.normal = try allocator.alloc(Vector4, pixels_count);
+        self.rng_state = try allocator.alloc(u32, pixels_count);
+        return self;
+    }
+
+    pub fn deinit(self: *Self) void {
+        self.allocator.free(self.accumulation);
+        self.allocator.free(self.second_moment);
+        self.allocator.free(self.albedo);
+        self.allocator.free(self.normal);
+        self.allocator.free(self.rng_state);
+    }
+
+    pub fn getResolution(self: *const Self) util.Resolution {
+        return .{ .width = self.header.width, .height = self.header.height };
+    }
+
+    // The header is checked against resolution and the size of the file before the arrays are allocated.
+    pub fn load(allocator: std.mem.Allocator, path: []const u8, resolution: util.Resolution) !Self {
+        var file = try std.fs.cwd().openFile(path, .{});
+        defer file.close();
+
+        var header: Header = undefined;
+        if (try file.readAll(std.mem.asBytes(&header)) != @sizeOf(Header)) return CheckpointError.InvalidCheckpoint;
+        if (!std.mem.eql(u8, &header.magic, &MAGIC) or header.version != VERSION) return CheckpointError.InvalidCheckpoint;
+        if (header.width != resolution.width or header.height != resolution.height) return CheckpointError.ResolutionMismatch;
+        const file_size = (try file.stat()).size;
+        if (file_size != @sizeOf(Header) + @as(u64, resolution.pixel_count()) * PIXEL_BYTES) return CheckpointError.InvalidCheckpoint;
+
+        var self = try Self.init(allocator, resolution);
+        errdefer self.deinit();
+        self.header = header;
+        inline for (.{ "accumulation", "second_moment", "albedo", "normal", "rng_state" }) |name| {
+            const bytes = std.mem.sliceAsBytes(@field(self, name));
+            if (try file.readAll(bytes) != bytes.len) return CheckpointError.InvalidCheckpoint;
+        }
+        return self;
+    }
+
+    // Writes a temporary file next to path and renames it, so a crash never leaves a truncated checkpoint.
+    pub fn save(self: *const Self, path: []const u8) !void {
+        var tmp_path_buffer: [std.fs.MAX_PATH_BYTES]u8 = undefined;
+        const tmp_path = try std.fmt.bufPrint(&tmp_path_buffer, "{s}.tmp", .{path});
+        {
+            var file = try std.fs.cwd().createFile(tmp_path, .{});
+            defer file.close();
+            var buffered = std.io.bufferedWriter(file.writer());
+            const writer = buffered.writer();
+            try writer.writeAll(std.mem.asBytes(&self.header));
+            inline for (.{ "accumulation", "second_moment", "albedo", "normal", "rng_state" }) |name| {
+                try writer.writeAll(std.mem.sliceAsBytes(@field(self, name)));
+            }
+            try buffered.flush();
+            try file.sync();
+        }
+        try std.fs.cwd().rename(tmp_path, path);
+    }
+
+    pub fn validate(self: *const Self, render_hash: u64) CheckpointError!void {
+        if (self.header.render_hash != render_hash) return CheckpointError.SceneMismatch;
+    }
+};
+
+// saveCheckpoint and loadCheckpoint of the backends. path_tracer is the path tracer of a backend,
+// its readCheckpointBuffers and writeCheckpointBuffers copy the per pixel state between its target buffer and a checkpoint.
+
+// Hands a snapshot of the accumulation to the writer once its interval passed and the previous
+// checkpoint is written, the file is written on the writer thread. Returns whether a checkpoint was taken.
+pub fn save(path_tracer: anytype, writer: *CheckpointWriter) !bool {
+    // the accumulation of a moved camera or of a partial stride pattern is not worth keeping
+    if (path_tracer.scene.camera.dirty or path_tracer.state.isFirstCycle()) return false;
+    const snapshot = (try writer.acquire(path_tracer.state.getResolution())) orelse return false;
+    snapshot.header.current_iteration = path_tracer.state.current_iteration;
+    snapshot.header.render_hash = renderHash(path_tracer.scene_hash, &path_tracer.scene.camera, &path_tracer.state, path_tracer.environment_map);
+    try path_tracer.readCheckpointBuffers(snapshot);
+    writer.submit();
+    return true;
+}
+
+// Continues the render saved to path, the resolution, the scene, the camera and the path depth must be the same.
+pub fn load(path_tracer: anytype, path: []const u8) !void {
+    var snapshot = try Checkpoint.load(path_tracer.allocator, path, path_tracer.state.getResolution());
+    defer snapshot.deinit();
+    try snapshot.validate(renderHash(path_tracer.scene_hash, &path_tracer.scene.camera, &path_tracer.state, path_tracer.environment_map));
+
+    try path_tracer.writeCheckpointBuffers(&snapshot);
+    path_tracer.state.restore(snapshot.header.current_iteration);
+    path_tracer.scene.camera.dirty = false;
+    path_tracer.history_camera = null;
+    path_tracer.reprojection = null;
+}
+
+// Writes checkpoints on its own thread, the render thread only fills the staging checkpoint.
+// A checkpoint is taken once interval_ns passed since the previous one and the previous file is written.
+pub const CheckpointWriter = struct {
+    const Self = @This();
+    allocator: std.mem.Allocator,
+    path: []u8,
+    interval_ns: u64,
+    timer: std.time.Timer,
+    checkpoint: ?Checkpoint,
+    thread: std.Thread,
+    mutex: std.Thread.Mutex,
+    condition: std.Thread.Condition,
+    // the staging checkpoint belongs to the writer thread
+    pending: bool,
+    shutdown: bool,
+    write_error: ?anyerror,
+
+    pub fn init(allocator: std.mem.Allocator, path: []const u8, interval_ns: u64) !*Self {
+        var self = try allocator.create(Self);
+        errdefer allocator.destroy(self);
+        self.* = .{
+            .allocator = allocator,
+            .path = try allocator.dupe(u8, path),
+            .interval_ns = interval_ns,
+            .timer = try std.time.Timer.start(),
+            .checkpoint = null,
+            .thread = undefined,
+            .mutex = .{},
+            .condition = .{},
+            .pending = false,
+            .shutdown = false,
+            .write_error = null,
+        };
+        errdefer allocator.free(self.path);
+        self.thread = try std.Thread.spawn(.{}, writerMain, .{self});
+        return self;
+    }
+
+    // Waits for the pending checkpoint to be written.
+    pub fn deinit(self: *Self) void {
+        self.mutex.lock();
+        self.shutdown = true;
+        self.condition.signal();
+        self.mutex.unlock();
+        self.thread.join();
+
+        if (self.checkpoint) |*checkpoint| checkpoint.deinit();
+        self.allocator.free(self.path);
+        self.allocator.destroy(self);
+    }
+
+    // Staging checkpoint to fill and submit, null when it is too early or the previous checkpoint is still being written.
+    // Returns the error of the previous write if it failed.
+    pub fn acquire(self: *Self, resolution: util.Resolution) !?*Checkpoint {
+        if (self.timer.read() < self.interval_ns) return null;
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        if (self.pending) return null;
+        if (self.write_error) |err| {
+            self.write_error = null;
+            self.timer.reset();
+            return err;
+        }
+
+        if (self.checkpoint) |*checkpoint| {
+            if (std.meta.eql(checkpoint.getResolution(), resolution)) return checkpoint;
+            checkpoint.deinit();
+            self.checkpoint = null;
+        }
+        self.checkpoint = try Checkpoint.init(self.allocator, resolution);
+        return &self.checkpoint.?;
+    }
+
+    pub fn submit(self: *Self) void {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        self.pending = true;
+        self.timer.reset();
+        self.condition.signal();
+    }
+
+    fn writerMain(self: *Self) void {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        while (true) {
+            while (!self.pending and !self.shutdown) self.condition.wait(&self.mutex);
+            if (!self.pending) return;
+
+            self.mutex.unlock();
+            const result = self.checkpoint.?.save(self.path);
+            self.mutex.lock();
+            self.pending = false;
+            result catch |err| {
+                std.log.err("[ornament] checkpoint {s} was not written: {s}", .{ self.path, @errorName(err) });
+                self.write_error = err;
+            };
+        }
+    }
+};
+
+// Hash of the data the accumulated samples depend on, built once per scene.
+pub fn sceneHash(bvh: *const Bvh) u64 {
+    var hasher = std.hash.Wyhash.init(0);
+    inline for (.{
+        "tlas_nodes",
+        "blas_nodes",
+        "light_nodes",
+        "lights",
+        "normals",
+        "normal_indices",
+        "uvs",
+        "uv_indices",
+        "transforms",
+        "materials",
+        "environment_alias_table",
+    }) |name| {
+        for (@field(bvh, name).items) |item| hashValue(&hasher, item);
+    }
+    for (bvh.textures.items) |texture| {
+        hashValue(&hasher, [_]u32{ texture.width, texture.height, texture.num_components, texture.bytes_per_component });
+        hasher.update(texture.data.items);
+    }
+    return hasher.final();
+}
+
+// A checkpoint continues only a render of the same scene, environment map, camera and path depth.
+pub fn renderHash(scene_hash: u64, camera: *const ornament.Camera, state: *const State, environment_map: gpu_structs.EnvironmentMap) u64 {
+    var hasher = std.hash.Wyhash.init(scene_hash);
+    hashValue(&hasher, environment_map);
+    hashValue(&hasher, gpu_structs.Camera.from(camera));
+    hashValue(&hasher, state.depth);
+    hashValue(&hasher, state.ray_cast_epsilon);
+    return hasher.final();
+}
+
+// Hashes the values of fields, the undefined _padding fields of the gpu structs are skipped.
+fn hashValue(hasher: *std.hash.Wyhash, value: anytype) void {
+    const T = @TypeOf(value);
+    switch (@typeInfo(T)) {
+        .Struct => |info| inline for (info.fields) |field| {
+            if (comptime !std.mem.startsWith(u8, field.name, "_padding")) hashValue(hasher, @field(value, field.name));
+        },
+        .Array => for (value) |item| hashValue(hasher, item),
+        .Float => hasher.update(std.mem.asBytes(&value)),
+        .Int, .Bool => hasher.update(std.mem.asBytes(&value)),
+        .Enum => hashValue(hasher, @intFromEnum(value)),
+        else => @compileError("cannot hash " ++ @typeName(T)),
+    }
+}
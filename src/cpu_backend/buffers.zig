@@ -0,0 +1,259 @@
+const std = @import("std");
+const util = @import("../util.zig");
+const gpu_structs = @import("../gpu_structs.zig");
+const ornament = @import("../ornament.zig");
+const Denoiser = @import("../denoiser.zig").Denoiser;
+const Checkpoint = @import("../checkpoint.zig").Checkpoint;
+const options = @import("ornament_options");
+
+// float4 is 16 bytes aligned in the kernels, arrays are allocated with the same alignment.
+pub const ALIGNMENT = 16;
+
+pub const Target = struct {
+    const Self = @This();
+    allocator: std.mem.Allocator,
+    // pixels of output_format
+    buffer: []align(ALIGNMENT) u8,
+    // pixels of accumulation_format
+    accumulation_buffer: []align(ALIGNMENT) u8,
+    second_moment_buffer: []f32,
+    albedo_buffer: []align(ALIGNMENT) gpu_structs.Vector4,
+    normal_buffer: []align(ALIGNMENT) gpu_structs.Vector4,
+    denoised_buffer: []align(ALIGNMENT) gpu_structs.Vector4,
+    position_buffer: []align(ALIGNMENT) gpu_structs.Vector4,
+    history_accumulation_buffer: []align(ALIGNMENT) u8,
+    history_second_moment_buffer: []f32,
+    history_position_buffer: []align(ALIGNMENT) gpu_structs.Vector4,
+    rng_state_buffer: []u32,
+    render_stats: gpu_structs.RenderStats,
+    // counts of the frame and of the last traced sample of every pixel, empty without options.traversal_stats
+    traversal_stats: gpu_structs.TraversalTotals,
+    traversal_heatmap: []gpu_structs.TraversalStats,
+    resolution: util.Resolution,
+    output_format: util.OutputFormat,
+    accumulation_format: util.AccumulationFormat,
+
+    pub fn init(allocator: std.mem.Allocator, resolution: util.Resolution, output_format: util.OutputFormat, accumulation_format: util.AccumulationFormat) !Self {
+        const pixels_count = resolution.pixel_count();
+        var self = Self{
+            .allocator = allocator,
+            .buffer = &.{},
+            .accumulation_buffer = &.{},
+            .second_moment_buffer = &.{},
+            .albedo_buffer = &.{},
+            .normal_buffer = &.{},
+            .denoised_buffer = &.{},
+            .position_buffer = &.{},
+            .history_accumulation_buffer = &.{},
+            .history_second_moment_buffer = &.{},
+            .history_position_buffer = &.{},
+            .rng_state_buffer = &.{},
+            .render_stats = .{},
+            .traversal_stats = .{},
+            .traversal_heatmap = &.{},
+            .resolution = resolution,
+            .output_format = output_format,
+            .accumulation_format = accumulation_format,
+        };
+        errdefer self.deinit();
+        self.buffer = try allocator.alignedAlloc(u8, ALIGNMENT, pixels_count * output_format.bytesPerPixel());
+        self.accumulation_buffer = try allocator.alignedAlloc(u8, ALIGNMENT, pixels_count * accumulation_format.bytesPerPixel());
+        self.second_moment_buffer = try allocator.alloc(f32, pixels_count);
+        self.albedo_buffer = try allocator.alignedAlloc(gpu_structs.Vector4, ALIGNMENT, pixels_count);
+        self.normal_buffer = try allocator.alignedAlloc(gpu_structs.Vector4, ALIGNMENT, pixels_count);
+        self.denoised_buffer = try allocator.alignedAlloc(gpu_structs.Vector4, ALIGNMENT, pixels_count);
+        self.position_buffer = try allocator.alignedAlloc(gpu_structs.Vector4, ALIGNMENT, pixels_count);
+        self.history_accumulation_buffer = try allocator.alignedAlloc(u8, ALIGNMENT, pixels_count * accumulation_format.bytesPerPixel());
+        self.history_second_moment_buffer = try allocator.alloc(f32, pixels_count);
+        self.history_position_buffer = try allocator.alignedAlloc(gpu_structs.Vector4, ALIGNMENT, pixels_count);
+        self.rng_state_buffer = try allocator.alloc(u32, pixels_count);
+        for (self.rng_state_buffer, 0..) |*value, index| {
+            value.* = @truncate(index);
+        }
+        if (options.traversal_stats) {
+            self.traversal_heatmap = try allocator.alloc(gpu_structs.TraversalStats, pixels_count);
+            @memset(self.traversal_heatmap, .{});
+        }
+        return self;
+    }
+
+    pub fn deinit(self: *Self) void {
+        self.allocator.free(self.buffer);
+        self.allocator.free(self.accumulation_buffer);
+        self.allocator.free(self.second_moment_buffer);
+        self.allocator.free(self.albedo_buffer);
+        self.allocator.free(self.normal_buffer);
+        self.allocator.free(self.denoised_buffer);
+        self.allocator.free(self.position_buffer);
+        self.allocator.free(self.history_accumulation_buffer);
+        self.allocator.free(self.history_second_moment_buffer);
+        self.allocator.free(self.history_position_buffer);
+        self.allocator.free(self.rng_state_buffer);
+        self.allocator.free(self.traversal_heatmap);
+    }
+
+    pub fn memoryBytes(self: *const Self) usize {
+        var bytes: usize = 0;
+        inline for (@typeInfo(Self).Struct.fields) |field| {
+            const info = @typeInfo(field.type);
+            if (info == .Pointer and info.Pointer.size == .Slice) bytes += std.mem.sliceAsBytes(@field(self, field.name)).len;
+        }
+        return bytes;
+    }
+
+    pub fn resetRenderStats(self: *Self) void {
+        self.render_stats = .{};
+    }
+
+    pub fn resetCycleStats(self: *Self) void {
+        self.render_stats.active_pixel_count = 0;
+        self.render_stats.error_sum_low = 0;
+        self.render_stats.error_sum_high = 0;
+    }
+
+    pub fn resetRayCount(self: *Self) void {
+        self.render_stats.secondary_ray_count_low = 0;
+        self.render_stats.secondary_ray_count_high = 0;
+    }
+
+    pub fn resetTraversalStats(self: *Self) void {
+        self.traversal_stats = .{};
+    }
+
+    // Keeps the accumulation for the reprojection after a camera move.
+    pub fn saveHistory(self: *Self) void {
+        @memcpy(self.history_accumulation_buffer, self.accumulation_buffer);
+        @memcpy(self.history_second_moment_buffer, self.second_moment_buffer);
+        @memcpy(self.history_position_buffer, self.position_buffer);
+    }
+
+    pub fn readDenoiserInputs(self: *const Self, denoiser: *Denoiser) void {
+        self.accumulation_format.decode(self.accumulation_buffer, denoiser.accumulation);
+        @memcpy(denoiser.albedo, self.albedo_buffer);
+        @memcpy(denoiser.normal, self.normal_buffer);
+        @memcpy(denoiser.second_moment, self.second_moment_buffer);
+    }
+
+    pub fn writeDenoised(self: *Self, src: []const gpu_structs.Vector4) void {
+        @memcpy(self.denoised_buffer, src);
+    }
+
+    pub fn readCheckpoint(self: *const Self, checkpoint: *Checkpoint) void {
+        self.accumulation_format.decode(self.accumulation_buffer, checkpoint.accumulation);
+        @memcpy(checkpoint.second_moment, self.second_moment_buffer);
+        @memcpy(checkpoint.albedo, self.albedo_buffer);
+        @memcpy(checkpoint.normal, self.normal_buffer);
+        @memcpy(checkpoint.rng_state, self.rng_state_buffer);
+    }
+
+    pub fn writeCheckpoint(self: *Self, checkpoint: *const Checkpoint) void {
+        self.accumulation_format.encode(checkpoint.accumulation, self.accumulation_buffer);
+        @memcpy(self.second_moment_buffer, checkpoint.second_moment);
+        @memcpy(self.albedo_buffer, checkpoint.albedo);
+        @memcpy(self.normal_buffer, checkpoint.normal);
+        @memcpy(self.rng_state_buffer, checkpoint.rng_state);
+    }
+};
+
+// Same layout as Array<T> of the kernels.
+pub fn Array(comptime T: type) type {
+    return extern struct {
+        const Self = @This();
+        ptr: [*]align(ALIGNMENT) T,
+        len: u32,
+
+        pub fn init(allocator: std.mem.Allocator, host_array: []const T) !Self {
+            const data = try allocator.alignedAlloc(T, ALIGNMENT, host_array.len);
+            @memcpy(data, host_array);
+            return .{
+                .ptr = data.ptr,
+                .len = @as(u32, @truncate(host_array.len)),
+            };
+        }
+
+        pub fn deinit(self: *Self, allocator: std.mem.Allocator) void {
+            allocator.free(self.ptr[0..self.len]);
+        }
+
+        pub fn bytes(self: *const Self) usize {
+            return @as(usize, self.len) * @sizeOf(T);
+        }
+    };
+}
+
+// Mirrors CpuTexture of kernels/include/hip/hip_runtime.h.
+pub const Texture = extern struct {
+    texels: [*]align(ALIGNMENT) const gpu_structs.Vector4,
+    width: u32,
+    height: u32,
+};
+
+// Textures are decoded to rgba floats once, tex2D of the kernels then reads them without conversions.
+// Values are normalized like the HIP textures return them, missing components are 0 and alpha is 1.
+pub const Textures = struct {
+    const Self = @This();
+    allocator: std.mem.Allocator,
+    texture_data: [][]align(ALIGNMENT) gpu_structs.Vector4,
+    texture_objects: []Texture,
+    device_texture_objects: Array(*const Texture),
+
+    pub fn init(allocator: std.mem.Allocator, textures: []const *ornament.Texture) !Self {
+        var texture_data = try allocator.alloc([]align(ALIGNMENT) gpu_structs.Vector4, textures.len);
+        var decoded: usize = 0;
+        errdefer {
+            for (texture_data[0..decoded]) |td| allocator.free(td);
+            allocator.free(texture_data);
+        }
+        var texture_objects = try allocator.alloc(Texture, textures.len);
+        errdefer allocator.free(texture_objects);
+        var pointers = try allocator.alloc(*const Texture, textures.len);
+        defer allocator.free(pointers);
+
+        for (textures, 0..) |txt, i| {
+            texture_data[i] = try decode(allocator, txt);
+            decoded += 1;
+            texture_objects[i] = .{ .texels = texture_data[i].ptr, .width = txt.width, .height = txt.height };
+            pointers[i] = &texture_objects[i];
+        }
+        return .{
+            .allocator = allocator,
+            .texture_data = texture_data,
+            .texture_objects = texture_objects,
+            .device_texture_objects = try Array(*const Texture).init(allocator, pointers),
+        };
+    }
+
+    pub fn deinit(self: *Self) void {
+        for (self.texture_data) |td| self.allocator.free(td);
+        self.allocator.free(self.texture_data);
+        self.allocator.free(self.texture_objects);
+        self.device_texture_objects.deinit(self.allocator);
+    }
+
+    pub fn memoryBytes(self: *const Self) usize {
+        var bytes = std.mem.sliceAsBytes(self.texture_objects).len + self.device_texture_objects.bytes();
+        for (self.texture_data) |td| bytes += std.mem.sliceAsBytes(td).len;
+        return bytes;
+    }
+
+    fn decode(allocator: std.mem.Allocator, txt: *const ornament.Texture) ![]align(ALIGNMENT) gpu_structs.Vector4 {
+        var texels = try allocator.alignedAlloc(gpu_structs.Vector4, ALIGNMENT, txt.width * txt.height);
+        for (texels, 0..) |*texel, i| {
+            texel.* = .{ 0.0, 0.0, 0.0, 1.0 };
+            const offset = i * txt.num_components * txt.bytes_per_component;
+            for (0..@min(txt.num_components, 4)) |c| {
+                const bytes = txt.data.items[offset + c * txt.bytes_per_component ..];
+                texel[c] = switch (txt.bytes_per_component) {
+                    1 => @as(f32, @floatFromInt(bytes[0])) / 255.0,
+                    2 => if (txt.is_hdr)
+                        @as(f32, @floatCast(@as(f16, @bitCast(std.mem.readIntLittle(u16, bytes[0..2])))))
+                    else
+                        @as(f32, @floatFromInt(std.mem.readIntLittle(u16, bytes[0..2]))) / 65535.0,
+                    4 => @as(f32, @bitCast(std.mem.readIntLittle(u32, bytes[0..4]))),
+                    else => unreachable,
+                };
+            }
+        }
+        return texels;
+    }
+};
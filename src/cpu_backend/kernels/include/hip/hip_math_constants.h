@@ -0,0 +1,4 @@
+#pragma once
+
+#define HIP_PI_F 3.141592654f
+#define HIP_PI 3.1415926535897931
@@ -0,0 +1,81 @@
+#pragma once
+
+// Host replacement of the HIP runtime header, enough of it to compile the
+// kernels of src/hip_backend/kernels with a regular C++ compiler.
+
+#include <stdint.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <hiprt/hiprt_vec.h>
+
+#define __global__
+// every worker thread renders with its own copy of the constants, see kernels.cpp
+#define __constant__ thread_local
+#define __shared__
+
+struct uint2 { uint32_t x, y; };
+struct uint3 { uint32_t x, y, z; };
+struct dim3 { uint32_t x, y, z; };
+
+inline uint2 make_uint2(uint32_t x, uint32_t y) { return { x, y }; }
+inline uint3 make_uint3(uint32_t x, uint32_t y, uint32_t z) { return { x, y, z }; }
+
+// The __global__ kernels are compiled but never launched on the host,
+// work is distributed by the tile functions of kernels.cpp instead.
+static const dim3 blockDim = { 1, 1, 1 };
+static const dim3 blockIdx = { 0, 0, 0 };
+static const dim3 threadIdx = { 0, 0, 0 };
+
+inline float min(float a, float b) { return fminf(a, b); }
+inline float max(float a, float b) { return fmaxf(a, b); }
+inline int min(int a, int b) { return a < b ? a : b; }
+inline int max(int a, int b) { return a > b ? a : b; }
+inline uint32_t min(uint32_t a, uint32_t b) { return a < b ? a : b; }
+inline uint32_t max(uint32_t a, uint32_t b) { return a > b ? a : b; }
+
+inline uint32_t __float_as_uint(float x)
+{
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    return bits;
+}
+
+inline float __uint_as_float(uint32_t x)
+{
+    float value;
+    memcpy(&value, &x, sizeof(value));
+    return value;
+}
+
+inline uint32_t atomicAdd(uint32_t* address, uint32_t value) { return __atomic_fetch_add(address, value, __ATOMIC_RELAXED); }
+inline unsigned long long atomicAdd(unsigned long long* address, unsigned long long value) { return __atomic_fetch_add(address, value, __ATOMIC_RELAXED); }
+
+// sincosf is a GNU extension of the C library
+inline void host_sincosf(float x, float* s, float* c)
+{
+    *s = sinf(x);
+    *c = cosf(x);
+}
+#define sincosf host_sincosf
+
+// Texels are decoded to rgba floats when the textures are uploaded, see src/cpu_backend/buffers.zig.
+struct CpuTexture
+{
+    const hiprtFloat4* texels;
+    uint32_t width;
+    uint32_t height;
+};
+
+typedef const CpuTexture* hipTextureObject_t;
+
+// Point filtering with normalized coordinates and the wrap address mode, as the HIP textures are created.
+template <typename T>
+inline T tex2D(hipTextureObject_t texture, float u, float v)
+{
+    int32_t x = (int32_t)floorf(u * (float)texture->width) % (int32_t)texture->width;
+    int32_t y = (int32_t)floorf(v * (float)texture->height) % (int32_t)texture->height;
+    if (x < 0) { x += texture->width; }
+    if (y < 0) { y += texture->height; }
+    return texture->texels[(uint32_t)y * texture->width + (uint32_t)x];
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+// Host vector types with the layout of the HIP ones, vec_math.hip.h maps float2/3/4 to them.
+
+struct hiprtInt2 { int x, y; };
+struct hiprtInt3 { int x, y, z; };
+struct alignas(16) hiprtInt4 { int x, y, z, w; };
+
+struct alignas(8) hiprtFloat2 { float x, y; };
+struct hiprtFloat3 { float x, y, z; };
+struct alignas(16) hiprtFloat4 { float x, y, z, w; };
+
+inline hiprtInt2 make_hiprtInt2(int x, int y) { return { x, y }; }
+inline hiprtInt3 make_hiprtInt3(int x, int y, int z) { return { x, y, z }; }
+inline hiprtInt4 make_hiprtInt4(int x, int y, int z, int w) { return { x, y, z, w }; }
+
+inline hiprtFloat2 make_hiprtFloat2(float x, float y) { return { x, y }; }
+inline hiprtFloat3 make_hiprtFloat3(float x, float y, float z) { return { x, y, z }; }
+inline hiprtFloat4 make_hiprtFloat4(float x, float y, float z, float w) { return { x, y, z, w }; }
@@ -0,0 +1,73 @@
+// Host build of the HIP kernels, include/ replaces the HIP runtime headers.
+#include "pathtracer.hip.cpp"
+
+// constant_params is thread local on the host, the tile functions take the constants with every call.
+
+// Traces the pixels of the tile [x0, x1) x [y0, y1) which belong to the current offset of the pixel stride.
+extern "C" void cpu_path_tracing_tile(const KernalGlobals* kg, const ConstantParams* params, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+    constant_params = *params;
+    uint2 resolution = make_uint2(constant_params.width, constant_params.height);
+    uint32_t stride = constant_params.pixel_stride;
+    uint32_t offset = pixel_offset_index();
+    uint32_t x_offset = offset % stride;
+    uint32_t y_offset = offset / stride;
+    for (uint32_t y = y0; y < y1; y++)
+    {
+        if (y % stride != y_offset) { continue; }
+        for (uint32_t x = x0 + (x_offset + stride - x0 % stride) % stride; x < x1; x += stride)
+        {
+            KernalLocalState kls(*kg, resolution, y * resolution.x + x);
+            kls.kg.accumulation_buffer.store(kls.global_invocation_id, path_tracing(&kls));
+            kls.save_rng_seed();
+            kls.save_traversal_stats();
+        }
+    }
+}
+
+extern "C" void cpu_post_processing_tile(const KernalGlobals* kg, const ConstantParams* params, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+    constant_params = *params;
+    uint2 resolution = make_uint2(constant_params.width, constant_params.height);
+    for (uint32_t y = y0; y < y1; y++)
+    {
+        for (uint32_t x = x0; x < x1; x++)
+        {
+            KernalLocalState kls(*kg, resolution, y * resolution.x + x);
+            uint32_t traced_id = traced_pixel_id(kls.xy);
+            float4 accumulated_rgba = constant_params.denoise != 0
+                ? kls.kg.denoised_buffer[traced_id]
+                : kls.kg.accumulation_buffer.load(traced_id);
+            post_processing(&kls, kls.global_invocation_id, accumulated_rgba);
+        }
+    }
+}
+
+// Bucket rendering, the buffers of kg hold only the bucket [x0, x1) x [y0, y1) row by row,
+// while the camera rays are generated for the pixels of the whole image.
+// Reprojection and the pixel stride are not supported, params must have them disabled.
+extern "C" void cpu_path_tracing_bucket(const KernalGlobals* kg, const ConstantParams* params, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+    constant_params = *params;
+    uint2 bucket_resolution = make_uint2(x1 - x0, y1 - y0);
+    for (uint32_t id = 0; id < bucket_resolution.x * bucket_resolution.y; id++)
+    {
+        KernalLocalState kls(*kg, bucket_resolution, id);
+        kls.xy = make_uint2(x0 + kls.xy.x, y0 + kls.xy.y);
+        kls.kg.accumulation_buffer.store(id, path_tracing(&kls));
+        kls.save_rng_seed();
+        kls.save_traversal_stats();
+    }
+}
+
+// params.flip_y must be 0, the rows of the bucket are written in order.
+extern "C" void cpu_post_processing_bucket(const KernalGlobals* kg, const ConstantParams* params, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+    constant_params = *params;
+    uint2 bucket_resolution = make_uint2(x1 - x0, y1 - y0);
+    for (uint32_t id = 0; id < bucket_resolution.x * bucket_resolution.y; id++)
+    {
+        KernalLocalState kls(*kg, bucket_resolution, id);
+        post_processing(&kls, id, kls.kg.accumulation_buffer.load(id));
+    }
+}
@@ -0,0 +1,573 @@
+const std = @import("std");
+
+const buffers = @import("buffers.zig");
+const tile_scheduler = @import("../tile_scheduler.zig");
+const TileScheduler = tile_scheduler.TileScheduler;
+const Tile = tile_scheduler.Tile;
+const PpmWriter = @import("../ppm_writer.zig").PpmWriter;
+const ornament = @import("../ornament.zig");
+const State = @import("../state.zig").State;
+const Scene = @import("../scene.zig").Scene;
+const util = @import("../util.zig");
+const Bvh = @import("../bvh.zig").Bvh;
+const gpu_structs = @import("../gpu_structs.zig");
+const Denoiser = @import("../denoiser.zig").Denoiser;
+const checkpoint = @import("../checkpoint.zig");
+const trace = @import("../trace.zig");
+const PeakAllocator = @import("../peak_allocator.zig").PeakAllocator;
+const options = @import("ornament_options");
+
+// Layout of KernalGlobals of the kernels.
+const KernalGlobals = extern struct {
+    bvh: extern struct {
+        tlas_nodes: buffers.Array(gpu_structs.BvhNode),
+        blas_nodes: buffers.Array(gpu_structs.BvhNode),
+        normals: buffers.Array(gpu_structs.Normal),
+        normal_indices: buffers.Array(u32),
+        uvs: buffers.Array(gpu_structs.Uv),
+        uv_indices: buffers.Array(u32),
+        transforms: buffers.Array(gpu_structs.Transform),
+    },
+    light_bvh: extern struct {
+        nodes: buffers.Array(gpu_structs.LightNode),
+        lights: buffers.Array(gpu_structs.Light),
+    },
+    environment_map: extern struct {
+        alias_table: buffers.Array(gpu_structs.AliasEntry),
+    },
+    materials: buffers.Array(gpu_structs.Material),
+    textures: buffers.Array(*const buffers.Texture),
+    framebuffer: [*]u8,
+    accumulation_buffer: [*]u8,
+    second_moment_buffer: [*]f32,
+    albedo_buffer: [*]gpu_structs.Vector4,
+    normal_buffer: [*]gpu_structs.Vector4,
+    denoised_buffer: [*]gpu_structs.Vector4,
+    position_buffer: [*]gpu_structs.Vector4,
+    history: extern struct {
+        accumulation_buffer: [*]u8,
+        second_moment_buffer: [*]f32,
+        position_buffer: [*]gpu_structs.Vector4,
+    },
+    render_stats: *gpu_structs.RenderStats,
+    traversal_stats: ?*gpu_structs.TraversalTotals,
+    traversal_heatmap: ?[*]gpu_structs.TraversalStats,
+    rng_seed_buffer: [*]u32,
+    pixel_count: u32,
+};
+
+// kernels/kernels.cpp, the HIP kernels built for the host
+const TileKernal = fn (*const KernalGlobals, *const gpu_structs.ConstantParams, u32, u32, u32, u32) callconv(.C) void;
+extern fn cpu_path_tracing_tile(kg: *const KernalGlobals, params: *const gpu_structs.ConstantParams, x0: u32, y0: u32, x1: u32, y1: u32) void;
+extern fn cpu_post_processing_tile(kg: *const KernalGlobals, params: *const gpu_structs.ConstantParams, x0: u32, y0: u32, x1: u32, y1: u32) void;
+extern fn cpu_path_tracing_bucket(kg: *const KernalGlobals, params: *const gpu_structs.ConstantParams, x0: u32, y0: u32, x1: u32, y1: u32) void;
+extern fn cpu_post_processing_bucket(kg: *const KernalGlobals, params: *const gpu_structs.ConstantParams, x0: u32, y0: u32, x1: u32, y1: u32) void;
+
+// Runs the path tracing kernels on the cores of the host, see TileScheduler.
+pub const PathTracer = struct {
+    const Self = @This();
+    allocator: std.mem.Allocator,
+    scene: Scene,
+    state: State,
+    scheduler: *TileScheduler,
+    // Morton ordered tiles of the target buffer
+    tiles: []Tile,
+
+    target_buffer: ?buffers.Target,
+    textures: buffers.Textures,
+    materials: buffers.Array(gpu_structs.Material),
+    normals: buffers.Array(gpu_structs.Normal),
+    normal_indices: buffers.Array(u32),
+    uvs: buffers.Array(gpu_structs.Uv),
+    uv_indices: buffers.Array(u32),
+    transforms: buffers.Array(gpu_structs.Transform),
+    tlas_nodes: buffers.Array(gpu_structs.BvhNode),
+    blas_nodes: buffers.Array(gpu_structs.BvhNode),
+    light_nodes: buffers.Array(gpu_structs.LightNode),
+    lights: buffers.Array(gpu_structs.Light),
+    environment_alias_table: buffers.Array(gpu_structs.AliasEntry),
+    environment_map: gpu_structs.EnvironmentMap,
+
+    constant_params: gpu_structs.ConstantParams,
+    // identifies the scene of checkpoints, see checkpoint.renderHash
+    scene_hash: u64,
+    bvh_memory: util.BvhMemory,
+    denoiser: Denoiser,
+    cancellation: util.Cancellation,
+    // camera of the last rendered iteration, null when there is no history to reproject
+    history_camera: ?gpu_structs.Camera,
+    // camera of the saved history while pixels take their first samples after a move
+    reprojection: ?gpu_structs.Camera,
+
+    pub fn init(allocator: std.mem.Allocator, scene: Scene) !Self {
+        const span = trace.begin("cpu.init");
+        defer span.end();
+        const state = State.init();
+
+        var bvh_allocator = PeakAllocator.init(allocator);
+        var bvh = try Bvh.init(bvh_allocator.allocator(), &scene, true);
+        defer bvh.deinit();
+
+        const scheduler = try TileScheduler.init(allocator);
+        std.log.debug("[ornament] cpu path tracer uses {d} workers", .{scheduler.getWorkersCount()});
+        const upload = trace.begin("cpu.upload");
+        defer upload.end();
+        return .{
+            .allocator = allocator,
+            .scene = scene,
+            .state = state,
+            .scheduler = scheduler,
+            .tiles = &.{},
+
+            .target_buffer = null,
+            .textures = try buffers.Textures.init(allocator, bvh.textures.items),
+            .materials = try buffers.Array(gpu_structs.Material).init(allocator, bvh.materials.items),
+            .normals = try buffers.Array(gpu_structs.Normal).init(allocator, bvh.normals.items),
+            .normal_indices = try buffers.Array(u32).init(allocator, bvh.normal_indices.items),
+            .uvs = try buffers.Array(gpu_structs.Uv).init(allocator, bvh.uvs.items),
+            .uv_indices = try buffers.Array(u32).init(allocator, bvh.uv_indices.items),
+            .transforms = try buffers.Array(gpu_structs.Transform).init(allocator, bvh.transforms.items),
+            .tlas_nodes = try buffers.Array(gpu_structs.BvhNode).init(allocator, bvh.tlas_nodes.items),
+            .blas_nodes = try buffers.Array(gpu_structs.BvhNode).init(allocator, bvh.blas_nodes.items),
+            .light_nodes = try buffers.Array(gpu_structs.LightNode).init(allocator, bvh.light_nodes.items),
+            .lights = try buffers.Array(gpu_structs.Light).init(allocator, bvh.lights.items),
+            .environment_alias_table = try buffers.Array(gpu_structs.AliasEntry).init(allocator, bvh.environment_alias_table.items),
+            .environment_map = bvh.environment_map,
+
+            .constant_params = undefined,
+            .scene_hash = checkpoint.sceneHash(&bvh),
+            .bvh_memory = .{ .bytes = bvh.memoryBytes(), .build_peak_bytes = bvh_allocator.getPeakBytes() },
+            .denoiser = Denoiser.initShared(allocator, scheduler),
+            .cancellation = .{},
+            .history_camera = null,
+            .reprojection = null,
+        };
+    }
+
+    pub fn deinit(self: *Self) void {
+        self.scheduler.deinit();
+        self.allocator.free(self.tiles);
+        self.textures.deinit();
+        self.materials.deinit(self.allocator);
+        self.normals.deinit(self.allocator);
+        self.normal_indices.deinit(self.allocator);
+        self.uvs.deinit(self.allocator);
+        self.uv_indices.deinit(self.allocator);
+        self.transforms.deinit(self.allocator);
+        self.tlas_nodes.deinit(self.allocator);
+        self.blas_nodes.deinit(self.allocator);
+        self.light_nodes.deinit(self.allocator);
+        self.lights.deinit(self.allocator);
+        self.environment_alias_table.deinit(self.allocator);
+        if (self.target_buffer) |*tb| tb.deinit();
+        self.denoiser.deinit();
+        self.scene.deinit();
+    }
+
+    pub fn setResolution(self: *Self, resolution: util.Resolution) !void {
+        self.state.setResolution(resolution);
+        if (self.target_buffer) |*tb| {
+            tb.deinit();
+            self.target_buffer = null;
+        }
+        self.history_camera = null;
+        self.reprojection = null;
+    }
+
+    // Pixels of packed output formats are expanded to floats, see getFrameBufferBytes to read them as they are.
+    pub fn getFrameBuffer(self: *Self, dst: []gpu_structs.Vector4) !void {
+        const span = trace.begin("cpu.getFrameBuffer");
+        defer span.end();
+        const tb = try self.getOrCreateTargetBuffer();
+        tb.output_format.decode(tb.buffer, dst);
+    }
+
+    // dst takes pixel_count * bytesPerPixel of the output format.
+    pub fn getFrameBufferBytes(self: *Self, dst: []u8) !void {
+        const span = trace.begin("cpu.getFrameBufferBytes");
+        defer span.end();
+        const tb = try self.getOrCreateTargetBuffer();
+        @memcpy(dst, tb.buffer[0..dst.len]);
+    }
+
+    // Stops the running render or renderFor at the next cancellation point, so a new camera or scene
+    // doesn't wait for the stale iterations. May be called from any thread, renders started later are not affected.
+    pub fn cancel(self: *Self) void {
+        self.cancellation.cancel();
+    }
+
+    pub fn render(self: *Self) !void {
+        self.state.nextFrame(self.scene.camera.dirty);
+        (try self.getOrCreateTargetBuffer()).resetRayCount();
+        if (options.traversal_stats) (try self.getOrCreateTargetBuffer()).resetTraversalStats();
+        const generation = self.cancellation.getGeneration();
+        var i: u32 = 0;
+        // iterations since the last read of the render stats
+        var unchecked: u32 = 0;
+        while (i < self.state.iterations) : (i += 1) {
+            try self.update();
+            try self.runTiles(cpu_path_tracing_tile, self.skippableGeneration(generation));
+            unchecked += 1;
+            if (self.state.adaptive_sampling and unchecked >= util.CONVERGENCE_CHECK_INTERVAL and self.state.isCycleEnd()) {
+                unchecked = 0;
+                if (try self.isConverged()) break;
+            }
+            if (self.cancellation.isCancelled(generation)) break;
+        }
+        try self.postProcessing();
+    }
+
+    // Keeps adding samples while the next iteration is expected to fit into the budget,
+    // at least one iteration is always rendered.
+    pub fn renderFor(self: *Self, budget_ns: u64) !util.RenderProgress {
+        self.state.nextFrame(self.scene.camera.dirty);
+        (try self.getOrCreateTargetBuffer()).resetRayCount();
+        if (options.traversal_stats) (try self.getOrCreateTargetBuffer()).resetTraversalStats();
+        const generation = self.cancellation.getGeneration();
+        var timer = try std.time.Timer.start();
+        var previous_ns: u64 = 0;
+        var iterations: u32 = 0;
+        var stats: gpu_structs.RenderStats = undefined;
+        while (true) {
+            try self.update();
+            try self.runTiles(cpu_path_tracing_tile, self.skippableGeneration(generation));
+            stats = try self.getRenderStats();
+            iterations += 1;
+
+            const elapsed_ns = timer.read();
+            const iteration_ns = elapsed_ns - previous_ns;
+            previous_ns = elapsed_ns;
+            if ((stats.active_pixel_count == 0 and self.state.isCycleEnd()) or elapsed_ns + iteration_ns > budget_ns or self.cancellation.isCancelled(generation)) break;
+        }
+        try self.postProcessing();
+
+        return .{
+            .samples = @intFromFloat(self.state.current_iteration),
+            .iterations = iterations,
+            .estimated_error = stats.meanError(self.state.cyclePixelCount()),
+            .cancelled = self.cancellation.isCancelled(generation),
+        };
+    }
+
+    fn postProcessing(self: *Self) !void {
+        const span = trace.begin("cpu.postProcessing");
+        defer span.end();
+        if (self.state.isDenoised()) {
+            const tb = try self.getOrCreateTargetBuffer();
+            try self.denoiser.resize(tb.resolution);
+            tb.readDenoiserInputs(&self.denoiser);
+            self.denoiser.denoise();
+            tb.writeDenoised(self.denoiser.output);
+        }
+        try self.runTiles(cpu_post_processing_tile, null);
+    }
+
+    // See checkpoint.save.
+    pub fn saveCheckpoint(self: *Self, writer: *checkpoint.CheckpointWriter) !bool {
+        return checkpoint.save(self, writer);
+    }
+
+    // See checkpoint.load.
+    pub fn loadCheckpoint(self: *Self, path: []const u8) !void {
+        return checkpoint.load(self, path);
+    }
+
+    // Used by checkpoint.save.
+    pub fn readCheckpointBuffers(self: *Self, snapshot: *checkpoint.Checkpoint) !void {
+        const tb = try self.getOrCreateTargetBuffer();
+        tb.readCheckpoint(snapshot);
+    }
+
+    // Used by checkpoint.load.
+    pub fn writeCheckpointBuffers(self: *Self, snapshot: *const checkpoint.Checkpoint) !void {
+        const tb = try self.getOrCreateTargetBuffer();
+        tb.writeCheckpoint(snapshot);
+    }
+
+    // Stats of the last path tracing iteration.
+    pub fn getRenderStats(self: *Self) !gpu_structs.RenderStats {
+        const tb = try self.getOrCreateTargetBuffer();
+        return tb.render_stats;
+    }
+
+    // Bytes held by the scene, by the bvh built at init and by the buffers of the backend.
+    pub fn memoryReport(self: *const Self) util.MemoryReport {
+        return util.memoryReport(self, "");
+    }
+
+    // Counts of the last render or renderFor, summed over its iterations.
+    pub fn getTraversalStats(self: *Self) !gpu_structs.TraversalTotals {
+        if (!options.traversal_stats) return error.TraversalStatsDisabled;
+        const tb = try self.getOrCreateTargetBuffer();
+        return tb.traversal_stats;
+    }
+
+    // Counts of the last traced sample of every pixel, dst takes pixel_count stats.
+    pub fn getTraversalHeatmap(self: *Self, dst: []gpu_structs.TraversalStats) !void {
+        if (!options.traversal_stats) return error.TraversalStatsDisabled;
+        const tb = try self.getOrCreateTargetBuffer();
+        @memcpy(dst, tb.traversal_heatmap);
+    }
+
+    fn isConverged(self: *Self) !bool {
+        // the stats cover every pixel only at the end of a stride cycle
+        if (!self.state.isCycleEnd()) return false;
+        const stats = try self.getRenderStats();
+        return stats.active_pixel_count == 0;
+    }
+
+    fn getOrCreateTargetBuffer(self: *Self) !*buffers.Target {
+        if (self.target_buffer == null) {
+            const span = trace.begin("cpu.createTarget");
+            defer span.end();
+            const resolution = self.state.getResolution();
+            const tiles = try tile_scheduler.mortonTiles(self.allocator, resolution);
+            self.allocator.free(self.tiles);
+            self.tiles = tiles;
+            self.target_buffer = try buffers.Target.init(self.allocator, resolution, self.state.getOutputFormat(), self.state.getAccumulationFormat());
+        }
+
+        return &self.target_buffer.?;
+    }
+
+    fn update(self: *Self) !void {
+        const span = trace.begin("cpu.update");
+        defer span.end();
+        var dirty = false;
+        if (self.scene.camera.dirty) {
+            dirty = true;
+            self.scene.camera.dirty = false;
+        }
+
+        const tb = try self.getOrCreateTargetBuffer();
+        if (dirty) {
+            self.reprojection = null;
+            if (self.state.temporal_reprojection and self.state.current_iteration > 0.0) {
+                self.reprojection = self.history_camera;
+                if (self.reprojection != null) tb.saveHistory();
+            }
+            self.state.reset();
+        }
+        self.state.nextIteration();
+        // with a pixel stride the first samples, which take the history, span several iterations
+        if (!self.state.isFirstCycle()) self.reprojection = null;
+        self.history_camera = gpu_structs.Camera.from(&self.scene.camera);
+        if (self.state.isCycleStart()) tb.resetCycleStats();
+        self.constant_params = gpu_structs.ConstantParams.from(
+            &self.scene.camera,
+            self.reprojection,
+            &self.state,
+            @truncate(self.scene.textures.items.len),
+            self.light_nodes.len,
+            self.environment_map,
+        );
+    }
+
+    // The first samples after a reset replace the accumulation of the previous camera,
+    // so the tiles of the first cycle are all rendered and only the later iterations stop early.
+    fn skippableGeneration(self: *const Self, generation: u64) ?u64 {
+        return if (self.state.isFirstCycle()) null else generation;
+    }
+
+    // With a generation the tiles left after a cancel are skipped, their pixels keep the samples they had.
+    fn runTiles(self: *Self, comptime kernal: TileKernal, generation: ?u64) !void {
+        const span = trace.begin("cpu.runTiles");
+        defer span.end();
+        const tb = try self.getOrCreateTargetBuffer();
+        const Job = struct {
+            kg: KernalGlobals,
+            params: *const gpu_structs.ConstantParams,
+            cancellation: *const util.Cancellation,
+            generation: ?u64,
+
+            fn run(job: *const @This(), worker_id: usize, tile: Tile) void {
+                _ = worker_id;
+                if (job.generation) |generation| {
+                    if (job.cancellation.isCancelled(generation)) return;
+                }
+                kernal(&job.kg, job.params, tile.x0, tile.y0, tile.x1, tile.y1);
+            }
+        };
+        const job = Job{
+            .kg = self.kernalGlobals(tb),
+            .params = &self.constant_params,
+            .cancellation = &self.cancellation,
+            .generation = generation,
+        };
+        self.scheduler.run(self.tiles, &job, Job.run);
+    }
+
+    // Renders resolution pixels bucket by bucket into the binary PPM at path.
+    // A bucket takes all its samples and is written to the file before the worker moves on,
+    // so the memory used depends only on the tile size and the number of workers, not on the resolution.
+    // Adaptive sampling stops a bucket once all of its pixels converged,
+    // the denoiser, the reprojection and the dynamic resolution are not used.
+    pub fn renderBuckets(self: *Self, path: []const u8, resolution: util.Resolution, samples: u32) !void {
+        const tiles = try tile_scheduler.mortonTiles(self.allocator, resolution);
+        defer self.allocator.free(tiles);
+        var writer = try PpmWriter.create(path, resolution);
+        defer writer.close();
+        try self.runBuckets(tiles, resolution, samples, 0, .{ .ppm = &writer });
+    }
+
+    // Renders samples of the region of a resolution sized image bucket by bucket, like renderBuckets,
+    // and stores the accumulated sums of the region row by row in dst.
+    // Regions rendered with different sample_offset take independent samples and can be added together.
+    pub fn renderRegion(self: *Self, region: Tile, resolution: util.Resolution, samples: u32, sample_offset: u32, dst: []gpu_structs.Vector4) !void {
+        const tiles = try tile_scheduler.mortonTiles(self.allocator, .{
+            .width = region.x1 - region.x0,
+            .height = region.y1 - region.y0,
+        });
+        defer self.allocator.free(tiles);
+        for (tiles) |*tile| {
+            tile.x0 += region.x0;
+            tile.x1 += region.x0;
+            tile.y0 += region.y0;
+            tile.y1 += region.y0;
+        }
+        try self.runBuckets(tiles, resolution, samples, sample_offset, .{ .region = .{ .region = region, .dst = dst } });
+    }
+
+    fn runBuckets(self: *Self, tiles: []const Tile, resolution: util.Resolution, samples: u32, sample_offset: u32, output: BucketJob.Output) !void {
+        var buckets = try self.allocator.alloc(buffers.Target, self.scheduler.getWorkersCount());
+        defer self.allocator.free(buckets);
+        var initialized: usize = 0;
+        defer for (buckets[0..initialized]) |*bucket| bucket.deinit();
+        while (initialized < buckets.len) : (initialized += 1) {
+            buckets[initialized] = try buffers.Target.init(self.allocator, .{
+                .width = tile_scheduler.TILE_SIZE,
+                .height = tile_scheduler.TILE_SIZE,
+            }, .rgba32f, .rgba32f);
+        }
+
+        var params = gpu_structs.ConstantParams.from(
+            &self.scene.camera,
+            null,
+            &self.state,
+            @truncate(self.scene.textures.items.len),
+            self.light_nodes.len,
+            self.environment_map,
+        );
+        params.width = resolution.width;
+        params.height = resolution.height;
+        params.flip_y = 0;
+        params.denoise = 0;
+        params.pixel_stride = 1;
+        params.output_format = @intFromEnum(util.OutputFormat.rgba32f);
+        params.accumulation_format = @intFromEnum(util.AccumulationFormat.rgba32f);
+
+        var job = BucketJob{
+            .path_tracer = self,
+            .params = params,
+            .samples = @max(samples, 1),
+            .sample_offset = sample_offset,
+            .buckets = buckets,
+            .output = output,
+            .mutex = .{},
+            .write_error = null,
+        };
+        self.scheduler.run(tiles, &job, BucketJob.run);
+        if (job.write_error) |err| return err;
+    }
+
+    const BucketJob = struct {
+        const Output = union(enum) {
+            ppm: *const PpmWriter,
+            region: struct { region: Tile, dst: []gpu_structs.Vector4 },
+        };
+
+        path_tracer: *Self,
+        params: gpu_structs.ConstantParams,
+        samples: u32,
+        sample_offset: u32,
+        // scratch buffers of the tile size, one per worker
+        buckets: []buffers.Target,
+        output: Output,
+        mutex: std.Thread.Mutex,
+        write_error: ?anyerror,
+
+        fn run(job: *BucketJob, worker_id: usize, tile: Tile) void {
+            const bucket = &job.buckets[worker_id];
+            const width = tile.x1 - tile.x0;
+            const pixels_count = width * (tile.y1 - tile.y0);
+            // seeds of the whole image, so the result doesn't depend on the tile size
+            const image_pixels_count = job.params.width * job.params.height;
+            for (bucket.rng_state_buffer[0..pixels_count], 0..) |*seed, i| {
+                const x = tile.x0 + @as(u32, @truncate(i)) % width;
+                const y = tile.y0 + @as(u32, @truncate(i)) / width;
+                seed.* = (y * job.params.width + x) +% job.sample_offset *% image_pixels_count;
+            }
+
+            const kg = job.path_tracer.kernalGlobals(bucket);
+            var params = job.params;
+            var iteration: u32 = 0;
+            while (iteration < job.samples) : (iteration += 1) {
+                params.current_iteration = @floatFromInt(iteration + 1);
+                bucket.resetRenderStats();
+                cpu_path_tracing_bucket(&kg, &params, tile.x0, tile.y0, tile.x1, tile.y1);
+                if (params.adaptive_sampling != 0 and bucket.render_stats.active_pixel_count == 0) break;
+            }
+
+            switch (job.output) {
+                .ppm => |writer| {
+                    cpu_post_processing_bucket(&kg, &params, tile.x0, tile.y0, tile.x1, tile.y1);
+                    writer.writeTile(tile, std.mem.bytesAsSlice(gpu_structs.Vector4, bucket.buffer)) catch |err| {
+                        job.mutex.lock();
+                        defer job.mutex.unlock();
+                        if (job.write_error == null) job.write_error = err;
+                    };
+                },
+                .region => |output| {
+                    const region_width = output.region.x1 - output.region.x0;
+                    const accumulation = std.mem.bytesAsSlice(gpu_structs.Vector4, bucket.accumulation_buffer);
+                    var y = tile.y0;
+                    while (y < tile.y1) : (y += 1) {
+                        const src = accumulation[(y - tile.y0) * width ..][0..width];
+                        const offset = (y - output.region.y0) * region_width + (tile.x0 - output.region.x0);
+                        @memcpy(output.dst[offset..][0..width], src);
+                    }
+                },
+            }
+        }
+    };
+
+    fn kernalGlobals(self: *Self, tb: *buffers.Target) KernalGlobals {
+        return .{
+            .bvh = .{
+                .tlas_nodes = self.tlas_nodes,
+                .blas_nodes = self.blas_nodes,
+                .normals = self.normals,
+                .normal_indices = self.normal_indices,
+                .uvs = self.uvs,
+                .uv_indices = self.uv_indices,
+                .transforms = self.transforms,
+            },
+            .light_bvh = .{
+                .nodes = self.light_nodes,
+                .lights = self.lights,
+            },
+            .environment_map = .{
+                .alias_table = self.environment_alias_table,
+            },
+            .materials = self.materials,
+            .textures = self.textures.device_texture_objects,
+            .framebuffer = tb.buffer.ptr,
+            .accumulation_buffer = tb.accumulation_buffer.ptr,
+            .second_moment_buffer = tb.second_moment_buffer.ptr,
+            .albedo_buffer = tb.albedo_buffer.ptr,
+            .normal_buffer = tb.normal_buffer.ptr,
+            .denoised_buffer = tb.denoised_buffer.ptr,
+            .position_buffer = tb.position_buffer.ptr,
+            .history = .{
+                .accumulation_buffer = tb.history_accumulation_buffer.ptr,
+                .second_moment_buffer = tb.history_second_moment_buffer.ptr,
+                .position_buffer = tb.history_position_buffer.ptr,
+            },
+            .render_stats = &tb.render_stats,
+            .traversal_stats = if (tb.traversal_heatmap.len > 0) &tb.traversal_stats else null,
+            .traversal_heatmap = if (tb.traversal_heatmap.len > 0) tb.traversal_heatmap.ptr else null,
+            .rng_seed_buffer = tb.rng_state_buffer.ptr,
+            .pixel_count = tb.resolution.pixel_count(),
+        };
+    }
+};
@@ -0,0 +1,278 @@
+const std = @import("std");
+const util = @import("util.zig");
+const gpu_structs = @import("gpu_structs.zig");
+const tile_scheduler = @import("tile_scheduler.zig");
+const Tile = tile_scheduler.Tile;
+const TileScheduler = tile_scheduler.TileScheduler;
+
+// Edge-avoiding à-trous wavelet filter (Dammertz et al. 2010) running on the host.
+// Irradiance is demodulated by the first-hit albedo, so textures are not blurred,
+// and the luminance edge-stopping function is scaled by the per-pixel variance as in SVGF.
+pub const Denoiser = struct {
+    const Self = @This();
+    const Vector4 = gpu_structs.Vector4;
+    const PASSES: u32 = 5;
+    const SIGMA_LUMINANCE: f32 = 4.0;
+    const SIGMA_NORMAL: f32 = 128.0;
+    const ALBEDO_EPSILON: f32 = 0.001;
+    const KERNEL = [_]f32{ 1.0 / 16.0, 1.0 / 4.0, 3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0 };
+    const BAND_ROWS = tile_scheduler.TILE_SIZE;
+
+    allocator: std.mem.Allocator,
+    resolution: util.Resolution,
+    // workers of the passes, created by the first denoise unless shared with the cpu backend
+    scheduler: ?*TileScheduler,
+    owns_scheduler: bool,
+    // horizontal bands of BAND_ROWS rows, the jobs of the passes
+    bands: []Tile,
+    // inputs, sums over the accumulated samples as written by the path tracing kernels
+    accumulation: []Vector4,
+    albedo: []Vector4,
+    normal: []Vector4,
+    second_moment: []f32,
+    // result in the accumulation buffer format, alpha is 1
+    output: []Vector4,
+    // demodulated irradiance with its variance in alpha, ping-ponged between the passes
+    irradiance: [2][]Vector4,
+
+    pub fn init(allocator: std.mem.Allocator) Self {
+        return initScheduler(allocator, null);
+    }
+
+    // Runs the passes on the workers of scheduler, which must outlive the denoiser.
+    pub fn initShared(allocator: std.mem.Allocator, scheduler: *TileScheduler) Self {
+        return initScheduler(allocator, scheduler);
+    }
+
+    fn initScheduler(allocator: std.mem.Allocator, scheduler: ?*TileScheduler) Self {
+        return .{
+            .allocator = allocator,
+            .resolution = .{ .width = 0, .height = 0 },
+            .scheduler = scheduler,
+            .owns_scheduler = false,
+            .bands = &.{},
+            .accumulation = &.{},
+            .albedo = &.{},
+            .normal = &.{},
+            .second_moment = &.{},
+            .output = &.{},
+            .irradiance = .{ &.{}, &.{} },
+        };
+    }
+
+    pub fn deinit(self: *Self) void {
+        self.free();
+        if (self.owns_scheduler) self.scheduler.?.deinit();
+    }
+
+    // Host bytes of the buffers of the current resolution.
+    pub fn memoryBytes(self: *const Self) usize {
+        var bytes = std.mem.sliceAsBytes(self.second_moment).len + std.mem.sliceAsBytes(self.bands).len;
+        for ([_][]Vector4{ self.accumulation, self.albedo, self.normal, self.output, self.irradiance[0], self.irradiance[1] }) |buffer| {
+            bytes += std.mem.sliceAsBytes(buffer).len;
+        }
+        return bytes;
+    }
+
+    pub fn resize(self: *Self, resolution: util.Resolution) !void {
+        if (std.meta.eql(self.resolution, resolution)) return;
+        self.free();
+        self.resolution = .{ .width = 0, .height = 0 };
+
+        const pixels_count = resolution.pixel_count();
+        errdefer self.free();
+        self.accumulation = try self.allocator.alloc(Vector4, pixels_count);
+        self.albedo = try self.allocator.alloc(Vector4, pixels_count);
+        self.normal = try self.allocator.alloc(Vector4, pixels_count);
+        self.second_moment = try self.allocator.alloc(f32, pixels_count);
+        self.output = try self.allocator.alloc(Vector4, pixels_count);
+        self.irradiance[0] = try self.allocator.alloc(Vector4, pixels_count);
+        self.irradiance[1] = try self.allocator.alloc(Vector4, pixels_count);
+        self.bands = try self.allocator.alloc(Tile, (resolution.height + BAND_ROWS - 1) / BAND_ROWS);
+        for (self.bands, 0..) |*band, i| {
+            const y0 = @as(u32, @intCast(i)) * BAND_ROWS;
+            band.* = .{ .x0 = 0, .y0 = y0, .x1 = resolution.width, .y1 = @min(y0 + BAND_ROWS, resolution.height) };
+        }
+        self.resolution = resolution;
+    }
+
+    fn free(self: *Self) void {
+        self.allocator.free(self.accumulation);
+        self.allocator.free(self.albedo);
+        self.allocator.free(self.normal);
+        self.allocator.free(self.second_moment);
+        self.allocator.free(self.output);
+        self.allocator.free(self.irradiance[0]);
+        self.allocator.free(self.irradiance[1]);
+        self.allocator.free(self.bands);
+        self.accumulation = &.{};
+        self.albedo = &.{};
+        self.normal = &.{};
+        self.second_moment = &.{};
+        self.output = &.{};
+        self.irradiance = .{ &.{}, &.{} };
+        self.bands = &.{};
+    }
+
+    // Filters the inputs into output, albedo and normal are overwritten with their averages.
+    pub fn denoise(self: *Self) void {
+        self.forEachRows(demodulateRows, 0);
+        var pass: u32 = 1;
+        while (pass <= PASSES) : (pass += 1) {
+            self.forEachRows(filterRows, pass);
+        }
+        self.forEachRows(remodulateRows, PASSES);
+    }
+
+    // Runs job over the horizontal bands of the image on the workers of the scheduler.
+    fn forEachRows(self: *Self, comptime job: fn (*Self, u32, u32, u32) void, pass: u32) void {
+        const Context = struct { denoiser: *Self, pass: u32 };
+        const Band = struct {
+            fn run(context: Context, _: usize, band: Tile) void {
+                job(context.denoiser, context.pass, band.y0, band.y1);
+            }
+        };
+        if (self.getScheduler()) |scheduler| {
+            scheduler.run(self.bands, Context{ .denoiser = self, .pass = pass }, Band.run);
+        } else {
+            job(self, pass, 0, self.resolution.height);
+        }
+    }
+
+    // The workers are spawned once and reused by every pass and frame,
+    // without them the passes run on the calling thread.
+    fn getScheduler(self: *Self) ?*TileScheduler {
+        if (self.scheduler == null) {
+            self.scheduler = TileScheduler.init(self.allocator) catch |err| blk: {
+                std.log.warn("[ornament] denoiser runs on one thread, creating its workers failed: {}", .{err});
+                break :blk null;
+            };
+            self.owns_scheduler = self.scheduler != null;
+        }
+        return self.scheduler;
+    }
+
+    fn demodulateRows(self: *Self, pass: u32, first_row: u32, last_row: u32) void {
+        _ = pass;
+        const width = self.resolution.width;
+        for (first_row * width..last_row * width) |i| {
+            const n = self.accumulation[i][3];
+            if (n <= 0.0) {
+                self.albedo[i] = .{ 1.0, 1.0, 1.0, 0.0 };
+                self.normal[i] = .{ 0.0, 0.0, 0.0, 0.0 };
+                self.irradiance[0][i] = .{ 0.0, 0.0, 0.0, 0.0 };
+                continue;
+            }
+
+            var color: [3]f32 = undefined;
+            var irradiance: [3]f32 = undefined;
+            for (0..3) |c| {
+                color[c] = self.accumulation[i][c] / n;
+                var albedo = self.albedo[i][c] / n;
+                if (albedo < ALBEDO_EPSILON) albedo = 1.0;
+                self.albedo[i][c] = albedo;
+                irradiance[c] = color[c] / albedo;
+            }
+
+            const normal = [3]f32{ self.normal[i][0], self.normal[i][1], self.normal[i][2] };
+            const normal_length = @sqrt(dot(normal, normal));
+            for (0..3) |c| {
+                self.normal[i][c] = if (normal_length > 0.0) normal[c] / normal_length else 0.0;
+            }
+
+            // variance of the mean luminance, rescaled to the demodulated irradiance
+            const mean = luminance(color);
+            var variance = @max(self.second_moment[i] / n - mean * mean, 0.0) / n;
+            if (mean > 0.0) {
+                const ratio = luminance(irradiance) / mean;
+                variance *= ratio * ratio;
+            }
+            self.irradiance[0][i] = .{ irradiance[0], irradiance[1], irradiance[2], variance };
+        }
+    }
+
+    fn filterRows(self: *Self, pass: u32, first_row: u32, last_row: u32) void {
+        const src = self.irradiance[(pass - 1) % 2];
+        const dst = self.irradiance[pass % 2];
+        const step: i64 = @as(i64, 1) << @intCast(pass - 1);
+        const width = self.resolution.width;
+        const height = self.resolution.height;
+
+        var y = first_row;
+        while (y < last_row) : (y += 1) {
+            var x: u32 = 0;
+            while (x < width) : (x += 1) {
+                const p = y * width + x;
+                if (self.accumulation[p][3] <= 0.0) {
+                    dst[p] = src[p];
+                    continue;
+                }
+
+                const luminance_p = luminance(.{ src[p][0], src[p][1], src[p][2] });
+                const normal_p = [3]f32{ self.normal[p][0], self.normal[p][1], self.normal[p][2] };
+                const luminance_scale = SIGMA_LUMINANCE * @sqrt(@max(src[p][3], 0.0)) + 1e-6;
+
+                var color_sum = [3]f32{ 0.0, 0.0, 0.0 };
+                var variance_sum: f32 = 0.0;
+                var weight_sum: f32 = 0.0;
+                for (KERNEL, 0..) |ky, j| {
+                    const qy = @as(i64, y) + (@as(i64, @intCast(j)) - 2) * step;
+                    if (qy < 0 or qy >= height) continue;
+                    for (KERNEL, 0..) |kx, k| {
+                        const qx = @as(i64, x) + (@as(i64, @intCast(k)) - 2) * step;
+                        if (qx < 0 or qx >= width) continue;
+                        const q: usize = @intCast(qy * width + qx);
+                        if (self.accumulation[q][3] <= 0.0) continue;
+
+                        const normal_q = [3]f32{ self.normal[q][0], self.normal[q][1], self.normal[q][2] };
+                        const luminance_q = luminance(.{ src[q][0], src[q][1], src[q][2] });
+                        const weight = kx * ky *
+                            normalWeight(normal_p, normal_q) *
+                            @exp(-@fabs(luminance_p - luminance_q) / luminance_scale);
+
+                        for (0..3) |c| color_sum[c] += weight * src[q][c];
+                        variance_sum += weight * weight * src[q][3];
+                        weight_sum += weight;
+                    }
+                }
+
+                // the center pixel always contributes, so weight_sum > 0
+                dst[p] = .{
+                    color_sum[0] / weight_sum,
+                    color_sum[1] / weight_sum,
+                    color_sum[2] / weight_sum,
+                    variance_sum / (weight_sum * weight_sum),
+                };
+            }
+        }
+    }
+
+    fn remodulateRows(self: *Self, pass: u32, first_row: u32, last_row: u32) void {
+        const src = self.irradiance[pass % 2];
+        const width = self.resolution.width;
+        for (first_row * width..last_row * width) |i| {
+            self.output[i] = .{
+                src[i][0] * self.albedo[i][0],
+                src[i][1] * self.albedo[i][1],
+                src[i][2] * self.albedo[i][2],
+                1.0,
+            };
+        }
+    }
+
+    inline fn normalWeight(n_p: [3]f32, n_q: [3]f32) f32 {
+        const p_missed = dot(n_p, n_p) == 0.0;
+        const q_missed = dot(n_q, n_q) == 0.0;
+        // pixels without a hit are filtered only with each other
+        if (p_missed or q_missed) return if (p_missed and q_missed) 1.0 else 0.0;
+        return std.math.pow(f32, @max(dot(n_p, n_q), 0.0), SIGMA_NORMAL);
+    }
+
+    inline fn dot(a: [3]f32, b: [3]f32) f32 {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    inline fn luminance(rgb: [3]f32) f32 {
+        return 0.2126 * rgb[0] + 0.7152 * rgb[1] + 0.0722 * rgb[2];
+    }
+};
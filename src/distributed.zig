@@ -0,0 +1,322 @@
+const std = @import("std");
+const util = @import("util.zig");
+const gpu_structs = @import("gpu_structs.zig");
+const tile_scheduler = @import("tile_scheduler.zig");
+const Tile = tile_scheduler.Tile;
+const PpmWriter = @import("ppm_writer.zig").PpmWriter;
+
+// Distributed rendering over TCP. Workers load the same scene and render regions of the image
+// for ranges of samples, the coordinator hands out the tasks to whichever worker is free
+// and adds the returned accumulation sums together.
+// Messages are the raw extern structs, coordinator and workers are expected to share the endianness.
+
+pub const DistributedError = error{
+    ProtocolError,
+    WorkersLost,
+};
+
+const MAGIC: u32 = 0x4f524e44; // "ORND"
+// how often the coordinator checks whether the image is done while it waits for workers to connect
+const ACCEPT_POLL_MS = 100;
+
+const MessageType = enum(u32) {
+    task = 1,
+    result = 2,
+    done = 3,
+};
+
+const MessageHeader = extern struct {
+    magic: u32 = MAGIC,
+    // MessageType, kept as an integer until it is validated
+    message_type: u32,
+    // bytes following the header
+    payload_size: u64,
+};
+
+pub const Task = extern struct {
+    id: u32,
+    width: u32,
+    height: u32,
+    x0: u32,
+    y0: u32,
+    x1: u32,
+    y1: u32,
+    samples: u32,
+    sample_offset: u32,
+
+    pub fn getRegion(self: *const Task) Tile {
+        return .{ .x0 = self.x0, .y0 = self.y0, .x1 = self.x1, .y1 = self.y1 };
+    }
+
+    pub fn getResolution(self: *const Task) util.Resolution {
+        return .{ .width = self.width, .height = self.height };
+    }
+
+    fn pixelsCount(self: *const Task) usize {
+        return @as(usize, self.x1 - self.x0) * (self.y1 - self.y0);
+    }
+};
+
+// Connects to the coordinator and renders its tasks until it sends done.
+// path_tracer needs renderRegion, see cpu_backend.PathTracer. The camera aspect ratio follows the resolution of the tasks.
+pub fn runWorker(allocator: std.mem.Allocator, path_tracer: anytype, address: std.net.Address) !void {
+    var stream = try std.net.tcpConnectToAddress(address);
+    defer stream.close();
+
+    var accumulation = std.ArrayList(gpu_structs.Vector4).init(allocator);
+    defer accumulation.deinit();
+    while (true) {
+        const header = try readHeader(stream);
+        switch (@as(MessageType, @enumFromInt(header.message_type))) {
+            .done => return,
+            .task => {
+                if (header.payload_size != @sizeOf(Task)) return DistributedError.ProtocolError;
+                var task: Task = undefined;
+                try stream.reader().readNoEof(std.mem.asBytes(&task));
+
+                try accumulation.resize(task.pixelsCount());
+                path_tracer.scene.camera.setAspectRatio(@as(f32, @floatFromInt(task.width)) / @as(f32, @floatFromInt(task.height)));
+                try path_tracer.renderRegion(task.getRegion(), task.getResolution(), task.samples, task.sample_offset, accumulation.items);
+
+                const pixels = std.mem.sliceAsBytes(accumulation.items);
+                try writeHeader(stream, .result, @sizeOf(Task) + pixels.len);
+                try stream.writer().writeAll(std.mem.asBytes(&task));
+                try stream.writer().writeAll(pixels);
+            },
+            else => return DistributedError.ProtocolError,
+        }
+    }
+}
+
+pub const CoordinatorOptions = struct {
+    resolution: util.Resolution,
+    // samples per pixel are samples_per_task * passes, passes of a region can run on different workers
+    samples_per_task: u32,
+    passes: u32 = 1,
+    // side of the square regions a task covers
+    region_size: u32 = 128,
+    inverted_gamma: f32 = 1.0,
+};
+
+// Accepts up to workers_count workers, renders the image with them and writes it as a binary PPM.
+// Workers take tasks as soon as they connect, no more are accepted once every task is done.
+// Tasks of a worker which disconnects go back to the queue for the other workers.
+pub fn runCoordinator(allocator: std.mem.Allocator, address: std.net.Address, workers_count: u32, options: CoordinatorOptions, path: []const u8) !void {
+    var coordinator = try Coordinator.init(allocator, options);
+    defer coordinator.deinit();
+
+    var server = std.net.StreamServer.init(.{ .reuse_address = true });
+    defer server.deinit();
+    try server.listen(address);
+    std.log.info("[ornament] coordinator listens on {}, waiting for {d} workers", .{ server.listen_address, workers_count });
+
+    var threads = try allocator.alloc(std.Thread, workers_count);
+    defer allocator.free(threads);
+    var spawned: usize = 0;
+    {
+        // connected workers finish the tasks even if accepting the others fails
+        defer for (threads[0..spawned]) |thread| thread.join();
+        while (spawned < workers_count and !coordinator.isFinished()) {
+            var fds = [_]std.os.pollfd{.{ .fd = server.sockfd.?, .events = std.os.POLL.IN, .revents = 0 }};
+            if (try std.os.poll(&fds, ACCEPT_POLL_MS) == 0) continue;
+            const connection = try server.accept();
+            std.log.info("[ornament] worker {d} connected from {}", .{ spawned, connection.address });
+            threads[spawned] = std.Thread.spawn(.{}, Coordinator.serveWorker, .{ &coordinator, connection.stream }) catch |err| {
+                connection.stream.close();
+                return err;
+            };
+            spawned += 1;
+        }
+    }
+
+    if (coordinator.completed_tasks != coordinator.tasks.len) return DistributedError.WorkersLost;
+    try coordinator.writePpm(path);
+}
+
+const Coordinator = struct {
+    const Self = @This();
+    allocator: std.mem.Allocator,
+    options: CoordinatorOptions,
+    tasks: []Task,
+    accumulation: []gpu_structs.Vector4,
+
+    mutex: std.Thread.Mutex,
+    // signaled when a running task completes or goes back to the queue
+    task_returned: std.Thread.Condition,
+    next_task: usize,
+    // tasks of disconnected workers
+    retry_tasks: std.ArrayList(u32),
+    // tasks sent to workers which didn't return their result yet
+    running_tasks: usize,
+    completed_tasks: usize,
+
+    fn init(allocator: std.mem.Allocator, options: CoordinatorOptions) !Self {
+        const resolution = options.resolution;
+        const regions_x = (resolution.width + options.region_size - 1) / options.region_size;
+        const regions_y = (resolution.height + options.region_size - 1) / options.region_size;
+        const regions_count = regions_x * regions_y;
+
+        // every region takes its first pass before any region takes the second one
+        var tasks = try allocator.alloc(Task, regions_count * options.passes);
+        errdefer allocator.free(tasks);
+        for (tasks, 0..) |*task, id| {
+            const region: u32 = @truncate(id % regions_count);
+            const pass: u32 = @truncate(id / regions_count);
+            const x0 = (region % regions_x) * options.region_size;
+            const y0 = (region / regions_x) * options.region_size;
+            task.* = .{
+                .id = @truncate(id),
+                .width = resolution.width,
+                .height = resolution.height,
+                .x0 = x0,
+                .y0 = y0,
+                .x1 = @min(x0 + options.region_size, resolution.width),
+                .y1 = @min(y0 + options.region_size, resolution.height),
+                .samples = options.samples_per_task,
+                .sample_offset = pass * options.samples_per_task,
+            };
+        }
+
+        var accumulation = try allocator.alloc(gpu_structs.Vector4, resolution.pixel_count());
+        @memset(accumulation, .{ 0.0, 0.0, 0.0, 0.0 });
+        return .{
+            .allocator = allocator,
+            .options = options,
+            .tasks = tasks,
+            .accumulation = accumulation,
+            .mutex = .{},
+            .task_returned = .{},
+            .next_task = 0,
+            .retry_tasks = std.ArrayList(u32).init(allocator),
+            .running_tasks = 0,
+            .completed_tasks = 0,
+        };
+    }
+
+    fn deinit(self: *Self) void {
+        self.allocator.free(self.tasks);
+        self.allocator.free(self.accumulation);
+        self.retry_tasks.deinit();
+    }
+
+    // Waits while the queue is empty but tasks of other workers are running, they may fail and come back.
+    // Null once no task is queued or running.
+    fn takeTask(self: *Self) ?Task {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        while (true) {
+            if (self.retry_tasks.popOrNull()) |id| {
+                self.running_tasks += 1;
+                return self.tasks[id];
+            }
+            if (self.next_task < self.tasks.len) {
+                self.next_task += 1;
+                self.running_tasks += 1;
+                return self.tasks[self.next_task - 1];
+            }
+            if (self.running_tasks == 0) return null;
+            self.task_returned.wait(&self.mutex);
+        }
+    }
+
+    fn retryTask(self: *Self, task: Task) void {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        self.retry_tasks.append(task.id) catch {
+            std.log.err("[ornament] task {d} is lost", .{task.id});
+        };
+        self.running_tasks -= 1;
+        self.task_returned.broadcast();
+    }
+
+    // No task is queued or running, either every task is completed or the failed ones are lost.
+    fn isFinished(self: *Self) bool {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        return self.running_tasks == 0 and self.retry_tasks.items.len == 0 and self.next_task == self.tasks.len;
+    }
+
+    fn serveWorker(self: *Self, stream: std.net.Stream) void {
+        defer stream.close();
+        var pixels = std.ArrayList(gpu_structs.Vector4).init(self.allocator);
+        defer pixels.deinit();
+
+        while (self.takeTask()) |task| {
+            self.runTask(stream, task, &pixels) catch |err| {
+                std.log.err("[ornament] worker failed task {d}: {s}", .{ task.id, @errorName(err) });
+                self.retryTask(task);
+                return;
+            };
+        }
+        writeHeader(stream, .done, 0) catch {};
+    }
+
+    fn runTask(self: *Self, stream: std.net.Stream, task: Task, pixels: *std.ArrayList(gpu_structs.Vector4)) !void {
+        try writeHeader(stream, .task, @sizeOf(Task));
+        try stream.writer().writeAll(std.mem.asBytes(&task));
+
+        const header = try readHeader(stream);
+        if (header.message_type != @intFromEnum(MessageType.result) or header.payload_size != @sizeOf(Task) + task.pixelsCount() * @sizeOf(gpu_structs.Vector4)) {
+            return DistributedError.ProtocolError;
+        }
+        var result: Task = undefined;
+        try stream.reader().readNoEof(std.mem.asBytes(&result));
+        if (result.id != task.id) return DistributedError.ProtocolError;
+        try pixels.resize(task.pixelsCount());
+        try stream.reader().readNoEof(std.mem.sliceAsBytes(pixels.items));
+
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        const region_width = task.x1 - task.x0;
+        for (pixels.items, 0..) |pixel, i| {
+            const x = task.x0 + @as(u32, @truncate(i)) % region_width;
+            const y = task.y0 + @as(u32, @truncate(i)) / region_width;
+            const dst = &self.accumulation[y * task.width + x];
+            for (dst, pixel) |*d, p| d.* += p;
+        }
+        self.completed_tasks += 1;
+        self.running_tasks -= 1;
+        self.task_returned.broadcast();
+    }
+
+    // Same as the post processing of the kernels, the alpha of the accumulation is the samples count.
+    fn writePpm(self: *const Self, path: []const u8) !void {
+        const resolution = self.options.resolution;
+        var writer = try PpmWriter.create(path, resolution);
+        defer writer.close();
+
+        const tiles = try tile_scheduler.mortonTiles(self.allocator, resolution);
+        defer self.allocator.free(tiles);
+        var pixels: [tile_scheduler.TILE_SIZE * tile_scheduler.TILE_SIZE]gpu_structs.Vector4 = undefined;
+        for (tiles) |tile| {
+            const width = tile.x1 - tile.x0;
+            var y = tile.y0;
+            while (y < tile.y1) : (y += 1) {
+                var x = tile.x0;
+                while (x < tile.x1) : (x += 1) {
+                    const rgba = self.accumulation[y * resolution.width + x];
+                    const pixel = &pixels[(y - tile.y0) * width + (x - tile.x0)];
+                    for (0..3) |c| {
+                        const value = if (rgba[3] > 0.0) std.math.clamp(rgba[c] / rgba[3], 0.0, 1.0) else 0.0;
+                        pixel[c] = std.math.pow(f32, value, self.options.inverted_gamma);
+                    }
+                    pixel[3] = 1.0;
+                }
+            }
+            try writer.writeTile(tile, pixels[0 .. width * (tile.y1 - tile.y0)]);
+        }
+    }
+};
+
+fn writeHeader(stream: std.net.Stream, message_type: MessageType, payload_size: u64) !void {
+    const header = MessageHeader{ .message_type = @intFromEnum(message_type), .payload_size = payload_size };
+    try stream.writer().writeAll(std.mem.asBytes(&header));
+}
+
+fn readHeader(stream: std.net.Stream) !MessageHeader {
+    var header: MessageHeader = undefined;
+    try stream.reader().readNoEof(std.mem.asBytes(&header));
+    if (header.magic != MAGIC) return DistributedError.ProtocolError;
+    _ = std.meta.intToEnum(MessageType, header.message_type) catch return DistributedError.ProtocolError;
+    return header;
+}
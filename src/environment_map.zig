@@ -0,0 +1,61 @@
+const std = @import("std");
+const gpu_structs = @import("gpu_structs.zig");
+const Texture = @import("texture.zig").Texture;
+
+// Builds the alias table (Vose's method) over texels of an equirectangular environment map.
+// Texels are weighted by luminance and sin(theta), rows near the poles cover a smaller solid angle.
+pub fn buildAliasTable(allocator: std.mem.Allocator, texture: *const Texture, table: *std.ArrayList(gpu_structs.AliasEntry)) std.mem.Allocator.Error!void {
+    const texels_count = texture.width * texture.height;
+    try table.resize(texels_count);
+
+    var probabilities = try allocator.alloc(f32, texels_count);
+    defer allocator.free(probabilities);
+
+    var sum: f64 = 0.0;
+    var y: u32 = 0;
+    while (y < texture.height) : (y += 1) {
+        const theta = (@as(f32, @floatFromInt(y)) + 0.5) / @as(f32, @floatFromInt(texture.height)) * std.math.pi;
+        const sin_theta = @sin(theta);
+        var x: u32 = 0;
+        while (x < texture.width) : (x += 1) {
+            const rgb = texture.getRgb(x, y);
+            const luminance = 0.2126 * rgb[0] + 0.7152 * rgb[1] + 0.0722 * rgb[2];
+            const weight = @max(luminance, 0.0) * sin_theta;
+            probabilities[y * texture.width + x] = weight;
+            sum += weight;
+        }
+    }
+
+    if (sum == 0.0) {
+        // black environment map, fall back to uniform texel sampling
+        for (table.items, 0..) |*entry, i| {
+            entry.* = .{ .q = 1.0, .alias = @truncate(i), .pdf = 1.0 / @as(f32, @floatFromInt(texels_count)) };
+        }
+        return;
+    }
+
+    var small = try std.ArrayList(u32).initCapacity(allocator, texels_count);
+    defer small.deinit();
+    var large = try std.ArrayList(u32).initCapacity(allocator, texels_count);
+    defer large.deinit();
+
+    const scale = @as(f64, @floatFromInt(texels_count)) / sum;
+    for (probabilities, 0..) |*p, i| {
+        table.items[i].pdf = @floatCast(p.* / sum);
+        p.* = @floatCast(p.* * scale);
+        if (p.* < 1.0) small.appendAssumeCapacity(@truncate(i)) else large.appendAssumeCapacity(@truncate(i));
+    }
+
+    while (small.items.len > 0 and large.items.len > 0) {
+        const s = small.pop();
+        const l = large.pop();
+        table.items[s].q = probabilities[s];
+        table.items[s].alias = l;
+        probabilities[l] = (probabilities[l] + probabilities[s]) - 1.0;
+        if (probabilities[l] < 1.0) small.appendAssumeCapacity(l) else large.appendAssumeCapacity(l);
+    }
+
+    // leftovers are equal to 1 up to rounding errors
+    for (small.items) |i| table.items[i] = .{ .q = 1.0, .alias = i, .pdf = table.items[i].pdf };
+    for (large.items) |i| table.items[i] = .{ .q = 1.0, .alias = i, .pdf = table.items[i].pdf };
+}
@@ -30,6 +30,60 @@ pub const BvhNode = extern struct {
     transform_id: u32,
 };
 
+pub const LightNodeType = enum(u32) {
+    InternalNode = 0,
+    Light = 1,
+};
+
+// Node of the light bvh. Every node keeps the bounds, the total power and the
+// cone of emitter normals of its subtree, which is enough to estimate how much
+// light the subtree contributes to a shading point.
+pub const LightNode = extern struct {
+    aabb_min: [3]f32,
+    left_or_light_id: u32, // internal left node id / light id
+    aabb_max: [3]f32,
+    right: u32,
+    axis: [3]f32,
+    node_type: LightNodeType,
+    power: f32,
+    cos_theta_o: f32,
+    cos_theta_e: f32,
+    _padding: u32 = undefined,
+};
+
+pub const LightType = enum(u32) {
+    Sphere = 0,
+    Triangle = 1,
+};
+
+pub const Light = extern struct {
+    v0_or_center: [3]f32, // world space
+    light_type: LightType,
+    v1: [3]f32,
+    material_index: u32,
+    v2: [3]f32,
+    triangle_id: u32, // first uv index of the triangle
+    radius: f32,
+    area: f32,
+    _padding0: u32 = undefined,
+    _padding1: u32 = undefined,
+};
+
+// Entry of the alias table over environment map texels.
+pub const AliasEntry = extern struct {
+    q: f32, // probability to keep the texel instead of jumping to the alias
+    alias: u32,
+    pdf: f32, // discrete probability of the texel
+    _padding: u32 = undefined,
+};
+
+pub const EnvironmentMap = struct {
+    pub const none = EnvironmentMap{ .texture_id = std.math.maxInt(u32), .width = 0, .height = 0 };
+    texture_id: u32,
+    width: u32,
+    height: u32,
+};
+
 pub const Material = extern struct {
     const Self = @This();
     albedo: [3]f32,
@@ -61,6 +115,8 @@ pub const Material = extern struct {
 pub const ConstantParams = extern struct {
     const Self = @This();
     camera: Camera,
+    // camera of the history when reproject is set
+    previous_camera: Camera,
     depth: u32,
     width: u32,
     height: u32,
@@ -69,10 +125,38 @@ pub const ConstantParams = extern struct {
     ray_cast_epsilon: f32,
     textures_count: u32,
     current_iteration: f32 = 0.0,
+    light_nodes_count: u32,
+    environment_map_texture_id: u32,
+    environment_map_width: u32,
+    environment_map_height: u32,
+    adaptive_sampling: u32,
+    adaptive_threshold: f32,
+    adaptive_min_samples: u32,
+    denoise: u32,
+    reproject: u32,
+    temporal_history_limit: u32,
+    pixel_stride: u32,
+    // util.OutputFormat of the frame buffer
+    output_format: u32,
+    // util.AccumulationFormat of the accumulation buffers
+    accumulation_format: u32,
+    _padding0: u32 = undefined,
+    _padding1: u32 = undefined,
+    _padding2: u32 = undefined,
 
-    pub fn from(camera: *const ornament.Camera, state: *const State, textures_count: u32) Self {
+    // reprojection is the camera the history was rendered with, null keeps the history untouched.
+    pub fn from(
+        camera: *const ornament.Camera,
+        reprojection: ?Camera,
+        state: *const State,
+        textures_count: u32,
+        light_nodes_count: u32,
+        environment_map: EnvironmentMap,
+    ) Self {
+        const gpu_camera = Camera.from(camera);
         return .{
-            .camera = Camera.from(camera),
+            .camera = gpu_camera,
+            .previous_camera = reprojection orelse gpu_camera,
             .depth = state.depth,
             .width = state.resolution.width,
             .height = state.resolution.height,
@@ -81,10 +165,77 @@ pub const ConstantParams = extern struct {
             .ray_cast_epsilon = state.ray_cast_epsilon,
             .textures_count = textures_count,
             .current_iteration = state.current_iteration,
+            .light_nodes_count = light_nodes_count,
+            .environment_map_texture_id = environment_map.texture_id,
+            .environment_map_width = environment_map.width,
+            .environment_map_height = environment_map.height,
+            .adaptive_sampling = if (state.adaptive_sampling) 1 else 0,
+            .adaptive_threshold = state.adaptive_threshold,
+            .adaptive_min_samples = state.adaptive_min_samples,
+            .denoise = if (state.isDenoised()) 1 else 0,
+            .reproject = if (reprojection != null) 1 else 0,
+            .temporal_history_limit = state.temporal_history_limit,
+            .pixel_stride = state.pixel_stride,
+            .output_format = @intFromEnum(state.output_format),
+            .accumulation_format = @intFromEnum(state.accumulation_format),
         };
     }
 };
 
+// Written by the path tracing kernels, the pixel count and the error summed over the iterations
+// of a stride cycle (see State.isCycleStart) and the ray count over all iterations of a render.
+pub const RenderStats = extern struct {
+    pub const ERROR_SCALE: f32 = 256.0;
+    // the fields of the cycle come first, the ray count is reset separately
+    pub const RAY_COUNT_OFFSET = @offsetOf(RenderStats, "secondary_ray_count_low");
+    active_pixel_count: u32 = 0, // pixels which are not converged yet
+    // 64 bit sum of per pixel relative errors clamped to 1, in units of 1/ERROR_SCALE
+    error_sum_low: u32 = 0,
+    error_sum_high: u32 = 0,
+    // 64 bit count of the rays traced after the camera rays, the bounces and the shadow rays
+    secondary_ray_count_low: u32 = 0,
+    secondary_ray_count_high: u32 = 0,
+
+    pub fn errorSum(self: *const RenderStats) u64 {
+        return (@as(u64, self.error_sum_high) << 32) | self.error_sum_low;
+    }
+
+    pub fn secondaryRayCount(self: *const RenderStats) u64 {
+        return (@as(u64, self.secondary_ray_count_high) << 32) | self.secondary_ray_count_low;
+    }
+
+    // traced_pixel_count is State.cyclePixelCount of the iterations the stats were summed over.
+    pub fn meanError(self: *const RenderStats, traced_pixel_count: u32) f32 {
+        if (traced_pixel_count == 0) return 0.0;
+        return @as(f32, @floatCast(@as(f64, @floatFromInt(self.errorSum())) / ERROR_SCALE / @as(f64, @floatFromInt(traced_pixel_count))));
+    }
+};
+
+// Counters of the bvh traversal, see traversal_stats.hip.h, only counted with -Dtraversal_stats=true.
+pub const TraversalStats = extern struct {
+    rays: u32 = 0,
+    internal_nodes: u32 = 0,
+    aabb_tests: u32 = 0,
+    triangle_tests: u32 = 0,
+    sphere_tests: u32 = 0,
+    blas_entries: u32 = 0, // rays transformed into the space of a mesh
+
+    // nodes visited and primitives tested, the value of a heatmap pixel
+    pub fn cost(self: *const TraversalStats) u32 {
+        return self.internal_nodes + self.triangle_tests + self.sphere_tests + self.blas_entries;
+    }
+};
+
+// Counts of a frame, summed over the pixel samples.
+pub const TraversalTotals = extern struct {
+    rays: u64 = 0,
+    internal_nodes: u64 = 0,
+    aabb_tests: u64 = 0,
+    triangle_tests: u64 = 0,
+    sphere_tests: u64 = 0,
+    blas_entries: u64 = 0,
+};
+
 pub const Camera = extern struct {
     const Self = @This();
     origin: Point3,
@@ -3,26 +3,73 @@ const util = @import("../util.zig");
 const gpu_structs = @import("../gpu_structs.zig");
 const hip = @import("hip.zig");
 const ornament = @import("../ornament.zig");
+const Denoiser = @import("../denoiser.zig").Denoiser;
+const Checkpoint = @import("../checkpoint.zig").Checkpoint;
+const options = @import("ornament_options");
 
 pub const WORKGROUP_SIZE: u32 = 256;
 
 pub const Target = struct {
     const Self = @This();
+    allocator: std.mem.Allocator,
     buffer: hip.c.hipDeviceptr_t,
     accumulation_buffer: hip.c.hipDeviceptr_t,
+    second_moment_buffer: hip.c.hipDeviceptr_t,
+    albedo_buffer: hip.c.hipDeviceptr_t,
+    normal_buffer: hip.c.hipDeviceptr_t,
+    denoised_buffer: hip.c.hipDeviceptr_t,
+    position_buffer: hip.c.hipDeviceptr_t,
+    history_accumulation_buffer: hip.c.hipDeviceptr_t,
+    history_second_moment_buffer: hip.c.hipDeviceptr_t,
+    history_position_buffer: hip.c.hipDeviceptr_t,
     rng_state_buffer: hip.c.hipDeviceptr_t,
+    render_stats: hip.c.hipDeviceptr_t,
+    // counts of the frame and of the last traced sample of every pixel, null without options.traversal_stats
+    traversal_stats: hip.c.hipDeviceptr_t,
+    traversal_heatmap: hip.c.hipDeviceptr_t,
+    // host copy of a packed frame buffer which getFrameBuffer decodes, empty for rgba32f
+    staging: []u8,
     resolution: util.Resolution,
+    output_format: util.OutputFormat,
+    accumulation_format: util.AccumulationFormat,
     workgroups: u32,
 
-    pub fn init(allocator: std.mem.Allocator, resolution: util.Resolution) !Self {
+    pub fn init(allocator: std.mem.Allocator, resolution: util.Resolution, output_format: util.OutputFormat, accumulation_format: util.AccumulationFormat) !Self {
         const pixels_count = resolution.pixel_count();
 
         var buffer: hip.c.hipDeviceptr_t = undefined;
         var accumulation_buffer: hip.c.hipDeviceptr_t = undefined;
+        var second_moment_buffer: hip.c.hipDeviceptr_t = undefined;
+        var albedo_buffer: hip.c.hipDeviceptr_t = undefined;
+        var normal_buffer: hip.c.hipDeviceptr_t = undefined;
+        var denoised_buffer: hip.c.hipDeviceptr_t = undefined;
+        var position_buffer: hip.c.hipDeviceptr_t = undefined;
+        var history_accumulation_buffer: hip.c.hipDeviceptr_t = undefined;
+        var history_second_moment_buffer: hip.c.hipDeviceptr_t = undefined;
+        var history_position_buffer: hip.c.hipDeviceptr_t = undefined;
         var rng_state_buffer: hip.c.hipDeviceptr_t = undefined;
-        try hip.checkError(hip.c.hipMalloc(&buffer, pixels_count * @sizeOf(gpu_structs.Vector4)));
-        try hip.checkError(hip.c.hipMalloc(&accumulation_buffer, pixels_count * @sizeOf(gpu_structs.Vector4)));
+        var render_stats: hip.c.hipDeviceptr_t = undefined;
+        try hip.checkError(hip.c.hipMalloc(&buffer, pixels_count * output_format.bytesPerPixel()));
+        try hip.checkError(hip.c.hipMalloc(&accumulation_buffer, pixels_count * accumulation_format.bytesPerPixel()));
+        try hip.checkError(hip.c.hipMalloc(&second_moment_buffer, pixels_count * @sizeOf(f32)));
+        try hip.checkError(hip.c.hipMalloc(&albedo_buffer, pixels_count * @sizeOf(gpu_structs.Vector4)));
+        try hip.checkError(hip.c.hipMalloc(&normal_buffer, pixels_count * @sizeOf(gpu_structs.Vector4)));
+        try hip.checkError(hip.c.hipMalloc(&denoised_buffer, pixels_count * @sizeOf(gpu_structs.Vector4)));
+        try hip.checkError(hip.c.hipMalloc(&position_buffer, pixels_count * @sizeOf(gpu_structs.Vector4)));
+        try hip.checkError(hip.c.hipMalloc(&history_accumulation_buffer, pixels_count * accumulation_format.bytesPerPixel()));
+        try hip.checkError(hip.c.hipMalloc(&history_second_moment_buffer, pixels_count * @sizeOf(f32)));
+        try hip.checkError(hip.c.hipMalloc(&history_position_buffer, pixels_count * @sizeOf(gpu_structs.Vector4)));
         try hip.checkError(hip.c.hipMalloc(&rng_state_buffer, pixels_count * @sizeOf(u32)));
+        try hip.checkError(hip.c.hipMalloc(&render_stats, @sizeOf(gpu_structs.RenderStats)));
+        try hip.checkError(hip.c.hipMemset(render_stats, 0, @sizeOf(gpu_structs.RenderStats)));
+        var traversal_stats: hip.c.hipDeviceptr_t = null;
+        var traversal_heatmap: hip.c.hipDeviceptr_t = null;
+        if (options.traversal_stats) {
+            try hip.checkError(hip.c.hipMalloc(&traversal_stats, @sizeOf(gpu_structs.TraversalTotals)));
+            try hip.checkError(hip.c.hipMemset(traversal_stats, 0, @sizeOf(gpu_structs.TraversalTotals)));
+            try hip.checkError(hip.c.hipMalloc(&traversal_heatmap, pixels_count * @sizeOf(gpu_structs.TraversalStats)));
+            try hip.checkError(hip.c.hipMemset(traversal_heatmap, 0, pixels_count * @sizeOf(gpu_structs.TraversalStats)));
+        }
 
         var rng_seed = try allocator.alloc(u32, pixels_count);
         defer allocator.free(rng_seed);
@@ -31,6 +78,8 @@ pub const Target = struct {
         }
 
         try hip.checkError(hip.c.hipMemcpy(rng_state_buffer, rng_seed.ptr, pixels_count * @sizeOf(u32), hip.c.hipMemcpyHostToDevice));
+        var staging: []u8 = &.{};
+        if (output_format != .rgba32f) staging = try allocator.alloc(u8, pixels_count * output_format.bytesPerPixel());
 
         var workgroups = pixels_count / WORKGROUP_SIZE;
         if (pixels_count % WORKGROUP_SIZE > 0) {
@@ -38,10 +87,25 @@ pub const Target = struct {
         }
 
         return .{
+            .allocator = allocator,
             .buffer = buffer,
             .accumulation_buffer = accumulation_buffer,
+            .second_moment_buffer = second_moment_buffer,
+            .albedo_buffer = albedo_buffer,
+            .normal_buffer = normal_buffer,
+            .denoised_buffer = denoised_buffer,
+            .position_buffer = position_buffer,
+            .history_accumulation_buffer = history_accumulation_buffer,
+            .history_second_moment_buffer = history_second_moment_buffer,
+            .history_position_buffer = history_position_buffer,
             .rng_state_buffer = rng_state_buffer,
+            .render_stats = render_stats,
+            .traversal_stats = traversal_stats,
+            .traversal_heatmap = traversal_heatmap,
+            .staging = staging,
             .resolution = resolution,
+            .output_format = output_format,
+            .accumulation_format = accumulation_format,
             .workgroups = workgroups,
         };
     }
@@ -49,7 +113,124 @@ pub const Target = struct {
     pub fn deinit(self: *Self) !void {
         try hip.checkError(hip.c.hipFree(self.buffer));
         try hip.checkError(hip.c.hipFree(self.accumulation_buffer));
+        try hip.checkError(hip.c.hipFree(self.second_moment_buffer));
+        try hip.checkError(hip.c.hipFree(self.albedo_buffer));
+        try hip.checkError(hip.c.hipFree(self.normal_buffer));
+        try hip.checkError(hip.c.hipFree(self.denoised_buffer));
+        try hip.checkError(hip.c.hipFree(self.position_buffer));
+        try hip.checkError(hip.c.hipFree(self.history_accumulation_buffer));
+        try hip.checkError(hip.c.hipFree(self.history_second_moment_buffer));
+        try hip.checkError(hip.c.hipFree(self.history_position_buffer));
         try hip.checkError(hip.c.hipFree(self.rng_state_buffer));
+        try hip.checkError(hip.c.hipFree(self.render_stats));
+        if (self.traversal_stats != null) try hip.checkError(hip.c.hipFree(self.traversal_stats));
+        if (self.traversal_heatmap != null) try hip.checkError(hip.c.hipFree(self.traversal_heatmap));
+        self.allocator.free(self.staging);
+    }
+
+    // Workgroups covering every pixel_stride-th pixel in both directions.
+    pub fn stridedWorkgroups(self: *const Self, pixel_stride: u32) u32 {
+        const width = (self.resolution.width + pixel_stride - 1) / pixel_stride;
+        const height = (self.resolution.height + pixel_stride - 1) / pixel_stride;
+        return (width * height + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+    }
+
+    pub fn resetRenderStats(self: *const Self) !void {
+        return hip.checkError(hip.c.hipMemset(self.render_stats, 0, @sizeOf(gpu_structs.RenderStats)));
+    }
+
+    pub fn resetCycleStats(self: *const Self) !void {
+        return hip.checkError(hip.c.hipMemset(self.render_stats, 0, gpu_structs.RenderStats.RAY_COUNT_OFFSET));
+    }
+
+    pub fn resetRayCount(self: *const Self) !void {
+        const ray_count: hip.c.hipDeviceptr_t = @ptrFromInt(@intFromPtr(self.render_stats) + gpu_structs.RenderStats.RAY_COUNT_OFFSET);
+        return hip.checkError(hip.c.hipMemset(ray_count, 0, @sizeOf(gpu_structs.RenderStats) - gpu_structs.RenderStats.RAY_COUNT_OFFSET));
+    }
+
+    pub fn getRenderStats(self: *const Self) !gpu_structs.RenderStats {
+        var stats = gpu_structs.RenderStats{};
+        try hip.checkError(hip.c.hipMemcpy(&stats, self.render_stats, @sizeOf(gpu_structs.RenderStats), hip.c.hipMemcpyDeviceToHost));
+        return stats;
+    }
+
+    // Device bytes of the buffers.
+    pub fn memoryBytes(self: *const Self) usize {
+        const pixels_count: usize = self.resolution.pixel_count();
+        var bytes = pixels_count * (self.output_format.bytesPerPixel() +
+            2 * self.accumulation_format.bytesPerPixel() + // with the history
+            2 * @sizeOf(f32) + // second moments
+            5 * @sizeOf(gpu_structs.Vector4) + // albedo, normal, denoised, positions
+            @sizeOf(u32)) + // rng states
+            @sizeOf(gpu_structs.RenderStats);
+        if (self.traversal_stats != null) bytes += @sizeOf(gpu_structs.TraversalTotals) + pixels_count * @sizeOf(gpu_structs.TraversalStats);
+        return bytes;
+    }
+
+    pub fn resetTraversalStats(self: *const Self) !void {
+        return hip.checkError(hip.c.hipMemset(self.traversal_stats, 0, @sizeOf(gpu_structs.TraversalTotals)));
+    }
+
+    pub fn getTraversalStats(self: *const Self) !gpu_structs.TraversalTotals {
+        var stats = gpu_structs.TraversalTotals{};
+        try hip.checkError(hip.c.hipMemcpy(&stats, self.traversal_stats, @sizeOf(gpu_structs.TraversalTotals), hip.c.hipMemcpyDeviceToHost));
+        return stats;
+    }
+
+    pub fn getTraversalHeatmap(self: *const Self, dst: []gpu_structs.TraversalStats) !void {
+        return hip.checkError(hip.c.hipMemcpy(dst.ptr, self.traversal_heatmap, dst.len * @sizeOf(gpu_structs.TraversalStats), hip.c.hipMemcpyDeviceToHost));
+    }
+
+    // Keeps the accumulation for the reprojection after a camera move.
+    pub fn saveHistory(self: *const Self) !void {
+        const pixels_count = self.resolution.pixel_count();
+        try memcpyDToD(self.history_accumulation_buffer, self.accumulation_buffer, pixels_count * self.accumulation_format.bytesPerPixel());
+        try memcpyDToD(self.history_second_moment_buffer, self.second_moment_buffer, pixels_count * @sizeOf(f32));
+        try memcpyDToD(self.history_position_buffer, self.position_buffer, pixels_count * @sizeOf(gpu_structs.Vector4));
+    }
+
+    pub fn readDenoiserInputs(self: *const Self, denoiser: *Denoiser) !void {
+        try self.readAccumulation(denoiser.accumulation);
+        try memcpyDToH(gpu_structs.Vector4, denoiser.albedo, self.albedo_buffer);
+        try memcpyDToH(gpu_structs.Vector4, denoiser.normal, self.normal_buffer);
+        try memcpyDToH(f32, denoiser.second_moment, self.second_moment_buffer);
+    }
+
+    pub fn writeDenoised(self: *const Self, src: []const gpu_structs.Vector4) !void {
+        return memcpyHToD(gpu_structs.Vector4, self.denoised_buffer, src);
+    }
+
+    pub fn readCheckpoint(self: *const Self, checkpoint: *Checkpoint) !void {
+        try self.readAccumulation(checkpoint.accumulation);
+        try memcpyDToH(f32, checkpoint.second_moment, self.second_moment_buffer);
+        try memcpyDToH(gpu_structs.Vector4, checkpoint.albedo, self.albedo_buffer);
+        try memcpyDToH(gpu_structs.Vector4, checkpoint.normal, self.normal_buffer);
+        try memcpyDToH(u32, checkpoint.rng_state, self.rng_state_buffer);
+    }
+
+    pub fn writeCheckpoint(self: *const Self, checkpoint: *const Checkpoint) !void {
+        try self.writeAccumulation(checkpoint.accumulation);
+        try memcpyHToD(f32, self.second_moment_buffer, checkpoint.second_moment);
+        try memcpyHToD(gpu_structs.Vector4, self.albedo_buffer, checkpoint.albedo);
+        try memcpyHToD(gpu_structs.Vector4, self.normal_buffer, checkpoint.normal);
+        try memcpyHToD(u32, self.rng_state_buffer, checkpoint.rng_state);
+    }
+
+    // Sums of the samples with the samples count in w, whatever the accumulation format is.
+    fn readAccumulation(self: *const Self, dst: []gpu_structs.Vector4) !void {
+        if (self.accumulation_format == .rgba32f) return memcpyDToH(gpu_structs.Vector4, dst, self.accumulation_buffer);
+        const bytes = try self.allocator.alloc(u8, dst.len * self.accumulation_format.bytesPerPixel());
+        defer self.allocator.free(bytes);
+        try memcpyDToH(u8, bytes, self.accumulation_buffer);
+        self.accumulation_format.decode(bytes, dst);
+    }
+
+    fn writeAccumulation(self: *const Self, src: []const gpu_structs.Vector4) !void {
+        if (self.accumulation_format == .rgba32f) return memcpyHToD(gpu_structs.Vector4, self.accumulation_buffer, src);
+        const bytes = try self.allocator.alloc(u8, src.len * self.accumulation_format.bytesPerPixel());
+        defer self.allocator.free(bytes);
+        self.accumulation_format.encode(src, bytes);
+        try memcpyHToD(u8, self.accumulation_buffer, bytes);
     }
 };
 
@@ -72,6 +253,10 @@ pub fn Array(comptime T: type) type {
         pub fn deinit(self: *Self) !void {
             return hip.checkError(hip.c.hipFree(self.dptr));
         }
+
+        pub fn bytes(self: *const Self) usize {
+            return @as(usize, self.len) * @sizeOf(T);
+        }
     };
 }
 
@@ -96,11 +281,14 @@ pub const Textures = struct {
     const Self = @This();
     texture_objects: std.ArrayList(hip.c.hipTextureObject_t),
     texture_data: std.ArrayList(hip.c.hipDeviceptr_t),
+    // pitched texels of texture_data
+    texture_data_bytes: usize,
     device_texture_objects: Array(hip.c.hipTextureObject_t),
 
     pub fn init(allocator: std.mem.Allocator, textures: []const *ornament.Texture, pitch_alignment: usize) !Self {
         var texture_objects = try std.ArrayList(hip.c.hipTextureObject_t).initCapacity(allocator, textures.len);
         var texture_data = try std.ArrayList(hip.c.hipDeviceptr_t).initCapacity(allocator, textures.len);
+        var texture_data_bytes: usize = 0;
 
         for (textures) |txt| {
             const format = if (txt.is_hdr) hip.c.HIP_AD_FORMAT_FLOAT else hip.c.HIP_AD_FORMAT_UNSIGNED_INT8;
@@ -111,6 +299,7 @@ pub const Textures = struct {
             var dptr: hip.c.hipDeviceptr_t = undefined;
             try hip.checkError(hip.c.hipMalloc(&dptr, dst_pitch * txt.height));
             try texture_data.append(dptr);
+            texture_data_bytes += dst_pitch * txt.height;
             const param = std.mem.zeroInit(hip.c.hip_Memcpy2D, .{
                 .dstMemoryType = hip.c.hipMemoryTypeDevice,
                 .dstDevice = dptr,
@@ -146,10 +335,15 @@ pub const Textures = struct {
         return .{
             .texture_objects = texture_objects,
             .texture_data = texture_data,
+            .texture_data_bytes = texture_data_bytes,
             .device_texture_objects = try Array(hip.c.hipTextureObject_t).init(texture_objects.items),
         };
     }
 
+    pub fn memoryBytes(self: *const Self) usize {
+        return self.texture_data_bytes + self.device_texture_objects.bytes();
+    }
+
     pub fn deinit(self: *Self) !void {
         for (self.texture_objects.items) |to| try hip.checkError(hip.c.hipTexObjectDestroy(to));
         self.texture_objects.deinit();
@@ -181,3 +375,16 @@ fn memcpyHToD(comptime T: type, device_dest: hip.c.hipDeviceptr_t, host_source:
         hip.c.hipMemcpyHostToDevice,
     ));
 }
+
+fn memcpyDToD(device_dest: hip.c.hipDeviceptr_t, device_source: hip.c.hipDeviceptr_t, bytes: usize) !void {
+    return hip.checkError(hip.c.hipMemcpy(device_dest, device_source, bytes, hip.c.hipMemcpyDeviceToDevice));
+}
+
+fn memcpyDToH(comptime T: type, host_dest: []T, device_source: hip.c.hipDeviceptr_t) !void {
+    return hip.checkError(hip.c.hipMemcpy(
+        @as(?*anyopaque, @ptrCast(host_dest.ptr)),
+        device_source,
+        host_dest.len * @sizeOf(T),
+        hip.c.hipMemcpyDeviceToHost,
+    ));
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <hip/hip_runtime.h>
+#include "common.hip.h"
+#include "vec_math.hip.h"
+#include "constants.hip.h"
+
+// Layouts of the accumulation buffers, same values as AccumulationFormat of src/util.zig.
+// RGBA32F keeps the sums of the samples and the samples count in w.
+// RGB15E5 packs the running mean as 15 bit mantissas with a shared 5 bit exponent and the samples count
+// as a 14 bit integer into 8 bytes per pixel. The mean doesn't grow with the samples and it is rounded
+// stochastically, so small updates of pixels with many samples are not lost. The rounding errors of
+// the stores add up, to about 0.01% / 0.03% / 0.05% / 0.1% rms at 64 / 256 / 1024 / 4096 samples.
+// Past RGB15E5_MAX_COUNT samples the count stays and the mean becomes a moving average of the last samples,
+// the kernels scale the other sums of the pixel with saturation_scale so they average with the same weights.
+#define ACCUMULATION_FORMAT_RGBA32F 0
+#define ACCUMULATION_FORMAT_RGB15E5 1
+
+#define RGB15E5_MANTISSA_BITS 15
+#define RGB15E5_EXPONENT_BIAS 15
+#define RGB15E5_MAX 65534.0f
+#define RGB15E5_MAX_COUNT 16383u
+
+// Same for all channels of a pixel and different for every iteration.
+HOST_DEVICE INLINE float accumulation_dither(uint32_t id)
+{
+    uint32_t v = id * 747796405u + (uint32_t)constant_params.current_iteration * 2891336453u;
+    uint32_t word = ((v >> ((v >> 28) + 4)) ^ v) * 277803737u;
+    return (float)((word >> 22) ^ word) * (1.0f / 4294967296.0f);
+}
+
+// r, g, b, exponent and count from the low bits, dither 0.5 rounds to nearest,
+// a uniform random dither rounds without bias on average.
+HOST_DEVICE INLINE uint2 encode_rgb15e5(float r, float g, float b, uint32_t count, float dither)
+{
+    r = min(max(r, 0.0f), RGB15E5_MAX);
+    g = min(max(g, 0.0f), RGB15E5_MAX);
+    b = min(max(b, 0.0f), RGB15E5_MAX);
+    count = min(count, RGB15E5_MAX_COUNT);
+    float max_c = max(r, max(g, b));
+    if (max_c <= 0.0f) { return make_uint2(0, count << 18); }
+
+    int32_t exponent = max(-RGB15E5_EXPONENT_BIAS - 1, (int32_t)floorf(log2f(max_c))) + 1 + RGB15E5_EXPONENT_BIAS;
+    float scale = exp2f((float)(RGB15E5_EXPONENT_BIAS + RGB15E5_MANTISSA_BITS - exponent));
+    if (floorf(max_c * scale + 0.5f) >= (float)(1 << RGB15E5_MANTISSA_BITS))
+    {
+        exponent += 1;
+        scale *= 0.5f;
+    }
+    uint32_t max_mantissa = (1 << RGB15E5_MANTISSA_BITS) - 1;
+    uint64_t rm = min((uint32_t)(r * scale + dither), max_mantissa);
+    uint64_t gm = min((uint32_t)(g * scale + dither), max_mantissa);
+    uint64_t bm = min((uint32_t)(b * scale + dither), max_mantissa);
+    uint64_t packed = rm | (gm << 15) | (bm << 30) | ((uint64_t)exponent << 45) | ((uint64_t)count << 50);
+    return make_uint2((uint32_t)packed, (uint32_t)(packed >> 32));
+}
+
+// Means in xyz and the samples count in w.
+HOST_DEVICE INLINE float4 decode_rgb15e5(const uint2& rgb15e5)
+{
+    uint64_t packed = ((uint64_t)rgb15e5.y << 32) | rgb15e5.x;
+    int32_t exponent = (int32_t)((packed >> 45) & 0x1f);
+    float scale = exp2f((float)(exponent - RGB15E5_EXPONENT_BIAS - RGB15E5_MANTISSA_BITS));
+    return make_float4(
+        (float)(packed & 0x7fff) * scale,
+        (float)((packed >> 15) & 0x7fff) * scale,
+        (float)((packed >> 30) & 0x7fff) * scale,
+        (float)(packed >> 50));
+}
+
+// Pointer to an accumulation buffer of constant_params.accumulation_format,
+// loads and stores exchange the sums and the samples count in w in both formats.
+struct AccumulationBuffer
+{
+    void* data;
+
+    HOST_DEVICE INLINE float4 load(uint32_t id) const
+    {
+        if (constant_params.accumulation_format == ACCUMULATION_FORMAT_RGBA32F) { return ((const float4*)data)[id]; }
+        float4 mean = decode_rgb15e5(((const uint2*)data)[id]);
+        return make_float4(mean.x * mean.w, mean.y * mean.w, mean.z * mean.w, mean.w);
+    }
+
+    // Factor which keeps the sums of count samples within the count of the format.
+    HOST_DEVICE INLINE float saturation_scale(float count) const
+    {
+        if (constant_params.accumulation_format == ACCUMULATION_FORMAT_RGBA32F || count <= (float)RGB15E5_MAX_COUNT) { return 1.0f; }
+        return (float)RGB15E5_MAX_COUNT / count;
+    }
+
+    HOST_DEVICE INLINE void store(uint32_t id, const float4& rgba)
+    {
+        if (constant_params.accumulation_format == ACCUMULATION_FORMAT_RGBA32F)
+        {
+            ((float4*)data)[id] = rgba;
+            return;
+        }
+        // the counts are whole samples, reprojection scales the history to whole samples too
+        float inv_count = rgba.w > 0.0f ? 1.0f / rgba.w : 0.0f;
+        ((uint2*)data)[id] = encode_rgb15e5(rgba.x * inv_count, rgba.y * inv_count, rgba.z * inv_count, (uint32_t)(rgba.w + 0.5f), accumulation_dither(id));
+    }
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <hip/hip_runtime.h>
+#include "common.hip.h"
+#include "vec_math.hip.h"
+#include "constants.hip.h"
+
+#define RENDER_STATS_ERROR_SCALE 256.0f
+
+struct RenderStats
+{
+    uint32_t active_pixel_count;
+    // 64 bit sum split into words like in the wgsl shaders, which have no 64 bit atomics
+    uint32_t error_sum_low;
+    uint32_t error_sum_high;
+    // summed over the iterations of a render
+    uint32_t secondary_ray_count_low;
+    uint32_t secondary_ray_count_high;
+};
+
+HOST_DEVICE INLINE float luminance(const float3& rgb)
+{
+    return 0.2126f * rgb.x + 0.7152f * rgb.y + 0.0722f * rgb.z;
+}
+
+// Standard error of the mean luminance relative to the mean, clamped to 1.
+// accumulated_rgba.w is the number of samples of the pixel.
+HOST_DEVICE INLINE float estimate_relative_error(const float4& accumulated_rgba, float second_moment)
+{
+    float n = accumulated_rgba.w;
+    if (n < 2.0f) { return 1.0f; }
+
+    float mean = luminance(make_float3(accumulated_rgba)) / n;
+    float variance = max(second_moment / n - mean * mean, 0.0f) * n / (n - 1.0f);
+    // small absolute term keeps dark pixels from never converging
+    float error = sqrtf(variance / n) / (mean + 0.01f);
+    return min(error, 1.0f);
+}
+
+HOST_DEVICE INLINE bool is_converged(const float4& accumulated_rgba, float error)
+{
+    return constant_params.adaptive_sampling != 0
+        && accumulated_rgba.w >= (float)constant_params.adaptive_min_samples
+        && error < constant_params.adaptive_threshold;
+}
+
+// secondary_rays are the rays of the sample traced after the camera ray, the bounces and the shadow rays.
+HOST_DEVICE INLINE void record_render_stats(RenderStats* stats, float error, bool converged, uint32_t secondary_rays)
+{
+    uint32_t quantized_error = (uint32_t)(error * RENDER_STATS_ERROR_SCALE);
+    if (quantized_error > 0)
+    {
+        uint32_t previous = atomicAdd(&stats->error_sum_low, quantized_error);
+        if (previous + quantized_error < previous) { atomicAdd(&stats->error_sum_high, 1u); }
+    }
+    if (!converged) { atomicAdd(&stats->active_pixel_count, 1u); }
+    if (secondary_rays > 0)
+    {
+        uint32_t previous = atomicAdd(&stats->secondary_ray_count_low, secondary_rays);
+        if (previous + secondary_rays < previous) { atomicAdd(&stats->secondary_ray_count_high, 1u); }
+    }
+}
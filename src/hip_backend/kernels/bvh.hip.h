@@ -7,6 +7,7 @@
 #include "vec_math.hip.h"
 #include "constants.hip.h"
 #include "transform.hip.h"
+#include "traversal_stats.hip.h"
 
 enum BvhNodeType : uint32_t
 {
@@ -149,7 +150,8 @@ struct Bvh
         BvhNodeType* closest_bvh_node_type,
         uint32_t* closest_inverted_transform_id,
         uint32_t* closest_tri_id,
-        float2* closest_uv) 
+        float2* closest_uv,
+        TraversalStats* stats) 
     {
         #define finished_traverse_blas 0xffffffff
         float t_min = constant_params.ray_cast_epsilon;
@@ -163,6 +165,7 @@ struct Bvh
         bool traverse_tlas = true;
 
         bool hit_anything = false;
+        COUNT_TRAVERSAL(stats, rays, 1);
 
         Ray ray = not_transformed_ray;
         float3 invdir = safe_invdir(ray.direction);
@@ -179,6 +182,8 @@ struct Bvh
             {
                 case InternalNode: 
                 {
+                    COUNT_TRAVERSAL(stats, internal_nodes, 1);
+                    COUNT_TRAVERSAL(stats, aabb_tests, 2);
                     float2 left = aabb_hit(node.left_aabb_min_or_v0, node.left_aabb_max_or_v1, invdir, oxinvdir, t_min, t_max);
                     float2 right = aabb_hit(node.right_aabb_min_or_v2, node.right_aabb_max_or_v3, invdir, oxinvdir, t_min, t_max);
                     
@@ -197,6 +202,7 @@ struct Bvh
                 }
                 case Sphere: 
                 {
+                    COUNT_TRAVERSAL(stats, sphere_tests, 1);
                     inverted_transform_id = node.transform_id * 2;
                     Ray transformed_ray = transform_ray(transforms, inverted_transform_id, ray);
                     float t = sphere_hit(transformed_ray, t_min, t_max);
@@ -213,6 +219,7 @@ struct Bvh
                 }
                 case Mesh: 
                 {
+                    COUNT_TRAVERSAL(stats, blas_entries, 1);
                     // push signal to restore transformation after finshing mesh bvh
                     traverse_tlas = false;
                     stack_top++;
@@ -231,6 +238,7 @@ struct Bvh
                 }
                 case Triangle: 
                 {
+                    COUNT_TRAVERSAL(stats, triangle_tests, 1);
                     float2 uv;
                     float t = triangle_hit(
                         ray, 
@@ -4,6 +4,7 @@
 #include "common.hip.h"
 #include "ray.hip.h"
 #include "random.hip.h"
+#include "vec_math.hip.h"
 
 struct Camera
 {
@@ -31,4 +32,19 @@ struct Camera
             lower_left_corner + s * horizontal + t * vertical - origin - offset
         );
     }
+
+    // Inverse of get_ray for a pinhole: screen coordinates of a direction from the origin.
+    HOST_DEVICE INLINE bool project(const float3& direction, float2* st)
+    {
+        float forward = -dot(direction, w);
+        if (forward <= 0.0f) { return false; }
+
+        float focus_dist = dot(origin - lower_left_corner, w);
+        float3 on_focus_plane = direction * (focus_dist / forward) + origin - lower_left_corner;
+        *st = make_float2(
+            dot(on_focus_plane, horizontal) / dot(horizontal, horizontal),
+            dot(on_focus_plane, vertical) / dot(vertical, vertical)
+        );
+        return true;
+    }
 };
\ No newline at end of file
@@ -5,6 +5,7 @@
 struct ConstantParams
 {
     Camera camera;
+    Camera previous_camera;
     uint32_t depth;
     uint32_t width;
     uint32_t height;
@@ -13,4 +14,20 @@ struct ConstantParams
     float ray_cast_epsilon;
     uint32_t textures_count;
     float current_iteration;
+    uint32_t light_nodes_count;
+    uint32_t environment_map_texture_id;
+    uint32_t environment_map_width;
+    uint32_t environment_map_height;
+    uint32_t adaptive_sampling;
+    float adaptive_threshold;
+    uint32_t adaptive_min_samples;
+    uint32_t denoise;
+    uint32_t reproject;
+    uint32_t temporal_history_limit;
+    uint32_t pixel_stride;
+    uint32_t output_format;
+    uint32_t accumulation_format;
+    uint32_t _padding0;
+    uint32_t _padding1;
+    uint32_t _padding2;
 };
\ No newline at end of file
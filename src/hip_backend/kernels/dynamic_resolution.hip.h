@@ -0,0 +1,51 @@
+#pragma once
+
+#include <hip/hip_runtime.h>
+#include "common.hip.h"
+#include "vec_math.hip.h"
+#include "constants.hip.h"
+
+// Iterations after a reset trace the pixels with one offset of the stride pattern each,
+// an offset is (x % pixel_stride, y % pixel_stride) and its index is y_offset * pixel_stride + x_offset.
+HOST_DEVICE INLINE uint32_t pixel_offset_index()
+{
+    uint32_t stride = constant_params.pixel_stride;
+    return ((uint32_t)constant_params.current_iteration - 1) % (stride * stride);
+}
+
+// The first sample of every pixel is taken during the first pixel_stride^2 iterations.
+HOST_DEVICE INLINE bool is_first_cycle()
+{
+    uint32_t stride = constant_params.pixel_stride;
+    return constant_params.current_iteration <= (float)(stride * stride);
+}
+
+// Maps an invocation of the reduced grid to the pixel it traces this iteration.
+HOST_DEVICE INLINE bool strided_pixel_id(uint32_t global_id, uint32_t* pixel_id)
+{
+    uint32_t stride = constant_params.pixel_stride;
+    uint32_t strided_width = (constant_params.width + stride - 1) / stride;
+    uint32_t strided_height = (constant_params.height + stride - 1) / stride;
+    if (global_id >= strided_width * strided_height) { return false; }
+
+    uint32_t offset = pixel_offset_index();
+    uint32_t x = (global_id % strided_width) * stride + offset % stride;
+    uint32_t y = (global_id / strided_width) * stride + offset / stride;
+    if (x >= constant_params.width || y >= constant_params.height) { return false; }
+
+    *pixel_id = y * constant_params.width + x;
+    return true;
+}
+
+// Pixel whose accumulation is shown at xy, pixels not traced since the reset
+// take the pixel of their stride block traced by the first iteration.
+HOST_DEVICE INLINE uint32_t traced_pixel_id(const uint2& xy)
+{
+    uint32_t stride = constant_params.pixel_stride;
+    uint32_t x_offset = xy.x % stride;
+    uint32_t y_offset = xy.y % stride;
+    if (y_offset * stride + x_offset < (uint32_t)constant_params.current_iteration) {
+        return xy.y * constant_params.width + xy.x;
+    }
+    return (xy.y - y_offset) * constant_params.width + (xy.x - x_offset);
+}
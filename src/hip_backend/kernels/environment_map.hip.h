@@ -0,0 +1,101 @@
+#pragma once
+
+#include <hip/hip_runtime.h>
+#include <hip/hip_math_constants.h>
+#include "common.hip.h"
+#include "array.hip.h"
+#include "vec_math.hip.h"
+#include "random.hip.h"
+#include "constants.hip.h"
+
+struct AliasEntry
+{
+    float q;
+    uint32_t alias;
+    float pdf;
+    uint32_t _padding;
+};
+
+HOST_DEVICE INLINE float power_heuristic(float pdf_a, float pdf_b)
+{
+    float a2 = pdf_a * pdf_a;
+    float b2 = pdf_b * pdf_b;
+    return a2 + b2 > 0.0f ? a2 / (a2 + b2) : 0.0f;
+}
+
+// Equirectangular environment map, uses the same uv mapping as spheres.
+struct EnvironmentMap
+{
+    Array<AliasEntry> alias_table;
+
+    HOST_DEVICE INLINE bool enabled()
+    {
+        return constant_params.environment_map_texture_id != 0xffffffff;
+    }
+
+    HOST_DEVICE INLINE float2 direction_to_uv(const float3& direction)
+    {
+        float theta = acos(-direction.y);
+        float phi = atan2(-direction.z, direction.x) + HIP_PI_F;
+        return make_float2(phi / (2.0f * HIP_PI_F), theta / HIP_PI_F);
+    }
+
+    HOST_DEVICE INLINE float3 uv_to_direction(const float2& uv, float* sin_theta)
+    {
+        float theta = uv.y * HIP_PI_F;
+        float phi = uv.x * 2.0f * HIP_PI_F;
+        float cos_theta, sin_phi, cos_phi;
+        sincosf(theta, sin_theta, &cos_theta);
+        sincosf(phi, &sin_phi, &cos_phi);
+        return make_float3(-*sin_theta * cos_phi, -cos_theta, *sin_theta * sin_phi);
+    }
+
+    HOST_DEVICE INLINE float3 eval_uv(const float2& uv, const Array<hipTextureObject_t>& textures)
+    {
+        return make_float3(tex2D<float4>(textures[constant_params.environment_map_texture_id], uv.x, uv.y));
+    }
+
+    HOST_DEVICE float3 eval(const float3& direction, const Array<hipTextureObject_t>& textures)
+    {
+        return eval_uv(direction_to_uv(direction), textures);
+    }
+
+    // Solid angle pdf of sampling the normalized direction.
+    HOST_DEVICE float pdf(const float3& direction)
+    {
+        float2 uv = direction_to_uv(direction);
+        uint32_t width = constant_params.environment_map_width;
+        uint32_t height = constant_params.environment_map_height;
+        uint32_t x = min((uint32_t)(uv.x * width), width - 1);
+        uint32_t y = min((uint32_t)(uv.y * height), height - 1);
+        float sin_theta = sqrtf(max(0.0f, 1.0f - direction.y * direction.y));
+        if (sin_theta == 0.0f) { return 0.0f; }
+        return alias_table[y * width + x].pdf * (float)(width * height) / (2.0f * HIP_PI_F * HIP_PI_F * sin_theta);
+    }
+
+    HOST_DEVICE bool sample(RndGen& rnd, const Array<hipTextureObject_t>& textures, float3* direction, float3* radiance, float* pdf)
+    {
+        uint32_t width = constant_params.environment_map_width;
+        uint32_t height = constant_params.environment_map_height;
+        uint32_t index = min((uint32_t)(rnd.gen_float() * alias_table.len), alias_table.len - 1);
+        AliasEntry entry = alias_table[index];
+        if (rnd.gen_float() >= entry.q)
+        {
+            index = entry.alias;
+            entry = alias_table[index];
+        }
+
+        // uniformly inside of the texel
+        float2 uv = make_float2(
+            ((float)(index % width) + rnd.gen_float()) / width,
+            ((float)(index / width) + rnd.gen_float()) / height
+        );
+        float sin_theta;
+        *direction = uv_to_direction(uv, &sin_theta);
+        if (sin_theta == 0.0f) { return false; }
+
+        *pdf = entry.pdf * (float)(width * height) / (2.0f * HIP_PI_F * HIP_PI_F * sin_theta);
+        *radiance = eval_uv(uv, textures);
+        return *pdf > 0.0f;
+    }
+};
@@ -3,18 +3,37 @@
 #include <hip/hip_runtime.h>
 #include "common.hip.h"
 #include "bvh.hip.h"
+#include "lights.hip.h"
+#include "environment_map.hip.h"
+#include "adaptive_sampling.hip.h"
+#include "reprojection.hip.h"
+#include "dynamic_resolution.hip.h"
 #include "material.hip.h"
 #include "random.hip.h"
 #include "array.hip.h"
-#include "bvh.hip.h"
+#include "accumulation.hip.h"
+#include "traversal_stats.hip.h"
 
 struct KernalGlobals
 {
     Bvh bvh;
+    LightBvh light_bvh;
+    EnvironmentMap environment_map;
     Array<Material> materials;
     Array<hipTextureObject_t> textures;
-    float4* framebuffer;
-    float4* accumulation_buffer;
+    // pixels of constant_params.output_format, see output_format.hip.h
+    void* framebuffer;
+    AccumulationBuffer accumulation_buffer;
+    float* second_moment_buffer;
+    float4* albedo_buffer;
+    float4* normal_buffer;
+    float4* denoised_buffer;
+    float4* position_buffer;
+    History history;
+    RenderStats* render_stats;
+    // null unless the kernels are built with TRAVERSAL_STATS
+    TraversalTotals* traversal_stats;
+    TraversalStats* traversal_heatmap;
     uint32_t* rng_seed_buffer;
     uint32_t pixel_count;
 };
@@ -25,15 +44,26 @@ struct KernalLocalState
     uint2 xy;
     uint32_t global_invocation_id;
     RndGen rnd;
+    // rays of the pixel sample, see traversal_stats.hip.h
+    TraversalStats traversal_stats;
+    // bvh.hit calls of the pixel sample, the camera ray, the bounces and the shadow rays
+    uint32_t rays;
 
     HOST_DEVICE KernalLocalState(const KernalGlobals& kg, uint2 resolution, uint32_t global_invocation_id) : kg(kg),
         xy(make_uint2(global_invocation_id % resolution.x, global_invocation_id / resolution.x)),
         global_invocation_id(global_invocation_id), 
-        rnd(kg.rng_seed_buffer[global_invocation_id])
+        rnd(kg.rng_seed_buffer[global_invocation_id]),
+        traversal_stats{},
+        rays(0)
     {}
 
     HOST_DEVICE INLINE void save_rng_seed()
     {
         kg.rng_seed_buffer[global_invocation_id] = rnd.state;
     }
+
+    HOST_DEVICE INLINE void save_traversal_stats()
+    {
+        record_traversal_stats(kg.traversal_stats, kg.traversal_heatmap, global_invocation_id, traversal_stats);
+    }
 };
\ No newline at end of file
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <hip/hip_runtime.h>
+#include <hip/hip_math_constants.h>
+#include "common.hip.h"
+#include "array.hip.h"
+#include "vec_math.hip.h"
+#include "random.hip.h"
+#include "hitrecord.hip.h"
+#include "material.hip.h"
+#include "bvh.hip.h"
+
+enum LightNodeType : uint32_t
+{
+    LightInternalNode = 0,
+    LightLeafNode = 1,
+};
+
+enum LightType : uint32_t
+{
+    SphereLight = 0,
+    TriangleLight = 1,
+};
+
+struct LightNode
+{
+    float3 aabb_min;
+    uint32_t left_or_light_id; // internal left node id / light id
+    float3 aabb_max;
+    uint32_t right;
+    float3 axis;
+    LightNodeType node_type;
+    float power;
+    float cos_theta_o;
+    float cos_theta_e;
+    uint32_t _padding;
+};
+
+struct Light
+{
+    float3 v0_or_center;
+    LightType light_type;
+    float3 v1;
+    uint32_t material_index;
+    float3 v2;
+    uint32_t triangle_id;
+    float radius;
+    float area;
+    uint32_t _padding0;
+    uint32_t _padding1;
+};
+
+struct LightSample
+{
+    float3 direction;
+    float distance;
+    float3 radiance;
+    // solid angle pdf, includes the probability to pick the light
+    float pdf;
+};
+
+struct LightBvh
+{
+    Array<LightNode> nodes;
+    Array<Light> lights;
+
+    #define ONE_MINUS_EPSILON 0.99999994f
+
+    HOST_DEVICE INLINE float safe_sqrt(float x)
+    {
+        return sqrtf(x > 0.0f ? x : 0.0f);
+    }
+
+    // cos(max(0, theta_a - theta_b))
+    HOST_DEVICE INLINE float cos_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b)
+    {
+        if (cos_a > cos_b) { return 1.0f; }
+        return cos_a * cos_b + sin_a * sin_b;
+    }
+
+    // sin(max(0, theta_a - theta_b))
+    HOST_DEVICE INLINE float sin_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b)
+    {
+        if (cos_a > cos_b) { return 0.0f; }
+        return sin_a * cos_b - cos_a * sin_b;
+    }
+
+    // Conservative estimate of the light a node sends to the point p with the normal n.
+    HOST_DEVICE float importance(const LightNode& node, const float3& p, const float3& n)
+    {
+        float3 pc = 0.5f * (node.aabb_min + node.aabb_max);
+        float3 pc_to_p = p - pc;
+        float bounds_radius = 0.5f * length(node.aabb_max - node.aabb_min);
+        float d2 = length_squared(pc_to_p);
+        float d2_clamped = d2 > bounds_radius ? d2 : bounds_radius;
+
+        // angle between the cone axis and the direction to the point, lights are two sided
+        float3 wi = d2 > 0.0f ? pc_to_p / sqrtf(d2) : make_float3(0.0f);
+        float cos_theta_w = abs(dot(node.axis, wi));
+        float sin_theta_w = safe_sqrt(1.0f - cos_theta_w * cos_theta_w);
+
+        // angle subtended by the bounds as seen from the point
+        float cos_theta_b = -1.0f;
+        if (d2 > bounds_radius * bounds_radius)
+        {
+            cos_theta_b = safe_sqrt(1.0f - bounds_radius * bounds_radius / d2);
+        }
+        float sin_theta_b = safe_sqrt(1.0f - cos_theta_b * cos_theta_b);
+
+        float sin_theta_o = safe_sqrt(1.0f - node.cos_theta_o * node.cos_theta_o);
+        float cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, node.cos_theta_o);
+        float sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, node.cos_theta_o);
+        float cos_theta_p = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+        if (cos_theta_p <= node.cos_theta_e) { return 0.0f; }
+
+        float cos_theta_i = abs(dot(wi, n));
+        float sin_theta_i = safe_sqrt(1.0f - cos_theta_i * cos_theta_i);
+        float cos_theta_pi = cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+
+        float importance = node.power * cos_theta_p * cos_theta_pi / d2_clamped;
+        return importance > 0.0f ? importance : 0.0f;
+    }
+
+    // Stochastic traversal, every step picks a child proportionally to its importance.
+    HOST_DEVICE bool pick_light(const float3& p, const float3& n, float u, uint32_t* light_id, float* pmf)
+    {
+        if (nodes.len == 0) { return false; }
+
+        uint32_t addr = nodes.len - 1;
+        *pmf = 1.0f;
+        while (true)
+        {
+            LightNode node = nodes[addr];
+            if (node.node_type == LightLeafNode)
+            {
+                // a single light in the scene hasn't been tested yet
+                if (addr == nodes.len - 1 && importance(node, p, n) == 0.0f) { return false; }
+                *light_id = node.left_or_light_id;
+                return true;
+            }
+
+            float left = importance(nodes[node.left_or_light_id], p, n);
+            float right = importance(nodes[node.right], p, n);
+            if (left == 0.0f && right == 0.0f) { return false; }
+
+            float left_probability = left / (left + right);
+            if (u < left_probability)
+            {
+                addr = node.left_or_light_id;
+                *pmf *= left_probability;
+                u = min(u / left_probability, ONE_MINUS_EPSILON);
+            }
+            else
+            {
+                addr = node.right;
+                *pmf *= 1.0f - left_probability;
+                u = min((u - left_probability) / (1.0f - left_probability), ONE_MINUS_EPSILON);
+            }
+        }
+    }
+
+    HOST_DEVICE bool sample_triangle(const Light& light, const float3& p, RndGen& rnd, const Bvh& bvh, HitRecord* hit, LightSample* ls)
+    {
+        // uniform sampling of the triangle area
+        float su0 = sqrtf(rnd.gen_float());
+        float b1 = 1.0f - su0;
+        float b2 = rnd.gen_float() * su0;
+        float b0 = 1.0f - b1 - b2;
+        float3 x = b0 * light.v0_or_center + b1 * light.v1 + b2 * light.v2;
+
+        float3 to_light = x - p;
+        float dist2 = length_squared(to_light);
+        if (dist2 == 0.0f) { return false; }
+        ls->distance = sqrtf(dist2);
+        ls->direction = to_light / ls->distance;
+
+        float3 normal = normalize(cross(light.v1 - light.v0_or_center, light.v2 - light.v0_or_center));
+        float cos_light = abs(dot(normal, ls->direction));
+        if (cos_light == 0.0f) { return false; }
+        ls->pdf = dist2 / (cos_light * light.area);
+
+        float2 uv0 = bvh.uvs[bvh.uv_indices[light.triangle_id]];
+        float2 uv1 = bvh.uvs[bvh.uv_indices[light.triangle_id + 1]];
+        float2 uv2 = bvh.uvs[bvh.uv_indices[light.triangle_id + 2]];
+        hit->uv = b0 * uv0 + b1 * uv1 + b2 * uv2;
+        return true;
+    }
+
+    HOST_DEVICE bool sample_sphere(const Light& light, const float3& p, RndGen& rnd, HitRecord* hit, LightSample* ls)
+    {
+        float3 center = light.v0_or_center;
+        float radius = light.radius;
+        float3 p_to_center = center - p;
+        float dc2 = length_squared(p_to_center);
+        float3 x;
+        if (dc2 <= radius * radius)
+        {
+            // the point is inside of the sphere, sample its area uniformly
+            x = center + radius * rnd.gen_unit_vector();
+            float3 to_light = x - p;
+            float dist2 = length_squared(to_light);
+            if (dist2 == 0.0f) { return false; }
+            ls->distance = sqrtf(dist2);
+            ls->direction = to_light / ls->distance;
+            float cos_light = abs(dot(normalize(x - center), ls->direction));
+            if (cos_light == 0.0f) { return false; }
+            ls->pdf = dist2 / (cos_light * light.area);
+        }
+        else
+        {
+            // sample the cone of directions subtended by the sphere
+            float sin_theta_max2 = radius * radius / dc2;
+            float cos_theta_max = safe_sqrt(1.0f - sin_theta_max2);
+            float cos_theta = 1.0f - rnd.gen_float() * (1.0f - cos_theta_max);
+            float sin_theta = safe_sqrt(1.0f - cos_theta * cos_theta);
+            float phi = 2.0f * HIP_PI_F * rnd.gen_float();
+            float sin_phi, cos_phi;
+            sincosf(phi, &sin_phi, &cos_phi);
+
+            float3 w = p_to_center / sqrtf(dc2);
+            float3 a = abs(w.x) > 0.9f ? make_float3(0.0f, 1.0f, 0.0f) : make_float3(1.0f, 0.0f, 0.0f);
+            float3 t = normalize(cross(a, w));
+            float3 b = cross(w, t);
+            ls->direction = normalize(sin_theta * cos_phi * t + sin_theta * sin_phi * b + cos_theta * w);
+
+            float half_b = -dot(p_to_center, ls->direction);
+            float discriminant = half_b * half_b - (dc2 - radius * radius);
+            ls->distance = -half_b - safe_sqrt(discriminant);
+            if (ls->distance <= 0.0f) { return false; }
+            x = p + ls->distance * ls->direction;
+            ls->pdf = 1.0f / (2.0f * HIP_PI_F * (1.0f - cos_theta_max));
+        }
+
+        float3 outward_normal = normalize(x - center);
+        float theta = acos(-outward_normal.y);
+        float phi = atan2(-outward_normal.z, outward_normal.x) + HIP_PI_F;
+        hit->uv = make_float2(phi / (2.0f * HIP_PI_F), theta / HIP_PI_F);
+        return true;
+    }
+
+    // Samples a direction towards a light for the point p with the normal n.
+    HOST_DEVICE bool sample(
+        const float3& p,
+        const float3& n,
+        RndGen& rnd,
+        const Bvh& bvh,
+        const Array<Material>& materials,
+        const Array<hipTextureObject_t>& textures,
+        LightSample* ls)
+    {
+        uint32_t light_id;
+        float pmf;
+        if (!pick_light(p, n, rnd.gen_float(), &light_id, &pmf)) { return false; }
+
+        Light light = lights[light_id];
+        HitRecord hit;
+        bool sampled = light.light_type == TriangleLight
+            ? sample_triangle(light, p, rnd, bvh, &hit, ls)
+            : sample_sphere(light, p, rnd, &hit, ls);
+        if (!sampled) { return false; }
+
+        Material material = materials[light.material_index];
+        ls->radiance = material.emit(hit, textures);
+        ls->pdf *= pmf;
+        return ls->pdf > 0.0f;
+    }
+};
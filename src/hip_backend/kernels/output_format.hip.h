@@ -0,0 +1,62 @@
+#pragma once
+
+#include <hip/hip_runtime.h>
+#include "common.hip.h"
+#include "vec_math.hip.h"
+#include "constants.hip.h"
+
+// Pixel formats of the framebuffer, same values as OutputFormat of src/util.zig.
+#define OUTPUT_FORMAT_RGBA32F 0
+#define OUTPUT_FORMAT_RGBA8_SRGB 1
+#define OUTPUT_FORMAT_RGBA16F 2
+#define OUTPUT_FORMAT_RGB10A2 3
+
+HOST_DEVICE INLINE float linear_to_srgb(float c)
+{
+    return c <= 0.0031308f ? 12.92f * c : 1.055f * pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+HOST_DEVICE INLINE uint32_t pack_unorm(float c, float max_value)
+{
+    return (uint32_t)(c * max_value + 0.5f);
+}
+
+// c is in [0, 1], values below the normal range of half are flushed to zero.
+HOST_DEVICE INLINE uint32_t float_to_half(float c)
+{
+    uint32_t bits = __float_as_uint(c);
+    uint32_t exponent = (bits >> 23) & 0xff;
+    if (exponent < 113) { return 0; }
+    uint32_t mantissa = bits & 0x7fffff;
+    uint32_t half = ((exponent - 112) << 10) | (mantissa >> 13);
+    // round to nearest, a carry moves into the exponent as it should
+    return half + ((mantissa >> 12) & 1);
+}
+
+// rgba is clamped to [0, 1] and already gamma or sRGB encoded.
+HOST_DEVICE INLINE void write_framebuffer(void* framebuffer, uint32_t index, const float4& rgba)
+{
+    switch (constant_params.output_format)
+    {
+    case OUTPUT_FORMAT_RGBA8_SRGB:
+        ((uint32_t*)framebuffer)[index] = pack_unorm(rgba.x, 255.0f)
+            | (pack_unorm(rgba.y, 255.0f) << 8)
+            | (pack_unorm(rgba.z, 255.0f) << 16)
+            | (pack_unorm(rgba.w, 255.0f) << 24);
+        break;
+    case OUTPUT_FORMAT_RGBA16F:
+        ((uint2*)framebuffer)[index] = make_uint2(
+            float_to_half(rgba.x) | (float_to_half(rgba.y) << 16),
+            float_to_half(rgba.z) | (float_to_half(rgba.w) << 16));
+        break;
+    case OUTPUT_FORMAT_RGB10A2:
+        ((uint32_t*)framebuffer)[index] = pack_unorm(rgba.x, 1023.0f)
+            | (pack_unorm(rgba.y, 1023.0f) << 10)
+            | (pack_unorm(rgba.z, 1023.0f) << 20)
+            | (pack_unorm(rgba.w, 3.0f) << 30);
+        break;
+    default:
+        ((float4*)framebuffer)[index] = rgba;
+        break;
+    }
+}
@@ -7,9 +7,22 @@
 #include "bvh.hip.h"
 #include "transform.hip.h"
 #include "vec_math.hip.h"
+#include "output_format.hip.h"
+
+// Written for the denoiser and the reprojection.
+struct FirstHit
+{
+    float3 albedo;
+    float3 normal;
+    // hit position, or the ray direction with w = 0 for misses
+    float4 position;
+};
 
 HOST_DEVICE float4 path_tracing(KernalLocalState *kls);
-HOST_DEVICE float4 post_processing(uint32_t* fb_index, KernalLocalState* kls, float4 accumulated_rgba);
+HOST_DEVICE float3 trace_path(KernalLocalState *kls, FirstHit* first_hit);
+HOST_DEVICE void post_processing(KernalLocalState* kls, uint32_t fb_index, float4 accumulated_rgba);
+HOST_DEVICE float3 sample_direct_light(KernalLocalState* kls, const HitRecord& hit);
+HOST_DEVICE float3 sample_environment_light(KernalLocalState* kls, const HitRecord& hit);
 
 
 extern "C" __global__ void path_tracing_and_post_processing_kernal(KernalGlobals kg) {
@@ -20,25 +33,27 @@ extern "C" __global__ void path_tracing_and_post_processing_kernal(KernalGlobals
     KernalLocalState kls(kg, make_uint2(constant_params.width, constant_params.height), global_id);
 
     float4 accumulated_rgba = path_tracing(&kls);
-    kls.kg.accumulation_buffer[kls.global_invocation_id] = accumulated_rgba;
-    uint32_t fb_index = kls.global_invocation_id;
-    kls.kg.framebuffer[fb_index] = post_processing(&fb_index, &kls, accumulated_rgba);
+    kls.kg.accumulation_buffer.store(kls.global_invocation_id, accumulated_rgba);
+    post_processing(&kls, kls.global_invocation_id, accumulated_rgba);
 
     kls.save_rng_seed();
+    kls.save_traversal_stats();
 }
 
 extern "C" __global__ void path_tracing_kernal(KernalGlobals kg) {
     uint32_t global_id = blockDim.x * blockIdx.x + threadIdx.x;
-    if (global_id >= kg.pixel_count) {
+    uint32_t pixel_id;
+    if (!strided_pixel_id(global_id, &pixel_id)) {
         return;
     }
 
-    KernalLocalState kls(kg, make_uint2(constant_params.width, constant_params.height), global_id);
+    KernalLocalState kls(kg, make_uint2(constant_params.width, constant_params.height), pixel_id);
     
     float4 accumulated_rgba = path_tracing(&kls);
-    kls.kg.accumulation_buffer[kls.global_invocation_id] = accumulated_rgba;
+    kls.kg.accumulation_buffer.store(kls.global_invocation_id, accumulated_rgba);
 
     kls.save_rng_seed();
+    kls.save_traversal_stats();
 }
 
 extern "C" __global__ void post_processing_kernal(KernalGlobals kg) {
@@ -49,32 +64,104 @@ extern "C" __global__ void post_processing_kernal(KernalGlobals kg) {
 
     KernalLocalState kls(kg, make_uint2(constant_params.width, constant_params.height), global_id);
 
-    uint32_t fb_index = kls.global_invocation_id;
-    kls.kg.framebuffer[fb_index] = post_processing(&fb_index, &kls, kls.kg.accumulation_buffer[kls.global_invocation_id]);
+    uint32_t traced_id = traced_pixel_id(kls.xy);
+    float4 accumulated_rgba = constant_params.denoise != 0
+        ? kls.kg.denoised_buffer[traced_id]
+        : kls.kg.accumulation_buffer.load(traced_id);
+    post_processing(&kls, kls.global_invocation_id, accumulated_rgba);
 
     kls.save_rng_seed();
 }
 
-HOST_DEVICE float4 post_processing(uint32_t* fb_index, KernalLocalState* kls, float4 accumulated_rgba) {
-    float4 rgba = clamp(accumulated_rgba / constant_params.current_iteration, 0.0f, 1.0f);
-    rgba.x = pow(rgba.x, constant_params.inverted_gamma);
-    rgba.y = pow(rgba.y, constant_params.inverted_gamma);
-    rgba.z = pow(rgba.z, constant_params.inverted_gamma);
+HOST_DEVICE void post_processing(KernalLocalState* kls, uint32_t fb_index, float4 accumulated_rgba) {
+    // alpha keeps the number of samples of the pixel
+    float4 rgba = clamp(accumulated_rgba / accumulated_rgba.w, 0.0f, 1.0f);
+    if (constant_params.output_format == OUTPUT_FORMAT_RGBA8_SRGB) {
+        rgba.x = linear_to_srgb(rgba.x);
+        rgba.y = linear_to_srgb(rgba.y);
+        rgba.z = linear_to_srgb(rgba.z);
+    } else {
+        rgba.x = pow(rgba.x, constant_params.inverted_gamma);
+        rgba.y = pow(rgba.y, constant_params.inverted_gamma);
+        rgba.z = pow(rgba.z, constant_params.inverted_gamma);
+    }
 
     if (constant_params.flip_y != 0) {
         uint32_t y_flipped = constant_params.height - kls->xy.y - 1;
-        *fb_index = constant_params.width * y_flipped + kls->xy.x;
+        fb_index = constant_params.width * y_flipped + kls->xy.x;
     }
 
-    return rgba;
+    write_framebuffer(kls->kg.framebuffer, fb_index, rgba);
 }
 
 HOST_DEVICE float4 path_tracing(KernalLocalState *kls) {
+    uint32_t id = kls->global_invocation_id;
+    bool first_iteration = is_first_cycle();
+    if (!first_iteration && constant_params.adaptive_sampling != 0) {
+        float4 accumulated_rgba = kls->kg.accumulation_buffer.load(id);
+        float error = estimate_relative_error(accumulated_rgba, kls->kg.second_moment_buffer[id]);
+        if (is_converged(accumulated_rgba, error)) {
+            record_render_stats(kls->kg.render_stats, error, true, 0);
+            return accumulated_rgba;
+        }
+    }
+
+    FirstHit first_hit;
+    float3 radiance = trace_path(kls, &first_hit);
+    kls->kg.position_buffer[id] = first_hit.position;
+    float l = luminance(radiance);
+    float4 accumulated_rgba = make_float4(radiance, 1.0f);
+    float second_moment = l * l;
+    // denoiser guides, averaged with the same sample count as the color
+    float4 accumulated_albedo = make_float4(first_hit.albedo, 0.0f);
+    float4 accumulated_normal = make_float4(first_hit.normal, 0.0f);
+    if (!first_iteration) {
+        accumulated_rgba = kls->kg.accumulation_buffer.load(id) + accumulated_rgba;
+        second_moment += kls->kg.second_moment_buffer[id];
+        accumulated_albedo = kls->kg.albedo_buffer[id] + accumulated_albedo;
+        accumulated_normal = kls->kg.normal_buffer[id] + accumulated_normal;
+    } else if (constant_params.reproject != 0) {
+        float4 history_rgba;
+        float history_second_moment;
+        if (kls->kg.history.reproject(first_hit.position, &history_rgba, &history_second_moment)) {
+            accumulated_rgba = history_rgba + accumulated_rgba;
+            second_moment += history_second_moment;
+            // the history saw the same surface, so its guides are taken from the new sample
+            accumulated_albedo = accumulated_albedo * accumulated_rgba.w;
+            accumulated_normal = accumulated_normal * accumulated_rgba.w;
+        }
+    }
+    // a saturated count turns the color into a moving average, the second moment and the guides follow it
+    float saturation = kls->kg.accumulation_buffer.saturation_scale(accumulated_rgba.w);
+    accumulated_rgba = accumulated_rgba * saturation;
+    second_moment *= saturation;
+    accumulated_albedo = accumulated_albedo * saturation;
+    accumulated_normal = accumulated_normal * saturation;
+    kls->kg.second_moment_buffer[id] = second_moment;
+    kls->kg.albedo_buffer[id] = accumulated_albedo;
+    kls->kg.normal_buffer[id] = accumulated_normal;
+
+    float error = estimate_relative_error(accumulated_rgba, second_moment);
+    // the camera ray is counted by the host
+    record_render_stats(kls->kg.render_stats, error, is_converged(accumulated_rgba, error), max(kls->rays, 1u) - 1);
+    return accumulated_rgba;
+}
+
+// Misses and emitters report their radiance as the first hit albedo and a zero normal.
+HOST_DEVICE float3 trace_path(KernalLocalState *kls, FirstHit* first_hit) {
     float u = ((float)kls->xy.x + kls->rnd.gen_float()) / (constant_params.width - 1);
     float v = ((float)kls->xy.y + kls->rnd.gen_float()) / (constant_params.height - 1);
 
     Ray ray = constant_params.camera.get_ray(&kls->rnd, u, v);
-    float3 final_color = make_float3(1.0f);
+    float3 radiance = make_float3(0.0f);
+    float3 throughput = make_float3(1.0f);
+    // emitters reached after a diffuse bounce are already counted by the light sampling
+    bool count_emission = true;
+    // pdf of the last lambertian bounce, used to weight environment hits
+    float bsdf_pdf = 0.0f;
+    first_hit->albedo = make_float3(0.0f);
+    first_hit->normal = make_float3(0.0f);
+    first_hit->position = make_float4(0.0f);
 
     for (int i = 0; i < constant_params.depth; i += 1)
     {
@@ -84,11 +171,25 @@ HOST_DEVICE float4 path_tracing(KernalLocalState *kls) {
         uint32_t inverted_transform_id;
         uint32_t tri_id;
         float2 uv;
-        if (!kls->kg.bvh.hit(ray, &t, &material_index, &bvh_node_type, &inverted_transform_id, &tri_id, &uv)) {
+        kls->rays += 1;
+        if (!kls->kg.bvh.hit(ray, &t, &material_index, &bvh_node_type, &inverted_transform_id, &tri_id, &uv, &kls->traversal_stats)) {
             float3 unit_direction = normalize(ray.direction);
-            float tt = 0.5f * (unit_direction.y + 1.0f);
-            final_color = final_color * ((1.0f - tt) * make_float3(1.0f) + tt * make_float3(0.5f, 0.7f, 1.0f));
-            //final_color = make_float3(0.0f);
+            float3 background;
+            float weight = 1.0f;
+            if (kls->kg.environment_map.enabled()) {
+                background = kls->kg.environment_map.eval(unit_direction, kls->kg.textures);
+                if (!count_emission) {
+                    weight = power_heuristic(bsdf_pdf, kls->kg.environment_map.pdf(unit_direction));
+                }
+            } else {
+                float tt = 0.5f * (unit_direction.y + 1.0f);
+                background = (1.0f - tt) * make_float3(1.0f) + tt * make_float3(0.5f, 0.7f, 1.0f);
+            }
+            radiance += throughput * weight * background;
+            if (i == 0) {
+                first_hit->albedo = background;
+                first_hit->position = make_float4(unit_direction, 0.0f);
+            }
             break;
         }
 
@@ -132,23 +233,93 @@ HOST_DEVICE float4 path_tracing(KernalLocalState *kls) {
             }
             default: { break; }
         }
+        if (i == 0) {
+            first_hit->normal = hit.normal;
+            first_hit->position = make_float4(hit.p, 1.0f);
+        }
 
         float3 attenuation;
         Ray scattered;
         Material material = kls->kg.materials[hit.material_index];
         if (material.scatter(ray, hit, kls->rnd, kls->kg.textures, &attenuation, &scattered)) {
+            if (i == 0) { first_hit->albedo = attenuation; }
+            count_emission = material.material_type != Lambertian;
+            if (!count_emission) {
+                // lambertian scatter is cosine weighted, so attenuation is the albedo
+                radiance += throughput * attenuation * (sample_direct_light(kls, hit) + sample_environment_light(kls, hit));
+                bsdf_pdf = max(dot(hit.normal, normalize(scattered.direction)), 0.0f) / HIP_PI_F;
+            }
             ray = scattered;
-            final_color = final_color * attenuation;
+            throughput = throughput * attenuation;
         } else {
-            final_color = final_color * material.emit(hit, kls->kg.textures);
+            float3 emitted = material.emit(hit, kls->kg.textures);
+            if (count_emission) {
+                radiance += throughput * emitted;
+            }
+            if (i == 0) { first_hit->albedo = emitted; }
             break;
         }
     }
     
-    float4 accumulated_rgba = make_float4(final_color, 1.0f);
-    if (constant_params.current_iteration > 1.0f) {
-        accumulated_rgba = kls->kg.accumulation_buffer[kls->global_invocation_id] + accumulated_rgba;
+    return radiance;
+}
+
+HOST_DEVICE float3 sample_direct_light(KernalLocalState* kls, const HitRecord& hit) {
+    LightSample ls;
+    if (!kls->kg.light_bvh.sample(hit.p, hit.normal, kls->rnd, kls->kg.bvh, kls->kg.materials, kls->kg.textures, &ls)) {
+        return make_float3(0.0f);
     }
 
-    return accumulated_rgba;
+    float cos_theta = dot(hit.normal, ls.direction);
+    if (cos_theta <= 0.0f) {
+        return make_float3(0.0f);
+    }
+
+    float t;
+    uint32_t material_index;
+    BvhNodeType bvh_node_type;
+    uint32_t inverted_transform_id;
+    uint32_t tri_id;
+    float2 uv;
+    Ray shadow_ray(hit.p, ls.direction);
+    kls->rays += 1;
+    if (kls->kg.bvh.hit(shadow_ray, &t, &material_index, &bvh_node_type, &inverted_transform_id, &tri_id, &uv, &kls->traversal_stats) && t < ls.distance * 0.999f) {
+        return make_float3(0.0f);
+    }
+
+    // lambertian brdf without albedo: 1 / pi
+    return ls.radiance * (cos_theta / (HIP_PI_F * ls.pdf));
+}
+
+HOST_DEVICE float3 sample_environment_light(KernalLocalState* kls, const HitRecord& hit) {
+    if (!kls->kg.environment_map.enabled()) {
+        return make_float3(0.0f);
+    }
+
+    float3 direction;
+    float3 env_radiance;
+    float env_pdf;
+    if (!kls->kg.environment_map.sample(kls->rnd, kls->kg.textures, &direction, &env_radiance, &env_pdf)) {
+        return make_float3(0.0f);
+    }
+
+    float cos_theta = dot(hit.normal, direction);
+    if (cos_theta <= 0.0f) {
+        return make_float3(0.0f);
+    }
+
+    float t;
+    uint32_t material_index;
+    BvhNodeType bvh_node_type;
+    uint32_t inverted_transform_id;
+    uint32_t tri_id;
+    float2 uv;
+    Ray shadow_ray(hit.p, direction);
+    kls->rays += 1;
+    if (kls->kg.bvh.hit(shadow_ray, &t, &material_index, &bvh_node_type, &inverted_transform_id, &tri_id, &uv, &kls->traversal_stats)) {
+        return make_float3(0.0f);
+    }
+
+    float weight = power_heuristic(env_pdf, cos_theta / HIP_PI_F);
+    return env_radiance * (weight * cos_theta / (HIP_PI_F * env_pdf));
 }
\ No newline at end of file
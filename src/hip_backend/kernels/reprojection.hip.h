@@ -0,0 +1,47 @@
+#pragma once
+
+#include <hip/hip_runtime.h>
+#include "common.hip.h"
+#include "vec_math.hip.h"
+#include "constants.hip.h"
+#include "accumulation.hip.h"
+
+// max distance between the reprojected and the history first hits, relative to the distance to the camera
+#define REPROJECTION_TOLERANCE 0.05f
+
+// Accumulation of the previous camera, saved by the host before a camera move.
+struct History
+{
+    AccumulationBuffer accumulation_buffer;
+    float* second_moment_buffer;
+    // first hit position, or the ray direction with w = 0 for misses
+    float4* position_buffer;
+
+    // Finds the history pixel which saw the same first hit and returns its samples,
+    // clamped to constant_params.temporal_history_limit.
+    HOST_DEVICE bool reproject(const float4& position, float4* history_rgba, float* history_second_moment)
+    {
+        Camera camera = constant_params.previous_camera;
+        bool hit = position.w != 0.0f;
+        float3 direction = hit ? make_float3(position) - camera.origin : make_float3(position);
+        float2 st;
+        if (!camera.project(direction, &st)) { return false; }
+
+        // pixels are sampled by (xy + jitter) / (resolution - 1)
+        float x = floorf(st.x * (constant_params.width - 1));
+        float y = floorf(st.y * (constant_params.height - 1));
+        if (x < 0.0f || y < 0.0f || x >= (float)constant_params.width || y >= (float)constant_params.height) { return false; }
+        uint32_t index = (uint32_t)y * constant_params.width + (uint32_t)x;
+
+        float4 history_position = position_buffer[index];
+        if ((history_position.w != 0.0f) != hit) { return false; }
+        if (hit && length(make_float3(history_position) - make_float3(position)) > REPROJECTION_TOLERANCE * length(direction)) { return false; }
+
+        float4 rgba = accumulation_buffer.load(index);
+        if (rgba.w <= 0.0f) { return false; }
+        float scale = min(1.0f, (float)constant_params.temporal_history_limit / rgba.w);
+        *history_rgba = rgba * scale;
+        *history_second_moment = second_moment_buffer[index] * scale;
+        return true;
+    }
+};
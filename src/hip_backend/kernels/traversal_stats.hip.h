@@ -0,0 +1,55 @@
+#pragma once
+
+#include <hip/hip_runtime.h>
+#include "common.hip.h"
+
+// Counters of the bvh traversal, only counted when the kernels are built with -DTRAVERSAL_STATS.
+// Without the define the counters are never written and the compiler drops them.
+struct TraversalStats
+{
+    uint32_t rays;
+    uint32_t internal_nodes;
+    uint32_t aabb_tests;
+    uint32_t triangle_tests;
+    uint32_t sphere_tests;
+    uint32_t blas_entries;
+};
+
+// Counts of a frame, 64 bit as they are summed over all pixels.
+struct TraversalTotals
+{
+    unsigned long long rays;
+    unsigned long long internal_nodes;
+    unsigned long long aabb_tests;
+    unsigned long long triangle_tests;
+    unsigned long long sphere_tests;
+    unsigned long long blas_entries;
+};
+
+#ifdef TRAVERSAL_STATS
+#define COUNT_TRAVERSAL(stats, counter, n) ((stats)->counter += (n))
+#else
+#define COUNT_TRAVERSAL(stats, counter, n) ((void)(stats))
+#endif
+
+// Adds the counts of a pixel sample to the counts of the frame, and writes them to the heatmap.
+// Samples without rays, of converged pixels, keep the heatmap of their last traced sample.
+HOST_DEVICE INLINE void record_traversal_stats(TraversalTotals* frame, TraversalStats* heatmap, uint32_t id, const TraversalStats& sample)
+{
+#ifdef TRAVERSAL_STATS
+    // null when the buffers were not created
+    if (frame == nullptr || sample.rays == 0) { return; }
+    heatmap[id] = sample;
+    atomicAdd(&frame->rays, (unsigned long long)sample.rays);
+    atomicAdd(&frame->internal_nodes, (unsigned long long)sample.internal_nodes);
+    atomicAdd(&frame->aabb_tests, (unsigned long long)sample.aabb_tests);
+    atomicAdd(&frame->triangle_tests, (unsigned long long)sample.triangle_tests);
+    atomicAdd(&frame->sphere_tests, (unsigned long long)sample.sphere_tests);
+    atomicAdd(&frame->blas_entries, (unsigned long long)sample.blas_entries);
+#else
+    (void)frame;
+    (void)heatmap;
+    (void)id;
+    (void)sample;
+#endif
+}
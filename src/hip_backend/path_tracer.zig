@@ -8,6 +8,11 @@ const Scene = @import("../scene.zig").Scene;
 const util = @import("../util.zig");
 const Bvh = @import("../bvh.zig").Bvh;
 const gpu_structs = @import("../gpu_structs.zig");
+const Denoiser = @import("../denoiser.zig").Denoiser;
+const checkpoint = @import("../checkpoint.zig");
+const trace = @import("../trace.zig");
+const PeakAllocator = @import("../peak_allocator.zig").PeakAllocator;
+const options = @import("ornament_options");
 
 pub const PathTracer = struct {
     const Self = @This();
@@ -30,10 +35,25 @@ pub const PathTracer = struct {
     transforms: buffers.Array(gpu_structs.Transform),
     tlas_nodes: buffers.Array(gpu_structs.BvhNode),
     blas_nodes: buffers.Array(gpu_structs.BvhNode),
+    light_nodes: buffers.Array(gpu_structs.LightNode),
+    lights: buffers.Array(gpu_structs.Light),
+    environment_alias_table: buffers.Array(gpu_structs.AliasEntry),
+    environment_map: gpu_structs.EnvironmentMap,
 
     constant_params: buffers.Global(gpu_structs.ConstantParams),
+    // identifies the scene of checkpoints, see checkpoint.renderHash
+    scene_hash: u64,
+    bvh_memory: util.BvhMemory,
+    denoiser: Denoiser,
+    cancellation: util.Cancellation,
+    // camera of the last rendered iteration, null when there is no history to reproject
+    history_camera: ?gpu_structs.Camera,
+    // camera of the saved history while pixels take their first samples after a move
+    reprojection: ?gpu_structs.Camera,
 
     pub fn init(allocator: std.mem.Allocator, scene: Scene) !Self {
+        const span = trace.begin("hip.init");
+        defer span.end();
         var device_count: c_int = 0;
         try hip.checkError(hip.c.hipGetDeviceCount(&device_count));
         try printDevices(device_count);
@@ -42,7 +62,8 @@ pub const PathTracer = struct {
 
         const state = State.init();
 
-        var bvh = try Bvh.init(allocator, &scene, true);
+        var bvh_allocator = PeakAllocator.init(allocator);
+        var bvh = try Bvh.init(bvh_allocator.allocator(), &scene, true);
         defer bvh.deinit();
 
         const fileName = "./zig-out/bin/pathtracer.co";
@@ -60,6 +81,8 @@ pub const PathTracer = struct {
 
         var device_prop: hip.c.hipDevicePropWithoutArchFlags_t = undefined;
         try hip.checkError(hip.c.hipGetDevicePropertiesWithoutArchFlags(&device_prop, wanted_device_id));
+        const upload = trace.begin("hip.upload");
+        defer upload.end();
         return .{
             .allocator = allocator,
             .scene = scene,
@@ -80,8 +103,18 @@ pub const PathTracer = struct {
             .transforms = try buffers.Array(gpu_structs.Transform).init(bvh.transforms.items),
             .tlas_nodes = try buffers.Array(gpu_structs.BvhNode).init(bvh.tlas_nodes.items),
             .blas_nodes = try buffers.Array(gpu_structs.BvhNode).init(bvh.blas_nodes.items),
+            .light_nodes = try buffers.Array(gpu_structs.LightNode).init(bvh.light_nodes.items),
+            .lights = try buffers.Array(gpu_structs.Light).init(bvh.lights.items),
+            .environment_alias_table = try buffers.Array(gpu_structs.AliasEntry).init(bvh.environment_alias_table.items),
+            .environment_map = bvh.environment_map,
 
             .constant_params = try buffers.Global(gpu_structs.ConstantParams).init("constant_params", module),
+            .scene_hash = checkpoint.sceneHash(&bvh),
+            .bvh_memory = .{ .bytes = bvh.memoryBytes(), .build_peak_bytes = bvh_allocator.getPeakBytes() },
+            .denoiser = Denoiser.init(allocator),
+            .cancellation = .{},
+            .history_camera = null,
+            .reprojection = null,
         };
     }
 
@@ -96,7 +129,11 @@ pub const PathTracer = struct {
         try self.transforms.deinit();
         try self.tlas_nodes.deinit();
         try self.blas_nodes.deinit();
+        try self.light_nodes.deinit();
+        try self.lights.deinit();
+        try self.environment_alias_table.deinit();
         if (self.target_buffer) |*tb| try tb.deinit();
+        self.denoiser.deinit();
         self.scene.deinit();
     }
 
@@ -106,32 +143,175 @@ pub const PathTracer = struct {
             try tb.deinit();
             self.target_buffer = null;
         }
+        self.history_camera = null;
+        self.reprojection = null;
     }
 
+    // Pixels of packed output formats are expanded to floats, see getFrameBufferBytes to read them as they are.
     pub fn getFrameBuffer(self: *Self, dst: []gpu_structs.Vector4) !void {
+        const span = trace.begin("hip.getFrameBuffer");
+        defer span.end();
+        const tb = try self.getOrCreateTargetBuffer();
+        const output_format = tb.output_format;
+        if (output_format == .rgba32f) return self.getFrameBufferBytes(std.mem.sliceAsBytes(dst));
+        const bytes = tb.staging[0 .. dst.len * output_format.bytesPerPixel()];
+        try self.getFrameBufferBytes(bytes);
+        output_format.decode(bytes, dst);
+    }
+
+    // dst takes pixel_count * bytesPerPixel of the output format.
+    pub fn getFrameBufferBytes(self: *Self, dst: []u8) !void {
+        const span = trace.begin("hip.getFrameBufferBytes");
+        defer span.end();
         const tb = try self.getOrCreateTargetBuffer();
         return hip.checkError(hip.c.hipMemcpy(
             dst.ptr,
             tb.buffer,
-            dst.len * @sizeOf(gpu_structs.Vector4),
+            dst.len,
             hip.c.hipMemcpyDeviceToHost,
         ));
     }
 
+    // Stops the running render or renderFor at the next cancellation point, so a new camera or scene
+    // doesn't wait for the stale iterations. May be called from any thread, renders started later are not affected.
+    pub fn cancel(self: *Self) void {
+        self.cancellation.cancel();
+    }
+
     pub fn render(self: *Self) !void {
-        if (self.state.iterations > 1) {
+        self.state.nextFrame(self.scene.camera.dirty);
+        try (try self.getOrCreateTargetBuffer()).resetRayCount();
+        if (options.traversal_stats) try (try self.getOrCreateTargetBuffer()).resetTraversalStats();
+        if (self.state.iterations > 1 or self.state.denoise or self.state.dynamic_resolution) {
+            const generation = self.cancellation.getGeneration();
             var i: u32 = 0;
+            // iterations since the last read of the render stats
+            var unchecked: u32 = 0;
             while (i < self.state.iterations) : (i += 1) {
                 try self.update();
                 try self.launchKernal(self.path_tracing_kernal);
+                unchecked += 1;
+                if (self.state.adaptive_sampling and unchecked >= util.CONVERGENCE_CHECK_INTERVAL and self.state.isCycleEnd()) {
+                    unchecked = 0;
+                    if (try self.isConverged()) break;
+                }
+                if (self.cancellation.isCancelled(generation)) break;
             }
-            try self.launchKernal(self.post_processing_kernal);
+            try self.postProcessing();
         } else {
             try self.update();
             try self.launchKernal(self.path_tracing_and_post_processing_kernal);
         }
     }
 
+    // Keeps adding samples while the next iteration is expected to fit into the budget,
+    // at least one iteration is always rendered.
+    pub fn renderFor(self: *Self, budget_ns: u64) !util.RenderProgress {
+        self.state.nextFrame(self.scene.camera.dirty);
+        try (try self.getOrCreateTargetBuffer()).resetRayCount();
+        if (options.traversal_stats) try (try self.getOrCreateTargetBuffer()).resetTraversalStats();
+        const generation = self.cancellation.getGeneration();
+        var timer = try std.time.Timer.start();
+        var previous_ns: u64 = 0;
+        var iterations: u32 = 0;
+        // one iteration until its time is known, then as many as fit into the budget up to the check interval
+        var batch: u32 = 1;
+        var stats: gpu_structs.RenderStats = undefined;
+        while (true) {
+            var i: u32 = 0;
+            while (i < batch) : (i += 1) {
+                try self.update();
+                try self.launchKernal(self.path_tracing_kernal);
+            }
+            // waits for the iterations of the batch to finish
+            stats = try self.getRenderStats();
+            iterations += batch;
+
+            const elapsed_ns = timer.read();
+            const iteration_ns = @max((elapsed_ns - previous_ns) / batch, 1);
+            previous_ns = elapsed_ns;
+            if ((stats.active_pixel_count == 0 and self.state.isCycleEnd()) or self.cancellation.isCancelled(generation)) break;
+            const fitting = (budget_ns -| elapsed_ns) / iteration_ns;
+            if (fitting == 0) break;
+            batch = @intCast(@min(fitting, self.state.iterationsToCycleEnd(util.CONVERGENCE_CHECK_INTERVAL)));
+        }
+        try self.postProcessing();
+
+        return .{
+            .samples = @intFromFloat(self.state.current_iteration),
+            .iterations = iterations,
+            .estimated_error = stats.meanError(self.state.cyclePixelCount()),
+            .cancelled = self.cancellation.isCancelled(generation),
+        };
+    }
+
+    fn postProcessing(self: *Self) !void {
+        const span = trace.begin("hip.postProcessing");
+        defer span.end();
+        if (self.state.isDenoised()) {
+            const tb = try self.getOrCreateTargetBuffer();
+            try self.denoiser.resize(tb.resolution);
+            try tb.readDenoiserInputs(&self.denoiser);
+            self.denoiser.denoise();
+            try tb.writeDenoised(self.denoiser.output);
+        }
+        try self.launchKernal(self.post_processing_kernal);
+    }
+
+    // See checkpoint.save.
+    pub fn saveCheckpoint(self: *Self, writer: *checkpoint.CheckpointWriter) !bool {
+        return checkpoint.save(self, writer);
+    }
+
+    // See checkpoint.load.
+    pub fn loadCheckpoint(self: *Self, path: []const u8) !void {
+        return checkpoint.load(self, path);
+    }
+
+    // Used by checkpoint.save.
+    pub fn readCheckpointBuffers(self: *Self, snapshot: *checkpoint.Checkpoint) !void {
+        const tb = try self.getOrCreateTargetBuffer();
+        try tb.readCheckpoint(snapshot);
+    }
+
+    // Used by checkpoint.load.
+    pub fn writeCheckpointBuffers(self: *Self, snapshot: *const checkpoint.Checkpoint) !void {
+        const tb = try self.getOrCreateTargetBuffer();
+        try tb.writeCheckpoint(snapshot);
+    }
+
+    // Stats of the last path tracing iteration.
+    pub fn getRenderStats(self: *Self) !gpu_structs.RenderStats {
+        const tb = try self.getOrCreateTargetBuffer();
+        return tb.getRenderStats();
+    }
+
+    // Bytes held by the scene, by the bvh built at init and by the buffers of the backend.
+    pub fn memoryReport(self: *const Self) util.MemoryReport {
+        return util.memoryReport(self, "");
+    }
+
+    // Counts of the last render or renderFor, summed over its iterations.
+    pub fn getTraversalStats(self: *Self) !gpu_structs.TraversalTotals {
+        if (!options.traversal_stats) return error.TraversalStatsDisabled;
+        const tb = try self.getOrCreateTargetBuffer();
+        return tb.getTraversalStats();
+    }
+
+    // Counts of the last traced sample of every pixel, dst takes pixel_count stats.
+    pub fn getTraversalHeatmap(self: *Self, dst: []gpu_structs.TraversalStats) !void {
+        if (!options.traversal_stats) return error.TraversalStatsDisabled;
+        const tb = try self.getOrCreateTargetBuffer();
+        return tb.getTraversalHeatmap(dst);
+    }
+
+    fn isConverged(self: *Self) !bool {
+        // the stats cover every pixel only at the end of a stride cycle
+        if (!self.state.isCycleEnd()) return false;
+        const stats = try self.getRenderStats();
+        return stats.active_pixel_count == 0;
+    }
+
     fn printDevices(device_count: c_int) !void {
         var device_id: c_int = 0;
         while (device_id < device_count) : (device_id += 1) {
@@ -141,34 +321,58 @@ pub const PathTracer = struct {
 
     fn getOrCreateTargetBuffer(self: *Self) !*buffers.Target {
         if (self.target_buffer == null) {
-            self.target_buffer = try buffers.Target.init(self.allocator, self.state.getResolution());
+            const span = trace.begin("hip.createTarget");
+            defer span.end();
+            self.target_buffer = try buffers.Target.init(self.allocator, self.state.getResolution(), self.state.getOutputFormat(), self.state.getAccumulationFormat());
         }
 
         return &self.target_buffer.?;
     }
 
     fn update(self: *Self) !void {
+        const span = trace.begin("hip.update");
+        defer span.end();
         var dirty = false;
         if (self.scene.camera.dirty) {
             dirty = true;
             self.scene.camera.dirty = false;
         }
 
-        if (dirty) self.state.reset();
+        const tb = try self.getOrCreateTargetBuffer();
+        if (dirty) {
+            self.reprojection = null;
+            if (self.state.temporal_reprojection and self.state.current_iteration > 0.0) {
+                self.reprojection = self.history_camera;
+                if (self.reprojection != null) try tb.saveHistory();
+            }
+            self.state.reset();
+        }
         self.state.nextIteration();
+        // with a pixel stride the first samples, which take the history, span several iterations
+        if (!self.state.isFirstCycle()) self.reprojection = null;
+        self.history_camera = gpu_structs.Camera.from(&self.scene.camera);
+        if (self.state.isCycleStart()) try tb.resetCycleStats();
         try buffers.globalCopyHToD(
             gpu_structs.ConstantParams,
             self.constant_params,
             gpu_structs.ConstantParams.from(
                 &self.scene.camera,
+                self.reprojection,
                 &self.state,
                 @truncate(self.scene.textures.items.len),
+                self.light_nodes.len,
+                self.environment_map,
             ),
         );
     }
 
     fn launchKernal(self: *Self, kernal: hip.c.hipFunction_t) !void {
+        // returns once the kernel is queued
+        const span = trace.begin("hip.launchKernal");
+        defer span.end();
         const tb = try self.getOrCreateTargetBuffer();
+        // path tracing runs on the reduced grid of the pixel stride
+        const workgroups = if (kernal == self.path_tracing_kernal) tb.stridedWorkgroups(self.state.pixel_stride) else tb.workgroups;
 
         const KernalGlobals = extern struct {
             bvh: extern struct {
@@ -180,10 +384,30 @@ pub const PathTracer = struct {
                 uv_indices: buffers.Array(u32),
                 transforms: buffers.Array(gpu_structs.Transform),
             },
+            light_bvh: extern struct {
+                nodes: buffers.Array(gpu_structs.LightNode),
+                lights: buffers.Array(gpu_structs.Light),
+            },
+            environment_map: extern struct {
+                alias_table: buffers.Array(gpu_structs.AliasEntry),
+            },
             materials: buffers.Array(gpu_structs.Material),
             textures: buffers.Array(hip.c.hipTextureObject_t),
             framebuffer: hip.c.hipDeviceptr_t,
             accumulation_buffer: hip.c.hipDeviceptr_t,
+            second_moment_buffer: hip.c.hipDeviceptr_t,
+            albedo_buffer: hip.c.hipDeviceptr_t,
+            normal_buffer: hip.c.hipDeviceptr_t,
+            denoised_buffer: hip.c.hipDeviceptr_t,
+            position_buffer: hip.c.hipDeviceptr_t,
+            history: extern struct {
+                accumulation_buffer: hip.c.hipDeviceptr_t,
+                second_moment_buffer: hip.c.hipDeviceptr_t,
+                position_buffer: hip.c.hipDeviceptr_t,
+            },
+            render_stats: hip.c.hipDeviceptr_t,
+            traversal_stats: hip.c.hipDeviceptr_t,
+            traversal_heatmap: hip.c.hipDeviceptr_t,
             rng_seed_buffer: hip.c.hipDeviceptr_t,
             pixel_count: u32,
         };
@@ -201,10 +425,30 @@ pub const PathTracer = struct {
                     .uv_indices = self.uv_indices,
                     .transforms = self.transforms,
                 },
+                .light_bvh = .{
+                    .nodes = self.light_nodes,
+                    .lights = self.lights,
+                },
+                .environment_map = .{
+                    .alias_table = self.environment_alias_table,
+                },
                 .materials = self.materials,
                 .textures = self.textures.device_texture_objects,
                 .framebuffer = tb.buffer,
                 .accumulation_buffer = tb.accumulation_buffer,
+                .second_moment_buffer = tb.second_moment_buffer,
+                .albedo_buffer = tb.albedo_buffer,
+                .normal_buffer = tb.normal_buffer,
+                .denoised_buffer = tb.denoised_buffer,
+                .position_buffer = tb.position_buffer,
+                .history = .{
+                    .accumulation_buffer = tb.history_accumulation_buffer,
+                    .second_moment_buffer = tb.history_second_moment_buffer,
+                    .position_buffer = tb.history_position_buffer,
+                },
+                .render_stats = tb.render_stats,
+                .traversal_stats = tb.traversal_stats,
+                .traversal_heatmap = tb.traversal_heatmap,
                 .rng_seed_buffer = tb.rng_state_buffer,
                 .pixel_count = tb.resolution.pixel_count(),
             },
@@ -221,7 +465,7 @@ pub const PathTracer = struct {
 
         try hip.checkError(hip.c.hipModuleLaunchKernel(
             kernal,
-            tb.workgroups, // gridDimX
+            workgroups, // gridDimX
             1, // gridDimY
             1, // gridDimZ
             buffers.WORKGROUP_SIZE, // blockDimX
@@ -1,7 +1,15 @@
 const util = @import("util.zig");
 pub const Resolution = util.Resolution;
+pub const RenderProgress = util.RenderProgress;
+pub const OutputFormat = util.OutputFormat;
+pub const AccumulationFormat = util.AccumulationFormat;
+pub const MemoryReport = util.MemoryReport;
+pub const PeakAllocator = @import("peak_allocator.zig").PeakAllocator;
+pub const TraversalStats = @import("gpu_structs.zig").TraversalStats;
+pub const TraversalTotals = @import("gpu_structs.zig").TraversalTotals;
 pub const Scene = @import("scene.zig").Scene;
 pub const Camera = @import("camera.zig").Camera;
+pub const Bvh = @import("bvh.zig").Bvh;
 pub const Aabb = @import("aabb.zig").Aabb;
 pub const Sphere = @import("sphere.zig").Sphere;
 pub const Mesh = @import("mesh.zig").Mesh;
@@ -11,9 +19,22 @@ pub const Material = material.Material;
 pub const MaterialType = material.MaterialType;
 pub const Texture = @import("texture.zig").Texture;
 pub const Color = @import("color.zig").Color;
+pub const scene_generator = @import("scene_generator.zig");
+pub const trace = @import("trace.zig");
+pub const checkpoint = @import("checkpoint.zig");
+pub const Checkpoint = checkpoint.Checkpoint;
+pub const CheckpointWriter = checkpoint.CheckpointWriter;
+pub const distributed = @import("distributed.zig");
+pub const render_server = @import("render_server.zig");
+pub const RenderServer = render_server.RenderServer;
+// POSIX only
+pub const SharedFrameBuffer = @import("shared_frame_buffer.zig").SharedFrameBuffer;
 
 pub const wgpu_backend = @import("wgpu_backend/path_tracer.zig");
 pub const WgpuPathTracer = wgpu_backend.PathTracer;
 
 pub const hip_backend = @import("hip_backend/path_tracer.zig");
 pub const HipPathTracer = hip_backend.PathTracer;
+
+pub const cpu_backend = @import("cpu_backend/path_tracer.zig");
+pub const CpuPathTracer = cpu_backend.PathTracer;
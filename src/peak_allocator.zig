@@ -0,0 +1,58 @@
+const std = @import("std");
+
+// Wraps an allocator and keeps the current and the peak number of allocated bytes.
+pub const PeakAllocator = struct {
+    const Self = @This();
+    child: std.mem.Allocator,
+    current_bytes: usize,
+    peak_bytes: usize,
+
+    pub fn init(child: std.mem.Allocator) Self {
+        return .{ .child = child, .current_bytes = 0, .peak_bytes = 0 };
+    }
+
+    pub fn allocator(self: *Self) std.mem.Allocator {
+        return .{
+            .ptr = self,
+            .vtable = &.{ .alloc = alloc, .resize = resize, .free = free },
+        };
+    }
+
+    // Starts a new measurement from the bytes allocated now.
+    pub fn resetPeak(self: *Self) void {
+        @atomicStore(usize, &self.peak_bytes, @atomicLoad(usize, &self.current_bytes, .Monotonic), .Monotonic);
+    }
+
+    pub fn getPeakBytes(self: *const Self) usize {
+        return @atomicLoad(usize, &self.peak_bytes, .Monotonic);
+    }
+
+    fn alloc(ctx: *anyopaque, len: usize, ptr_align: u8, ret_addr: usize) ?[*]u8 {
+        const self: *Self = @ptrCast(@alignCast(ctx));
+        const result = self.child.rawAlloc(len, ptr_align, ret_addr) orelse return null;
+        self.grow(len);
+        return result;
+    }
+
+    fn resize(ctx: *anyopaque, buf: []u8, buf_align: u8, new_len: usize, ret_addr: usize) bool {
+        const self: *Self = @ptrCast(@alignCast(ctx));
+        if (!self.child.rawResize(buf, buf_align, new_len, ret_addr)) return false;
+        if (new_len > buf.len) self.grow(new_len - buf.len) else self.shrink(buf.len - new_len);
+        return true;
+    }
+
+    fn free(ctx: *anyopaque, buf: []u8, buf_align: u8, ret_addr: usize) void {
+        const self: *Self = @ptrCast(@alignCast(ctx));
+        self.child.rawFree(buf, buf_align, ret_addr);
+        self.shrink(buf.len);
+    }
+
+    fn grow(self: *Self, bytes: usize) void {
+        const current = @atomicRmw(usize, &self.current_bytes, .Add, bytes, .Monotonic) + bytes;
+        _ = @atomicRmw(usize, &self.peak_bytes, .Max, current, .Monotonic);
+    }
+
+    fn shrink(self: *Self, bytes: usize) void {
+        _ = @atomicRmw(usize, &self.current_bytes, .Sub, bytes, .Monotonic);
+    }
+};
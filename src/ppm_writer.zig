@@ -0,0 +1,53 @@
+const std = @import("std");
+const util = @import("util.zig");
+const gpu_structs = @import("gpu_structs.zig");
+const tile_scheduler = @import("tile_scheduler.zig");
+const Tile = tile_scheduler.Tile;
+
+// Binary PPM which is filled tile by tile in any order, tiles are written with positional writes,
+// so workers can write concurrently and nothing but the header is kept in memory.
+// Rows are stored top to bottom, the first row of the path tracer is the bottom one.
+pub const PpmWriter = struct {
+    const Self = @This();
+    const BYTES_PER_PIXEL = 3;
+    file: std.fs.File,
+    resolution: util.Resolution,
+    header_len: u64,
+
+    pub fn create(path: []const u8, resolution: util.Resolution) !Self {
+        var file = try std.fs.cwd().createFile(path, .{});
+        errdefer file.close();
+
+        var header_buffer: [64]u8 = undefined;
+        const header = try std.fmt.bufPrint(&header_buffer, "P6\n{d} {d}\n255\n", .{ resolution.width, resolution.height });
+        try file.writeAll(header);
+        try file.setEndPos(header.len + @as(u64, resolution.width) * resolution.height * BYTES_PER_PIXEL);
+        return .{
+            .file = file,
+            .resolution = resolution,
+            .header_len = header.len,
+        };
+    }
+
+    pub fn close(self: *Self) void {
+        self.file.close();
+    }
+
+    // pixels are the post processed rgba values of the tile, row by row.
+    pub fn writeTile(self: *const Self, tile: Tile, pixels: []const gpu_structs.Vector4) !void {
+        const width = tile.x1 - tile.x0;
+        var row: [tile_scheduler.TILE_SIZE * BYTES_PER_PIXEL]u8 = undefined;
+        var y = tile.y0;
+        while (y < tile.y1) : (y += 1) {
+            const src = pixels[(y - tile.y0) * width ..][0..width];
+            for (src, 0..) |pixel, x| {
+                for (0..BYTES_PER_PIXEL) |c| {
+                    row[x * BYTES_PER_PIXEL + c] = @intFromFloat(@round(std.math.clamp(pixel[c], 0.0, 1.0) * 255.0));
+                }
+            }
+            const file_row: u64 = self.resolution.height - y - 1;
+            const offset = self.header_len + (file_row * self.resolution.width + tile.x0) * BYTES_PER_PIXEL;
+            try self.file.pwriteAll(row[0 .. width * BYTES_PER_PIXEL], offset);
+        }
+    }
+};
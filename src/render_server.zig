@@ -0,0 +1,242 @@
+const std = @import("std");
+const zmath = @import("zmath");
+const util = @import("util.zig");
+const gpu_structs = @import("gpu_structs.zig");
+const Scene = @import("scene.zig").Scene;
+const Camera = @import("camera.zig").Camera;
+
+// Render daemon. Scenes stay loaded with their path tracer (bvh, textures, kernels) between requests,
+// so a request pays only for the render.
+// Clients connect to a Unix socket and send RenderRequest messages, the server answers each of them
+// with a stream of frames, every frame is a FrameHeader followed by the pixels of getFrameBuffer.
+// Connections are served one at a time, requests of a connection in the order they were sent.
+
+pub const RenderServerError = error{
+    ProtocolError,
+    InvalidResolution,
+};
+
+pub const MAGIC: u32 = 0x4f524e53; // "ORNS"
+pub const SCENE_NAME_LEN = 64;
+// largest width and height of a request, the pixel count stays within u32
+pub const MAX_RESOLUTION: u32 = 16384;
+
+pub const RenderRequest = extern struct {
+    magic: u32 = MAGIC,
+    // zero padded name passed to the scene loader
+    scene_name: [SCENE_NAME_LEN]u8,
+    lookfrom: [3]f32,
+    lookat: [3]f32,
+    vup: [3]f32,
+    vfov: f32,
+    aperture: f32,
+    focus_dist: f32,
+    width: u32,
+    height: u32,
+    depth: u32,
+    // samples per pixel of the last frame
+    samples: u32,
+    // samples rendered between frames, 0 sends only the last frame
+    samples_per_frame: u32,
+
+    pub fn getSceneName(self: *const RenderRequest) []const u8 {
+        return std.mem.sliceTo(&self.scene_name, 0);
+    }
+};
+
+pub const FrameStatus = enum(u32) {
+    frame = 0,
+    last_frame = 1,
+    // the request failed, no pixels follow
+    failed = 2,
+};
+
+pub const FrameHeader = extern struct {
+    magic: u32 = MAGIC,
+    status: FrameStatus,
+    width: u32,
+    height: u32,
+    samples: u32,
+    // keeps payload_size aligned without sending uninitialized bytes
+    _padding: u32 = 0,
+    // size of the Vector4 pixels following the header
+    payload_size: u64,
+};
+
+// Fills the scene of a name, the server calls it the first time a scene is requested.
+pub const SceneLoader = *const fn (allocator: std.mem.Allocator, name: []const u8, scene: *Scene) anyerror!void;
+
+// PathTracer is created with init(allocator, scene), like the HIP and CPU path tracers.
+pub fn RenderServer(comptime PathTracer: type) type {
+    return struct {
+        const Self = @This();
+
+        const Entry = struct {
+            name: []u8,
+            path_tracer: PathTracer,
+            last_used: u64,
+        };
+
+        allocator: std.mem.Allocator,
+        loader: SceneLoader,
+        // the least recently used scene is unloaded to stay below it
+        max_scenes: u32,
+        entries: std.ArrayList(Entry),
+        requests_count: u64,
+        frame_buffer: std.ArrayList(gpu_structs.Vector4),
+
+        pub fn init(allocator: std.mem.Allocator, loader: SceneLoader, max_scenes: u32) Self {
+            return .{
+                .allocator = allocator,
+                .loader = loader,
+                .max_scenes = @max(max_scenes, 1),
+                .entries = std.ArrayList(Entry).init(allocator),
+                .requests_count = 0,
+                .frame_buffer = std.ArrayList(gpu_structs.Vector4).init(allocator),
+            };
+        }
+
+        pub fn deinit(self: *Self) void {
+            for (self.entries.items) |*entry| self.deinitEntry(entry);
+            self.entries.deinit();
+            self.frame_buffer.deinit();
+        }
+
+        // Listens on the Unix socket at path and serves clients until accepting a connection fails.
+        // A stale socket file left at path is replaced.
+        pub fn serve(self: *Self, path: []const u8) !void {
+            std.fs.cwd().deleteFile(path) catch |err| switch (err) {
+                error.FileNotFound => {},
+                else => return err,
+            };
+            var server = std.net.StreamServer.init(.{});
+            defer server.deinit();
+            try server.listen(try std.net.Address.initUnix(path));
+            std.log.info("[ornament] render server listens on {s}", .{path});
+
+            while (true) {
+                const connection = try server.accept();
+                defer connection.stream.close();
+                self.serveConnection(connection.stream) catch |err| {
+                    std.log.err("[ornament] render server connection failed: {s}", .{@errorName(err)});
+                };
+            }
+        }
+
+        fn serveConnection(self: *Self, stream: std.net.Stream) !void {
+            while (true) {
+                var request: RenderRequest = undefined;
+                const read = try stream.reader().readAll(std.mem.asBytes(&request));
+                if (read == 0) return;
+                if (read != @sizeOf(RenderRequest) or request.magic != MAGIC) return RenderServerError.ProtocolError;
+
+                self.render(stream, &request) catch |err| {
+                    std.log.err("[ornament] render request of {s} failed: {s}", .{ request.getSceneName(), @errorName(err) });
+                    // a failed write means the client is gone
+                    try writeFrame(stream, .{ .status = .failed, .width = 0, .height = 0, .samples = 0, .payload_size = 0 }, &.{});
+                };
+            }
+        }
+
+        fn render(self: *Self, stream: std.net.Stream, request: *const RenderRequest) !void {
+            if (request.width == 0 or request.height == 0 or request.width > MAX_RESOLUTION or request.height > MAX_RESOLUTION) {
+                return RenderServerError.InvalidResolution;
+            }
+            const path_tracer = try self.getPathTracer(request.getSceneName());
+            const resolution = util.Resolution{ .width = request.width, .height = request.height };
+            path_tracer.scene.camera = Camera.init(
+                zmath.loadArr3w(request.lookfrom, 1.0),
+                zmath.loadArr3w(request.lookat, 1.0),
+                zmath.loadArr3(request.vup),
+                @as(f32, @floatFromInt(request.width)) / @as(f32, @floatFromInt(request.height)),
+                request.vfov,
+                request.aperture,
+                request.focus_dist,
+            );
+            path_tracer.state.setDepth(request.depth);
+            path_tracer.state.setDynamicResolution(false);
+            path_tracer.state.setTemporalReprojection(false);
+            if (!std.meta.eql(path_tracer.state.getResolution(), resolution)) try path_tracer.setResolution(resolution);
+            try self.frame_buffer.resize(resolution.pixel_count());
+
+            const samples = @max(request.samples, 1);
+            const samples_per_frame = if (request.samples_per_frame == 0) samples else request.samples_per_frame;
+            var rendered: u32 = 0;
+            while (rendered < samples) {
+                const frame_samples = @min(samples_per_frame, samples - rendered);
+                path_tracer.state.setIterations(frame_samples);
+                try path_tracer.render();
+                rendered += frame_samples;
+
+                try path_tracer.getFrameBuffer(self.frame_buffer.items);
+                const pixels = std.mem.sliceAsBytes(self.frame_buffer.items);
+                try writeFrame(stream, .{
+                    .status = if (rendered == samples) .last_frame else .frame,
+                    .width = resolution.width,
+                    .height = resolution.height,
+                    .samples = rendered,
+                    .payload_size = pixels.len,
+                }, pixels);
+            }
+        }
+
+        fn getPathTracer(self: *Self, name: []const u8) !*PathTracer {
+            self.requests_count += 1;
+            for (self.entries.items) |*entry| {
+                if (std.mem.eql(u8, entry.name, name)) {
+                    entry.last_used = self.requests_count;
+                    return &entry.path_tracer;
+                }
+            }
+
+            if (self.entries.items.len == self.max_scenes) {
+                var lru: usize = 0;
+                for (self.entries.items, 0..) |entry, i| {
+                    if (entry.last_used < self.entries.items[lru].last_used) lru = i;
+                }
+                std.log.info("[ornament] render server unloads scene {s}", .{self.entries.items[lru].name});
+                self.deinitEntry(&self.entries.items[lru]);
+                _ = self.entries.swapRemove(lru);
+            }
+
+            std.log.info("[ornament] render server loads scene {s}", .{name});
+            var scene = Scene.init(self.allocator);
+            self.loader(self.allocator, name, &scene) catch |err| {
+                scene.deinit();
+                return err;
+            };
+            // the path tracer owns the scene once it is created
+            var path_tracer = PathTracer.init(self.allocator, scene) catch |err| {
+                scene.deinit();
+                return err;
+            };
+            errdefer deinitPathTracer(&path_tracer);
+            const entry_name = try self.allocator.dupe(u8, name);
+            errdefer self.allocator.free(entry_name);
+            try self.entries.append(.{ .name = entry_name, .path_tracer = path_tracer, .last_used = self.requests_count });
+            return &self.entries.items[self.entries.items.len - 1].path_tracer;
+        }
+
+        fn deinitEntry(self: *Self, entry: *Entry) void {
+            deinitPathTracer(&entry.path_tracer);
+            self.allocator.free(entry.name);
+        }
+
+        // deinit of HipPathTracer returns the errors of the driver
+        fn deinitPathTracer(path_tracer: *PathTracer) void {
+            const Result = @typeInfo(@TypeOf(PathTracer.deinit)).Fn.return_type.?;
+            if (@typeInfo(Result) == .ErrorUnion) {
+                path_tracer.deinit() catch |err| {
+                    std.log.err("[ornament] path tracer returned an error on deinit: {s}", .{@errorName(err)});
+                };
+            } else {
+                path_tracer.deinit();
+            }
+        }
+    };
+}
+
+fn writeFrame(stream: std.net.Stream, header: FrameHeader, pixels: []const u8) !void {
+    try stream.writer().writeAll(std.mem.asBytes(&header));
+    try stream.writer().writeAll(pixels);
+}
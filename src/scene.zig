@@ -9,6 +9,7 @@ const Material = @import("material.zig").Material;
 const Texture = @import("texture.zig").Texture;
 const Color = @import("color.zig").Color;
 const Aabb = @import("aabb.zig").Aabb;
+const util = @import("util.zig");
 
 pub const Scene = struct {
     const Self = @This();
@@ -19,6 +20,7 @@ pub const Scene = struct {
     mesh_instances: std.ArrayList(*MeshInstance),
     materials: std.ArrayList(*Material),
     textures: std.ArrayList(*Texture),
+    environment_map: ?*Texture,
 
     attached_spheres: std.ArrayList(*Sphere),
     attached_meshes: std.ArrayList(*Mesh),
@@ -41,6 +43,7 @@ pub const Scene = struct {
             .mesh_instances = std.ArrayList(*MeshInstance).init(allocator),
             .materials = std.ArrayList(*Material).init(allocator),
             .textures = std.ArrayList(*Texture).init(allocator),
+            .environment_map = null,
             .attached_spheres = std.ArrayList(*Sphere).init(allocator),
             .attached_meshes = std.ArrayList(*Mesh).init(allocator),
             .attached_mesh_instances = std.ArrayList(*MeshInstance).init(allocator),
@@ -61,6 +64,18 @@ pub const Scene = struct {
         self.destroyElements(&self.textures);
     }
 
+    pub fn memoryUsage(self: *const Self) util.SceneMemory {
+        var usage = util.SceneMemory{
+            .objects_bytes = util.arrayListsBytes(self.*) +
+                self.spheres.items.len * @sizeOf(Sphere) +
+                self.mesh_instances.items.len * @sizeOf(MeshInstance) +
+                self.materials.items.len * @sizeOf(Material),
+        };
+        for (self.meshes.items) |m| usage.meshes_bytes += @sizeOf(Mesh) + util.arrayListsBytes(m.*);
+        for (self.textures.items) |t| usage.textures_bytes += @sizeOf(Texture) + util.arrayListsBytes(t.*);
+        return usage;
+    }
+
     pub fn lambertian(self: *Self, albedo: Color) std.mem.Allocator.Error!*Material {
         var material = try self.allocator.create(Material);
         material.* = Material{
@@ -351,9 +366,18 @@ pub const Scene = struct {
     }
 
     pub fn releaseTexture(self: *Self, texture: *const Texture) void {
+        if (self.environment_map) |em| {
+            if (em == texture) self.environment_map = null;
+        }
         self.releaseElement(texture, self.textures);
     }
 
+    // Lights rays which leave the scene, equirectangular texture created by createTexture.
+    // Without it the sky gradient is used.
+    pub fn setEnvironmentMap(self: *Self, texture: ?*Texture) void {
+        self.environment_map = texture;
+    }
+
     pub fn attachSphere(self: *Self, sphere: *Sphere) !void {
         try self.attached_spheres.append(sphere);
     }
@@ -0,0 +1,144 @@
+const std = @import("std");
+const zmath = @import("zmath");
+const Scene = @import("scene.zig").Scene;
+const Camera = @import("camera.zig").Camera;
+const Material = @import("material.zig").Material;
+
+// Synthetic scenes of a given size for the bvh and render benchmarks.
+// Objects fill the cells of a cube grid of unit cells around the origin, one object per cell at a random offset,
+// so the density stays the same as the count grows. Materials are picked from a palette made like the
+// random spheres of the examples (80% lambertian, 15% metal, 5% dielectric), the memory is spent on geometry.
+// The camera looks at the cube from a corner and sees all of it.
+
+pub const Options = struct {
+    seed: u64 = 100,
+    aspect_ratio: f32 = 1.0,
+    palette_size: u32 = 16,
+};
+
+// count spheres.
+pub fn spheres(scene: *Scene, count: u32, options: Options) !void {
+    var generator = try Generator.init(scene, count, options);
+    defer generator.deinit();
+    var i: u32 = 0;
+    while (i < count) : (i += 1) {
+        try scene.attachSphere(try scene.createSphere(generator.cellCenter(i), generator.radius(), generator.material()));
+    }
+}
+
+// count instances of one sphere mesh, the mesh itself is the first of them.
+pub fn meshInstances(scene: *Scene, count: u32, options: Options) !void {
+    if (count == 0) return;
+    var generator = try Generator.init(scene, count, options);
+    defer generator.deinit();
+    const mesh = try scene.createSphereMesh(generator.cellCenter(0), generator.radius(), generator.material());
+    try scene.attachMesh(mesh);
+    var i: u32 = 1;
+    while (i < count) : (i += 1) {
+        const transform = zmath.mul(zmath.scalingV(zmath.f32x4s(generator.radius())), zmath.translationV(generator.cellCenter(i)));
+        try scene.attachMeshInstance(try scene.createMeshInstance(mesh, transform, generator.material()));
+    }
+}
+
+// One mesh of triangles_count triangles, a random triangle per cell.
+pub fn triangleMesh(scene: *Scene, triangles_count: u32, options: Options) !void {
+    if (triangles_count == 0) return;
+    var generator = try Generator.init(scene, triangles_count, options);
+    defer generator.deinit();
+
+    var vertices = try scene.allocator.alloc(zmath.Vec, triangles_count * 3);
+    defer scene.allocator.free(vertices);
+    var vertex_indices = try scene.allocator.alloc(u32, triangles_count * 3);
+    defer scene.allocator.free(vertex_indices);
+    var normals = try scene.allocator.alloc(zmath.Vec, triangles_count);
+    defer scene.allocator.free(normals);
+    var normal_indices = try scene.allocator.alloc(u32, triangles_count * 3);
+    defer scene.allocator.free(normal_indices);
+
+    var i: u32 = 0;
+    while (i < triangles_count) : (i += 1) {
+        const center = generator.cellCenter(i);
+        const v = vertices[i * 3 ..][0..3];
+        for (v) |*vertex| vertex.* = center + generator.offset(0.4);
+        normals[i] = zmath.normalize3(zmath.cross3(v[1] - v[0], v[2] - v[0]));
+        for (0..3) |j| {
+            vertex_indices[i * 3 + j] = i * 3 + @as(u32, @intCast(j));
+            normal_indices[i * 3 + j] = i;
+        }
+    }
+    try scene.attachMesh(try scene.createMesh(vertices, vertex_indices, normals, normal_indices, &.{}, &.{}, zmath.identity(), generator.material()));
+}
+
+const Generator = struct {
+    const Self = @This();
+    prng: std.rand.DefaultPrng,
+    palette: []*Material,
+    allocator: std.mem.Allocator,
+    // cells along every side of the cube
+    side: u32,
+
+    fn init(scene: *Scene, count: u32, options: Options) !Self {
+        var self = Self{
+            .prng = std.rand.DefaultPrng.init(options.seed),
+            .palette = try scene.allocator.alloc(*Material, @max(options.palette_size, 1)),
+            .allocator = scene.allocator,
+            .side = @max(@as(u32, @intFromFloat(@ceil(std.math.cbrt(@as(f64, @floatFromInt(count)))))), 1),
+        };
+        errdefer self.deinit();
+        const rand = self.prng.random();
+        for (self.palette) |*m| {
+            const choose_mat = rand.float(f32);
+            const color = zmath.f32x4(rand.float(f32), rand.float(f32), rand.float(f32), 1.0);
+            m.* = try if (choose_mat < 0.8)
+                scene.lambertian(.{ .vec = color * color })
+            else if (choose_mat < 0.95)
+                scene.metal(.{ .vec = zmath.f32x4s(0.5) + color * zmath.f32x4s(0.5) }, 0.5 * rand.float(f32))
+            else
+                scene.dielectric(1.5);
+        }
+
+        const half_side = 0.5 * @as(f32, @floatFromInt(self.side));
+        const lookat = zmath.f32x4(0.0, 0.0, 0.0, 1.0);
+        const lookfrom = zmath.f32x4(1.6 * half_side + 2.0, 1.2 * half_side + 2.0, 2.0 * half_side + 2.0, 1.0);
+        scene.camera = Camera.init(
+            lookfrom,
+            lookat,
+            zmath.f32x4(0.0, 1.0, 0.0, 0.0),
+            options.aspect_ratio,
+            40.0,
+            0.0,
+            zmath.length3(lookfrom - lookat)[0],
+        );
+        return self;
+    }
+
+    fn deinit(self: *Self) void {
+        self.allocator.free(self.palette);
+    }
+
+    fn cellCenter(self: *Self, index: u32) zmath.Vec {
+        const half_side = 0.5 * @as(f32, @floatFromInt(self.side));
+        const x: f32 = @floatFromInt(index % self.side);
+        const y: f32 = @floatFromInt(index / self.side % self.side);
+        const z: f32 = @floatFromInt(index / (self.side * self.side));
+        return zmath.f32x4(x + 0.5 - half_side, y + 0.5 - half_side, z + 0.5 - half_side, 1.0) + self.offset(0.2);
+    }
+
+    fn offset(self: *Self, max: f32) zmath.Vec {
+        const rand = self.prng.random();
+        return zmath.f32x4(
+            max * (2.0 * rand.float(f32) - 1.0),
+            max * (2.0 * rand.float(f32) - 1.0),
+            max * (2.0 * rand.float(f32) - 1.0),
+            0.0,
+        );
+    }
+
+    fn radius(self: *Self) f32 {
+        return 0.15 + 0.15 * self.prng.random().float(f32);
+    }
+
+    fn material(self: *Self) *Material {
+        return self.palette[self.prng.random().uintLessThan(usize, self.palette.len)];
+    }
+};
@@ -0,0 +1,157 @@
+const std = @import("std");
+const builtin = @import("builtin");
+const util = @import("util.zig");
+const gpu_structs = @import("gpu_structs.zig");
+
+comptime {
+    if (builtin.os.tag == .windows) @compileError("SharedFrameBuffer uses POSIX shared memory");
+}
+
+pub const SharedFrameBufferError = error{
+    InvalidSharedFrameBuffer,
+};
+
+// Double buffered frame buffer in POSIX shared memory, other processes map it and read frames in place.
+// The object is the header followed by two frames of Vector4 pixels.
+// The producer fills the back frame and publishes it by incrementing the sequence,
+// frame sequence % 2 is the front one. Right after the next publish the front frame becomes the back one
+// and the producer starts to overwrite it, so a consumer reading in place checks isCurrent after it is done with the pixels.
+pub const SharedFrameBuffer = struct {
+    const Self = @This();
+    const Vector4 = gpu_structs.Vector4;
+    pub const MAGIC: u32 = 0x4f524e46; // "ORNF"
+    pub const VERSION: u32 = 1;
+
+    pub const Header = extern struct {
+        magic: u32 = MAGIC,
+        version: u32 = VERSION,
+        width: u32,
+        height: u32,
+        // number of published frames, 0 while there is none
+        sequence: u64,
+    };
+
+    name: [:0]const u8,
+    owner: bool,
+    memory: []align(std.mem.page_size) u8,
+    header: *Header,
+    frames: [2][]Vector4,
+
+    // Creates the shared memory object name ("/ornament" style) for frames of resolution.
+    // The object is unlinked by deinit.
+    pub fn create(allocator: std.mem.Allocator, name: []const u8, resolution: util.Resolution) !Self {
+        const name_z = try allocator.dupeZ(u8, name);
+        errdefer allocator.free(name_z);
+        const fd = try shmOpen(name_z, std.os.O.RDWR | std.os.O.CREAT | std.os.O.TRUNC);
+        defer std.os.close(fd);
+        errdefer _ = std.c.shm_unlink(name_z);
+
+        const size = memorySize(resolution);
+        try std.os.ftruncate(fd, size);
+        var self = try map(name_z, true, fd, resolution);
+        self.header.* = .{ .width = resolution.width, .height = resolution.height, .sequence = 0 };
+        return self;
+    }
+
+    // Maps the shared memory object created by another process.
+    pub fn open(allocator: std.mem.Allocator, name: []const u8) !Self {
+        const name_z = try allocator.dupeZ(u8, name);
+        errdefer allocator.free(name_z);
+        const fd = try shmOpen(name_z, std.os.O.RDWR);
+        defer std.os.close(fd);
+
+        const stat = try std.os.fstat(fd);
+        if (stat.size < @sizeOf(Header)) return SharedFrameBufferError.InvalidSharedFrameBuffer;
+        var header: Header = undefined;
+        if (try std.os.pread(fd, std.mem.asBytes(&header), 0) != @sizeOf(Header)) return SharedFrameBufferError.InvalidSharedFrameBuffer;
+        if (header.magic != MAGIC or header.version != VERSION) return SharedFrameBufferError.InvalidSharedFrameBuffer;
+        const resolution = util.Resolution{ .width = header.width, .height = header.height };
+        if (stat.size < memorySize(resolution)) return SharedFrameBufferError.InvalidSharedFrameBuffer;
+        return map(name_z, false, fd, resolution);
+    }
+
+    pub fn deinit(self: *Self, allocator: std.mem.Allocator) void {
+        std.os.munmap(self.memory);
+        if (self.owner) _ = std.c.shm_unlink(self.name);
+        allocator.free(self.name);
+    }
+
+    pub fn getResolution(self: *const Self) util.Resolution {
+        return .{ .width = self.header.width, .height = self.header.height };
+    }
+
+    // Frame the producer fills before publish.
+    pub fn getBackBuffer(self: *Self) []Vector4 {
+        return self.frames[(self.loadSequence() + 1) % 2];
+    }
+
+    pub fn publish(self: *Self) void {
+        _ = @atomicRmw(u64, &self.header.sequence, .Add, 1, .Release);
+        // the pixels of the next back frame are not written before the new sequence
+        @fence(.Release);
+    }
+
+    // Copies the frame buffer of a path tracer to the back frame and publishes it.
+    pub fn publishFrameBuffer(self: *Self, path_tracer: anytype) !void {
+        try path_tracer.getFrameBuffer(self.getBackBuffer());
+        self.publish();
+    }
+
+    pub const Frame = struct {
+        sequence: u64,
+        pixels: []const Vector4,
+    };
+
+    // Last published frame, null before the first publish.
+    pub fn getFrontBuffer(self: *const Self) ?Frame {
+        const sequence = self.loadSequence();
+        if (sequence == 0) return null;
+        return .{ .sequence = sequence, .pixels = self.frames[sequence % 2] };
+    }
+
+    // False once the producer may have started to overwrite the pixels of the frame,
+    // which it does right after the next publish.
+    pub fn isCurrent(self: *const Self, frame: Frame) bool {
+        // the reads of the pixels are done before the sequence is checked again
+        @fence(.Acquire);
+        return self.loadSequence() == frame.sequence;
+    }
+
+    fn loadSequence(self: *const Self) u64 {
+        return @atomicLoad(u64, &self.header.sequence, .Acquire);
+    }
+
+    fn memorySize(resolution: util.Resolution) usize {
+        return frameOffset() + 2 * @as(usize, resolution.pixel_count()) * @sizeOf(Vector4);
+    }
+
+    // pixels start at the first Vector4 aligned offset after the header
+    fn frameOffset() usize {
+        return std.mem.alignForward(usize, @sizeOf(Header), @alignOf(Vector4));
+    }
+
+    fn map(name: [:0]const u8, owner: bool, fd: std.os.fd_t, resolution: util.Resolution) !Self {
+        const memory = try std.os.mmap(null, memorySize(resolution), std.os.PROT.READ | std.os.PROT.WRITE, std.os.MAP.SHARED, fd, 0);
+        const header: *Header = @ptrCast(memory.ptr);
+        const pixels_count = resolution.pixel_count();
+        const pixels: [*]Vector4 = @ptrCast(@alignCast(memory.ptr + frameOffset()));
+        return .{
+            .name = name,
+            .owner = owner,
+            .memory = memory,
+            .header = header,
+            .frames = .{ pixels[0..pixels_count], pixels[pixels_count .. 2 * pixels_count] },
+        };
+    }
+};
+
+fn shmOpen(name: [:0]const u8, flags: u32) !std.os.fd_t {
+    const fd = std.c.shm_open(name, @intCast(flags), 0o600);
+    return switch (std.c.getErrno(fd)) {
+        .SUCCESS => fd,
+        .NOENT => error.FileNotFound,
+        .ACCES => error.AccessDenied,
+        .EXIST => error.PathAlreadyExists,
+        else => |err| std.os.unexpectedErrno(err),
+    };
+}
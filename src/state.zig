@@ -1,24 +1,60 @@
-const Resolution = @import("util.zig").Resolution;
+const util = @import("util.zig");
+const Resolution = util.Resolution;
+const OutputFormat = util.OutputFormat;
+const AccumulationFormat = util.AccumulationFormat;
 
 pub const State = struct {
     const Self = @This();
     resolution: Resolution,
+    // format of the frame buffer, changes with the resolution
+    output_format: OutputFormat,
+    requested_output_format: OutputFormat,
+    // layout of the accumulation buffers, changes with the resolution
+    accumulation_format: AccumulationFormat,
+    requested_accumulation_format: AccumulationFormat,
     depth: u32,
     flip_y: bool,
     inverted_gamma: f32,
     iterations: u32,
     ray_cast_epsilon: f32,
     current_iteration: f32,
+    adaptive_sampling: bool,
+    adaptive_threshold: f32,
+    adaptive_min_samples: u32,
+    denoise: bool,
+    temporal_reprojection: bool,
+    temporal_history_limit: u32,
+    dynamic_resolution: bool,
+    dynamic_resolution_stride: u32,
+    dynamic_resolution_still_frames: u32,
+    // every pixel_stride-th pixel in both directions is traced per iteration
+    pixel_stride: u32,
+    still_frames: u32,
 
     pub fn init() Self {
         return .{
             .resolution = .{ .width = 500, .height = 500 },
+            .output_format = .rgba32f,
+            .requested_output_format = .rgba32f,
+            .accumulation_format = .rgba32f,
+            .requested_accumulation_format = .rgba32f,
             .depth = 10,
             .flip_y = false,
             .inverted_gamma = 1.0,
             .iterations = 1,
             .ray_cast_epsilon = 0.001,
             .current_iteration = 0.0,
+            .adaptive_sampling = false,
+            .adaptive_threshold = 0.01,
+            .adaptive_min_samples = 16,
+            .denoise = false,
+            .temporal_reprojection = false,
+            .temporal_history_limit = 64,
+            .dynamic_resolution = false,
+            .dynamic_resolution_stride = 2,
+            .dynamic_resolution_still_frames = 4,
+            .pixel_stride = 1,
+            .still_frames = 0,
         };
     }
 
@@ -56,12 +92,34 @@ pub const State = struct {
 
     pub fn setResolution(self: *Self, resolution: Resolution) void {
         self.resolution = resolution;
+        self.output_format = self.requested_output_format;
+        self.accumulation_format = self.requested_accumulation_format;
     }
 
     pub fn getResolution(self: *const Self) Resolution {
         return self.resolution;
     }
 
+    // The frame buffer is created with the format at the next setResolution of the path tracer.
+    pub fn setOutputFormat(self: *Self, output_format: OutputFormat) void {
+        self.requested_output_format = output_format;
+    }
+
+    pub fn getOutputFormat(self: *const Self) OutputFormat {
+        return self.output_format;
+    }
+
+    // The accumulation buffers are created with the format at the next setResolution of the path tracer.
+    // rgb15e5 halves the memory of the accumulation and the history, the WGPU backend supports only rgba32f.
+    // It counts up to 16383 samples per pixel, later samples update a moving average of about the last 16383.
+    pub fn setAccumulationFormat(self: *Self, accumulation_format: AccumulationFormat) void {
+        self.requested_accumulation_format = accumulation_format;
+    }
+
+    pub fn getAccumulationFormat(self: *const Self) AccumulationFormat {
+        return self.accumulation_format;
+    }
+
     pub fn setRayCastEpsilon(self: *Self, ray_cast_epsilon: f32) void {
         self.ray_cast_epsilon = ray_cast_epsilon;
     }
@@ -70,11 +128,172 @@ pub const State = struct {
         return self.ray_cast_epsilon;
     }
 
+    // Converged pixels stop taking samples, see setAdaptiveThreshold and setAdaptiveMinSamples.
+    pub fn setAdaptiveSampling(self: *Self, adaptive_sampling: bool) void {
+        self.adaptive_sampling = adaptive_sampling;
+    }
+
+    pub fn getAdaptiveSampling(self: *const Self) bool {
+        return self.adaptive_sampling;
+    }
+
+    // A pixel is converged when the standard error of its mean luminance relative to the mean is below the threshold.
+    pub fn setAdaptiveThreshold(self: *Self, adaptive_threshold: f32) void {
+        self.adaptive_threshold = adaptive_threshold;
+    }
+
+    pub fn getAdaptiveThreshold(self: *const Self) f32 {
+        return self.adaptive_threshold;
+    }
+
+    // Samples every pixel takes before its error estimate is trusted, at least 2.
+    pub fn setAdaptiveMinSamples(self: *Self, adaptive_min_samples: u32) void {
+        self.adaptive_min_samples = @max(adaptive_min_samples, 2);
+    }
+
+    pub fn getAdaptiveMinSamples(self: *const Self) u32 {
+        return self.adaptive_min_samples;
+    }
+
+    // Filters the accumulated image with the albedo and normal guided denoiser before post processing.
+    pub fn setDenoise(self: *Self, denoise: bool) void {
+        self.denoise = denoise;
+    }
+
+    pub fn getDenoise(self: *const Self) bool {
+        return self.denoise;
+    }
+
+    // Camera moves reproject the accumulated image instead of discarding it.
+    pub fn setTemporalReprojection(self: *Self, temporal_reprojection: bool) void {
+        self.temporal_reprojection = temporal_reprojection;
+    }
+
+    pub fn getTemporalReprojection(self: *const Self) bool {
+        return self.temporal_reprojection;
+    }
+
+    // Max samples a reprojected pixel keeps from its history, at least 1.
+    pub fn setTemporalHistoryLimit(self: *Self, temporal_history_limit: u32) void {
+        self.temporal_history_limit = @max(temporal_history_limit, 1);
+    }
+
+    pub fn getTemporalHistoryLimit(self: *const Self) u32 {
+        return self.temporal_history_limit;
+    }
+
+    // After a camera move iterations trace interleaved subsets of pixels and the gaps are filled
+    // in post processing, full resolution is back once the camera is still for a few frames.
+    pub fn setDynamicResolution(self: *Self, dynamic_resolution: bool) void {
+        self.dynamic_resolution = dynamic_resolution;
+        // otherwise the stride stays until it would drop after the still frames
+        if (!dynamic_resolution and self.pixel_stride > 1) {
+            // the pixels without a sample would be shown with the accumulation from before the reset
+            if (self.hasUntracedPixels()) self.current_iteration = 0.0;
+            self.pixel_stride = 1;
+        }
+    }
+
+    pub fn getDynamicResolution(self: *const Self) bool {
+        return self.dynamic_resolution;
+    }
+
+    // Pixel stride while moving, an iteration traces 1 / stride^2 of the pixels.
+    pub fn setDynamicResolutionStride(self: *Self, stride: u32) void {
+        self.dynamic_resolution_stride = @max(stride, 1);
+    }
+
+    pub fn getDynamicResolutionStride(self: *const Self) u32 {
+        return self.dynamic_resolution_stride;
+    }
+
+    // Rendered frames without camera moves before going back to full resolution.
+    pub fn setDynamicResolutionStillFrames(self: *Self, still_frames: u32) void {
+        self.dynamic_resolution_still_frames = still_frames;
+    }
+
+    pub fn getDynamicResolutionStillFrames(self: *const Self) u32 {
+        return self.dynamic_resolution_still_frames;
+    }
+
+    pub fn nextFrame(self: *Self, camera_moved: bool) void {
+        self.still_frames = if (camera_moved) 0 else self.still_frames +| 1;
+    }
+
     pub fn nextIteration(self: *Self) void {
+        // the stride can drop only after every pixel of the stride pattern got its first sample
+        const iteration: u32 = @intFromFloat(self.current_iteration);
+        if (self.pixel_stride > 1 and
+            self.still_frames >= self.dynamic_resolution_still_frames and
+            iteration % (self.pixel_stride * self.pixel_stride) == 0)
+        {
+            self.pixel_stride = 1;
+        }
         self.current_iteration += 1.0;
     }
 
+    // Every pixel takes its first sample after the reset during the first pixel_stride^2 iterations.
+    pub fn isFirstCycle(self: *const Self) bool {
+        return self.current_iteration <= @as(f32, @floatFromInt(self.pixel_stride * self.pixel_stride));
+    }
+
+    // Some pixels of the stride pattern have no sample since the reset yet and hold the accumulation from before it,
+    // they are shown with the pixel of their stride block traced first, are not denoised and don't count for convergence.
+    pub fn hasUntracedPixels(self: *const Self) bool {
+        return self.current_iteration < @as(f32, @floatFromInt(self.pixel_stride * self.pixel_stride));
+    }
+
+    // A stride cycle traces every offset of the stride pattern once, pixel_stride^2 iterations.
+    // The render stats are summed over a cycle, so convergence is known at its end.
+    fn cycleIterations(self: *const Self) u32 {
+        const iteration: u32 = @intFromFloat(self.current_iteration);
+        if (iteration == 0) return 0;
+        return (iteration - 1) % (self.pixel_stride * self.pixel_stride) + 1;
+    }
+
+    pub fn isCycleStart(self: *const Self) bool {
+        return self.cycleIterations() == 1;
+    }
+
+    pub fn isCycleEnd(self: *const Self) bool {
+        return self.current_iteration > 0.0 and self.cycleIterations() == self.pixel_stride * self.pixel_stride;
+    }
+
+    // Iterations until the first cycle end at least min_iterations away, the GPU backends
+    // read the render stats after them so the stats cover every pixel.
+    pub fn iterationsToCycleEnd(self: *const Self, min_iterations: u32) u32 {
+        const cycle = self.pixel_stride * self.pixel_stride;
+        var iterations = cycle - self.cycleIterations() % cycle;
+        while (iterations < min_iterations) iterations += cycle;
+        return iterations;
+    }
+
+    // Pixels traced since the start of the current cycle, the render stats count them.
+    pub fn cyclePixelCount(self: *const Self) u32 {
+        const stride = self.pixel_stride;
+        var count: u32 = 0;
+        var offset: u32 = 0;
+        while (offset < self.cycleIterations()) : (offset += 1) {
+            const width = (self.resolution.width -| offset % stride + stride - 1) / stride;
+            const height = (self.resolution.height -| offset / stride + stride - 1) / stride;
+            count += width * height;
+        }
+        return count;
+    }
+
+    // The denoiser reads every pixel, so it waits until all of them were traced.
+    pub fn isDenoised(self: *const Self) bool {
+        return self.denoise and !self.hasUntracedPixels();
+    }
+
+    // Continues the accumulation of a checkpoint, all its pixels have been traced already.
+    pub fn restore(self: *Self, current_iteration: f32) void {
+        self.current_iteration = current_iteration;
+        self.pixel_stride = 1;
+    }
+
     pub fn reset(self: *Self) void {
         self.current_iteration = 0.0;
+        self.pixel_stride = if (self.dynamic_resolution) self.dynamic_resolution_stride else 1;
     }
 };
@@ -42,4 +42,24 @@ pub const Texture = struct {
     pub fn deinit(self: *Self) void {
         self.data.deinit();
     }
+
+    // Linear rgb value of the texel, single component textures are treated as grey.
+    pub fn getRgb(self: *const Self, x: u32, y: u32) [3]f32 {
+        var rgb = [3]f32{ 0.0, 0.0, 0.0 };
+        const offset = y * self.bytes_per_row + x * self.num_components * self.bytes_per_component;
+        for (&rgb, 0..) |*c, i| {
+            const component: u32 = @truncate(@min(i, self.num_components - 1));
+            const bytes = self.data.items[offset + component * self.bytes_per_component ..];
+            c.* = switch (self.bytes_per_component) {
+                1 => std.math.pow(f32, @as(f32, @floatFromInt(bytes[0])) / 255.0, self.gamma),
+                2 => if (self.is_hdr)
+                    @as(f32, @floatCast(@as(f16, @bitCast(std.mem.readIntLittle(u16, bytes[0..2])))))
+                else
+                    std.math.pow(f32, @as(f32, @floatFromInt(std.mem.readIntLittle(u16, bytes[0..2]))) / 65535.0, self.gamma),
+                4 => @as(f32, @bitCast(std.mem.readIntLittle(u32, bytes[0..4]))),
+                else => unreachable,
+            };
+        }
+        return rgb;
+    }
 };
@@ -0,0 +1,233 @@
+const std = @import("std");
+const util = @import("util.zig");
+
+pub const TILE_SIZE: u32 = 32;
+
+pub const Tile = struct {
+    x0: u32,
+    y0: u32,
+    x1: u32,
+    y1: u32,
+};
+
+// Splits the image into TILE_SIZE tiles ordered along the Morton curve.
+pub fn mortonTiles(allocator: std.mem.Allocator, resolution: util.Resolution) ![]Tile {
+    const tiles_x = (resolution.width + TILE_SIZE - 1) / TILE_SIZE;
+    const tiles_y = (resolution.height + TILE_SIZE - 1) / TILE_SIZE;
+    var tiles = try allocator.alloc(Tile, tiles_x * tiles_y);
+
+    var i: usize = 0;
+    var ty: u32 = 0;
+    while (ty < tiles_y) : (ty += 1) {
+        var tx: u32 = 0;
+        while (tx < tiles_x) : (tx += 1) {
+            tiles[i] = .{
+                .x0 = tx * TILE_SIZE,
+                .y0 = ty * TILE_SIZE,
+                .x1 = @min((tx + 1) * TILE_SIZE, resolution.width),
+                .y1 = @min((ty + 1) * TILE_SIZE, resolution.height),
+            };
+            i += 1;
+        }
+    }
+    std.sort.heap(Tile, tiles, {}, mortonCompare);
+    return tiles;
+}
+
+fn mortonCompare(_: void, a: Tile, b: Tile) bool {
+    return mortonCode(a.x0 / TILE_SIZE, a.y0 / TILE_SIZE) < mortonCode(b.x0 / TILE_SIZE, b.y0 / TILE_SIZE);
+}
+
+fn mortonCode(x: u32, y: u32) u64 {
+    return spreadBits(x) | (spreadBits(y) << 1);
+}
+
+// Inserts a zero bit after each of the 32 bits.
+fn spreadBits(value: u32) u64 {
+    var x: u64 = value;
+    x = (x | (x << 16)) & 0x0000ffff0000ffff;
+    x = (x | (x << 8)) & 0x00ff00ff00ff00ff;
+    x = (x | (x << 4)) & 0x0f0f0f0f0f0f0f0f;
+    x = (x | (x << 2)) & 0x3333333333333333;
+    x = (x | (x << 1)) & 0x5555555555555555;
+    return x;
+}
+
+// Runs a job over tiles of the image on a persistent pool of workers.
+// Tiles are ordered along the Morton curve (see mortonTiles) and every worker starts with a contiguous run of them,
+// which keeps neighbouring pixels (and the bvh nodes they touch) on one core.
+// A worker that runs out of tiles steals from the back of the other deques, so cheap regions
+// like the sky don't leave cores idle while others are still tracing glass.
+pub const TileScheduler = struct {
+    const Self = @This();
+    const JobFn = *const fn (*const anyopaque, usize, Tile) void;
+
+    const Deque = struct {
+        mutex: std.Thread.Mutex = .{},
+        // the owner pops from head, thieves take from tail
+        head: usize = 0,
+        tail: usize = 0,
+        // keeps the deques of the workers on separate cache lines
+        _padding: [64]u8 = undefined,
+    };
+
+    allocator: std.mem.Allocator,
+    // tiles of the running job
+    tiles: []const Tile,
+    deques: []Deque,
+    threads: []std.Thread,
+
+    mutex: std.Thread.Mutex,
+    job_started: std.Thread.Condition,
+    job_finished: std.Thread.Condition,
+    // incremented for every job, workers wait for it to change
+    generation: u64,
+    busy_workers: u32,
+    shutdown: bool,
+    job: JobFn,
+    job_context: *const anyopaque,
+
+    // Workers are spawned for every cpu but one, the thread calling run works as the first worker.
+    pub fn init(allocator: std.mem.Allocator) !*Self {
+        const cpu_count = std.Thread.getCpuCount() catch 1;
+        const workers_count = @max(cpu_count, 1);
+
+        var self = try allocator.create(Self);
+        errdefer allocator.destroy(self);
+        self.* = .{
+            .allocator = allocator,
+            .tiles = &.{},
+            .deques = try allocator.alloc(Deque, workers_count),
+            .threads = &.{},
+            .mutex = .{},
+            .job_started = .{},
+            .job_finished = .{},
+            .generation = 0,
+            .busy_workers = 0,
+            .shutdown = false,
+            .job = undefined,
+            .job_context = undefined,
+        };
+        errdefer allocator.free(self.deques);
+        for (self.deques) |*deque| deque.* = .{};
+
+        self.threads = try allocator.alloc(std.Thread, workers_count - 1);
+        var spawned: usize = 0;
+        errdefer {
+            self.stopThreads(spawned);
+            allocator.free(self.threads);
+        }
+        while (spawned < self.threads.len) : (spawned += 1) {
+            self.threads[spawned] = try std.Thread.spawn(.{}, workerMain, .{ self, spawned + 1 });
+        }
+        return self;
+    }
+
+    pub fn deinit(self: *Self) void {
+        self.stopThreads(self.threads.len);
+        self.allocator.free(self.threads);
+        self.allocator.free(self.deques);
+        self.allocator.destroy(self);
+    }
+
+    pub fn getWorkersCount(self: *const Self) u32 {
+        return @truncate(self.deques.len);
+    }
+
+    // Calls job(context, worker_id, tile) for every one of tiles and returns when all of them are done.
+    // worker_id is below getWorkersCount, so jobs can keep per worker scratch memory.
+    pub fn run(self: *Self, tiles: []const Tile, context: anytype, comptime job: fn (@TypeOf(context), usize, Tile) void) void {
+        const Context = @TypeOf(context);
+        const Wrapper = struct {
+            fn call(ptr: *const anyopaque, worker_id: usize, tile: Tile) void {
+                job(@as(*const Context, @ptrCast(@alignCast(ptr))).*, worker_id, tile);
+            }
+        };
+        self.runErased(tiles, @ptrCast(&context), Wrapper.call);
+    }
+
+    fn runErased(self: *Self, tiles: []const Tile, context: *const anyopaque, job: JobFn) void {
+        if (tiles.len == 0) return;
+
+        self.mutex.lock();
+        self.tiles = tiles;
+        const workers_count = self.deques.len;
+        for (self.deques, 0..) |*deque, worker_id| {
+            deque.head = self.tiles.len * worker_id / workers_count;
+            deque.tail = self.tiles.len * (worker_id + 1) / workers_count;
+        }
+        self.job = job;
+        self.job_context = context;
+        self.generation += 1;
+        self.busy_workers = @truncate(self.threads.len);
+        self.job_started.broadcast();
+        self.mutex.unlock();
+
+        self.work(0, context, job);
+
+        self.mutex.lock();
+        while (self.busy_workers > 0) self.job_finished.wait(&self.mutex);
+        self.mutex.unlock();
+    }
+
+    fn workerMain(self: *Self, worker_id: usize) void {
+        var generation: u64 = 0;
+        while (true) {
+            self.mutex.lock();
+            while (self.generation == generation and !self.shutdown) self.job_started.wait(&self.mutex);
+            if (self.shutdown) {
+                self.mutex.unlock();
+                return;
+            }
+            generation = self.generation;
+            const job = self.job;
+            const context = self.job_context;
+            self.mutex.unlock();
+
+            self.work(worker_id, context, job);
+
+            self.mutex.lock();
+            self.busy_workers -= 1;
+            if (self.busy_workers == 0) self.job_finished.signal();
+            self.mutex.unlock();
+        }
+    }
+
+    fn work(self: *Self, worker_id: usize, context: *const anyopaque, job: JobFn) void {
+        while (self.popOwn(worker_id) orelse self.steal(worker_id)) |tile| {
+            job(context, worker_id, tile);
+        }
+    }
+
+    fn popOwn(self: *Self, worker_id: usize) ?Tile {
+        const deque = &self.deques[worker_id];
+        deque.mutex.lock();
+        defer deque.mutex.unlock();
+        if (deque.head == deque.tail) return null;
+        deque.head += 1;
+        return self.tiles[deque.head - 1];
+    }
+
+    // Tiles are never pushed back, so a single pass over the other deques finding them empty means the job is done.
+    fn steal(self: *Self, worker_id: usize) ?Tile {
+        var i: usize = 1;
+        while (i < self.deques.len) : (i += 1) {
+            const deque = &self.deques[(worker_id + i) % self.deques.len];
+            deque.mutex.lock();
+            defer deque.mutex.unlock();
+            if (deque.head < deque.tail) {
+                deque.tail -= 1;
+                return self.tiles[deque.tail];
+            }
+        }
+        return null;
+    }
+
+    fn stopThreads(self: *Self, spawned: usize) void {
+        self.mutex.lock();
+        self.shutdown = true;
+        self.job_started.broadcast();
+        self.mutex.unlock();
+        for (self.threads[0..spawned]) |thread| thread.join();
+    }
+};
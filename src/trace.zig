@@ -0,0 +1,115 @@
+const std = @import("std");
+const options = @import("ornament_options");
+
+// Timing of the phases of the path tracers, built with -Dtrace=true.
+//     const span = trace.begin("Bvh.init");
+//     defer span.end();
+// Every thread records its spans into its own ring buffer, the oldest spans are overwritten once it is full.
+// The spans are exported in the Chrome trace event format, which chrome://tracing and ui.perfetto.dev open.
+// Without the option Span is empty and the calls compile to nothing.
+// The spans of the GPU backends measure the host side, kernel launches return before the kernels finish.
+
+pub const enabled = options.trace;
+
+const RING_CAPACITY = 1 << 16;
+
+const Event = struct {
+    name: []const u8,
+    start_ns: u64,
+    duration_ns: u64,
+};
+
+const Ring = struct {
+    thread_id: std.Thread.Id,
+    // number of the recorded events, the next one goes to events[count % RING_CAPACITY]
+    count: usize,
+    events: [RING_CAPACITY]Event,
+};
+
+// the rings live until the process exits, the threads keep pointers to them
+var rings_mutex = std.Thread.Mutex{};
+var rings = std.ArrayListUnmanaged(*Ring){};
+var epoch: std.time.Instant = undefined;
+threadlocal var thread_ring: ?*Ring = null;
+
+pub const Span = if (enabled) struct {
+    name: []const u8,
+    start: ?std.time.Instant,
+
+    pub fn end(self: Span) void {
+        const start = self.start orelse return;
+        const now = std.time.Instant.now() catch return;
+        const ring = thread_ring orelse return;
+        const count = @atomicLoad(usize, &ring.count, .Monotonic);
+        ring.events[count % RING_CAPACITY] = .{
+            .name = self.name,
+            .start_ns = start.since(epoch),
+            .duration_ns = now.since(start),
+        };
+        // the event is written before export sees the new count
+        @atomicStore(usize, &ring.count, count + 1, .Release);
+    }
+} else struct {
+    pub inline fn end(_: Span) void {}
+};
+
+pub inline fn begin(comptime name: []const u8) Span {
+    if (!enabled) return .{};
+    // no ring, no span, the path tracer keeps running when its allocation fails
+    if (thread_ring == null) thread_ring = createRing() catch null;
+    return .{ .name = name, .start = if (thread_ring != null) std.time.Instant.now() catch null else null };
+}
+
+fn createRing() !*Ring {
+    rings_mutex.lock();
+    defer rings_mutex.unlock();
+    if (rings.items.len == 0) epoch = try std.time.Instant.now();
+    try rings.ensureUnusedCapacity(std.heap.page_allocator, 1);
+    const ring = try std.heap.page_allocator.create(Ring);
+    ring.thread_id = std.Thread.getCurrentId();
+    ring.count = 0;
+    rings.appendAssumeCapacity(ring);
+    return ring;
+}
+
+// Drops the recorded spans of all threads, the threads must not record while it runs.
+pub fn reset() void {
+    rings_mutex.lock();
+    defer rings_mutex.unlock();
+    for (rings.items) |ring| @atomicStore(usize, &ring.count, 0, .Release);
+}
+
+// Spans which are still recorded while it runs may be torn, export after the render finished.
+pub fn writeChromeTrace(writer: anytype) !void {
+    try writer.writeAll("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    if (enabled) {
+        rings_mutex.lock();
+        defer rings_mutex.unlock();
+        var first = true;
+        for (rings.items) |ring| {
+            const count = @atomicLoad(usize, &ring.count, .Acquire);
+            var i = count -| RING_CAPACITY;
+            while (i < count) : (i += 1) {
+                const event = ring.events[i % RING_CAPACITY];
+                if (!first) try writer.writeByte(',');
+                first = false;
+                // complete events, the timestamps are in microseconds
+                try writer.print("\n{{\"name\":\"{s}\",\"cat\":\"ornament\",\"ph\":\"X\",\"pid\":0,\"tid\":{d},\"ts\":{d:.3},\"dur\":{d:.3}}}", .{
+                    event.name,
+                    ring.thread_id,
+                    @as(f64, @floatFromInt(event.start_ns)) / std.time.ns_per_us,
+                    @as(f64, @floatFromInt(event.duration_ns)) / std.time.ns_per_us,
+                });
+            }
+        }
+    }
+    try writer.writeAll("\n]}\n");
+}
+
+pub fn saveChromeTrace(path: []const u8) !void {
+    var file = try std.fs.cwd().createFile(path, .{});
+    defer file.close();
+    var buffered = std.io.bufferedWriter(file.writer());
+    try writeChromeTrace(buffered.writer());
+    try buffered.flush();
+}
@@ -9,3 +9,235 @@ pub const Resolution = struct {
         return self.width * self.height;
     }
 };
+
+// Least iterations between reads of the render stats in render and renderFor, the reads also wait
+// for the end of a stride cycle and wait for the queued iterations of the GPU backends to finish.
+pub const CONVERGENCE_CHECK_INTERVAL: u32 = 4;
+
+pub const RenderProgress = struct {
+    // samples per pixel accumulated since the last reset
+    samples: u32,
+    // iterations rendered by the call
+    iterations: u32,
+    // mean relative error of the pixels traced in the current stride cycle, see gpu_structs.RenderStats
+    estimated_error: f32,
+    // the call stopped early because of a cancel
+    cancelled: bool,
+};
+
+// Counter of cancel requests, may be used from any thread.
+// A render remembers the generation it started with and stops at its next cancellation point once it changed.
+pub const Cancellation = struct {
+    generation: u64 = 0,
+
+    pub fn cancel(self: *Cancellation) void {
+        _ = @atomicRmw(u64, &self.generation, .Add, 1, .Release);
+    }
+
+    pub fn getGeneration(self: *const Cancellation) u64 {
+        return @atomicLoad(u64, &self.generation, .Acquire);
+    }
+
+    pub fn isCancelled(self: *const Cancellation, generation: u64) bool {
+        return self.getGeneration() != generation;
+    }
+};
+
+// Bytes held by a path tracer, see memoryReport of the backends.
+// The backend buffers are device memory for HIP and WGPU and host memory for the CPU backend.
+pub const MemoryReport = struct {
+    scene: SceneMemory,
+    bvh: BvhMemory,
+    // copies of the bvh arrays, materials and lights
+    scene_buffers: [SCENE_BUFFER_NAMES.len]BufferMemory,
+    textures_bytes: usize,
+    // buffers of the current resolution, 0 until the first render
+    target_bytes: usize,
+    // host buffers of the denoiser in all backends, 0 until the first denoised frame
+    denoiser_bytes: usize,
+
+    pub fn sceneBuffersBytes(self: *const MemoryReport) usize {
+        var bytes: usize = 0;
+        for (self.scene_buffers) |buffer| bytes += buffer.bytes;
+        return bytes;
+    }
+
+    pub fn backendBytes(self: *const MemoryReport) usize {
+        return self.sceneBuffersBytes() + self.textures_bytes + self.target_bytes;
+    }
+};
+
+pub const BufferMemory = struct {
+    name: []const u8,
+    bytes: usize,
+};
+
+// Scene arrays copied to the backends, the fields of the path tracers are named so, with a suffix in WGPU.
+pub const SCENE_BUFFER_NAMES = [_][]const u8{ "materials", "normals", "normal_indices", "uvs", "uv_indices", "transforms", "tlas_nodes", "blas_nodes", "light_nodes", "lights", "environment_alias_table" };
+
+// memoryReport of the backends, the scene buffers of path_tracer have a bytes method
+// and the textures, the target buffer and the denoiser a memoryBytes method.
+pub fn memoryReport(path_tracer: anytype, comptime buffer_suffix: []const u8) MemoryReport {
+    var scene_buffers: [SCENE_BUFFER_NAMES.len]BufferMemory = undefined;
+    inline for (SCENE_BUFFER_NAMES, 0..) |name, i| {
+        scene_buffers[i] = .{ .name = name, .bytes = @field(path_tracer, name ++ buffer_suffix).bytes() };
+    }
+    return .{
+        .scene = path_tracer.scene.memoryUsage(),
+        .bvh = path_tracer.bvh_memory,
+        .scene_buffers = scene_buffers,
+        .textures_bytes = path_tracer.textures.memoryBytes(),
+        .target_bytes = if (path_tracer.target_buffer) |*tb| tb.memoryBytes() else 0,
+        .denoiser_bytes = path_tracer.denoiser.memoryBytes(),
+    };
+}
+
+pub const SceneMemory = struct {
+    // vertices, normals, uvs and their indices
+    meshes_bytes: usize = 0,
+    // texels as they were loaded
+    textures_bytes: usize = 0,
+    // spheres, mesh instances, materials and the lists of the scene
+    objects_bytes: usize = 0,
+
+    pub fn total(self: *const SceneMemory) usize {
+        return self.meshes_bytes + self.textures_bytes + self.objects_bytes;
+    }
+};
+
+// The bvh is built at init and freed once its arrays are copied to the backend.
+pub const BvhMemory = struct {
+    // host arrays of the built bvh
+    bytes: usize = 0,
+    // peak of the bytes allocated while it was built
+    build_peak_bytes: usize = 0,
+};
+
+// Bytes allocated by the std.ArrayList fields of value.
+pub fn arrayListsBytes(value: anytype) usize {
+    var bytes: usize = 0;
+    inline for (@typeInfo(@TypeOf(value)).Struct.fields) |field| {
+        if (@typeInfo(field.type) == .Struct and @hasField(field.type, "items") and @hasField(field.type, "capacity")) {
+            const list = @field(value, field.name);
+            bytes += list.capacity * @sizeOf(std.meta.Elem(@TypeOf(list.items)));
+        }
+    }
+    return bytes;
+}
+
+// Pixel format of the frame buffer written by the post processing.
+// rgba8_srgb is sRGB encoded instead of the gamma of the state.
+pub const OutputFormat = enum(u32) {
+    rgba32f = 0,
+    rgba8_srgb = 1,
+    rgba16f = 2,
+    rgb10a2 = 3,
+
+    pub fn bytesPerPixel(self: OutputFormat) u32 {
+        return switch (self) {
+            .rgba32f => 16,
+            .rgba16f => 8,
+            .rgba8_srgb, .rgb10a2 => 4,
+        };
+    }
+
+    // Expands packed pixels to rgba floats, the values keep the gamma or sRGB encoding.
+    pub fn decode(self: OutputFormat, src: []const u8, dst: [][4]f32) void {
+        if (self == .rgba32f) {
+            @memcpy(std.mem.sliceAsBytes(dst), src[0 .. dst.len * @sizeOf([4]f32)]);
+            return;
+        }
+        for (dst, 0..) |*pixel, i| {
+            const bytes = src[i * self.bytesPerPixel() ..];
+            switch (self) {
+                .rgba32f => unreachable,
+                .rgba8_srgb => for (pixel, 0..) |*c, j| {
+                    c.* = @as(f32, @floatFromInt(bytes[j])) / 255.0;
+                },
+                .rgba16f => for (pixel, 0..) |*c, j| {
+                    c.* = @floatCast(@as(f16, @bitCast(std.mem.readIntLittle(u16, bytes[2 * j ..][0..2]))));
+                },
+                .rgb10a2 => {
+                    const value = std.mem.readIntLittle(u32, bytes[0..4]);
+                    for (pixel[0..3], 0..) |*c, j| {
+                        c.* = @as(f32, @floatFromInt((value >> @intCast(10 * j)) & 0x3ff)) / 1023.0;
+                    }
+                    pixel[3] = @as(f32, @floatFromInt(value >> 30)) / 3.0;
+                },
+            }
+        }
+    }
+};
+
+// Layout of the accumulation buffers, the values match ACCUMULATION_FORMAT_* of accumulation.hip.h.
+// rgb15e5 packs the running mean as shared exponent rgb and the samples count as a 14 bit integer
+// into 8 bytes, half of the memory of rgba32f. Layout of the little endian u64 from the low bits:
+// 15 bit mantissas of r, g and b, 5 bit exponent, samples count.
+pub const AccumulationFormat = enum(u32) {
+    rgba32f = 0,
+    rgb15e5 = 1,
+
+    const MANTISSA_BITS = 15;
+    const EXPONENT_BIAS = 15;
+    const MAX_VALUE: f32 = 65534.0;
+    const MAX_COUNT = (1 << 14) - 1;
+
+    pub fn bytesPerPixel(self: AccumulationFormat) u32 {
+        return switch (self) {
+            .rgba32f => 16,
+            .rgb15e5 => 8,
+        };
+    }
+
+    // Expands the pixels to sums of the samples with the samples count in w, like the kernels load them.
+    pub fn decode(self: AccumulationFormat, src: []const u8, dst: [][4]f32) void {
+        if (self == .rgba32f) {
+            @memcpy(std.mem.sliceAsBytes(dst), src[0 .. dst.len * @sizeOf([4]f32)]);
+            return;
+        }
+        for (dst, 0..) |*pixel, i| {
+            const bytes = src[i * self.bytesPerPixel() ..];
+            const rgb15e5 = std.mem.readIntLittle(u64, bytes[0..8]);
+            const count: f32 = @floatFromInt(rgb15e5 >> 50);
+            const exponent = @as(i32, @intCast((rgb15e5 >> 45) & 0x1f)) - EXPONENT_BIAS - MANTISSA_BITS;
+            const scale = std.math.pow(f32, 2.0, @floatFromInt(exponent));
+            for (pixel[0..3], 0..) |*c, j| {
+                c.* = @as(f32, @floatFromInt((rgb15e5 >> @intCast(MANTISSA_BITS * j)) & 0x7fff)) * scale * count;
+            }
+            pixel[3] = count;
+        }
+    }
+
+    // Inverse of decode, the means are rounded to nearest so host round trips are deterministic.
+    pub fn encode(self: AccumulationFormat, src: []const [4]f32, dst: []u8) void {
+        if (self == .rgba32f) {
+            @memcpy(dst[0 .. src.len * @sizeOf([4]f32)], std.mem.sliceAsBytes(src));
+            return;
+        }
+        for (src, 0..) |pixel, i| {
+            const bytes = dst[i * self.bytesPerPixel() ..];
+            const inverted_count = if (pixel[3] > 0.0) 1.0 / pixel[3] else 0.0;
+            var mean: [3]f32 = undefined;
+            for (&mean, 0..) |*c, j| c.* = std.math.clamp(pixel[j] * inverted_count, 0.0, MAX_VALUE);
+            const count: u64 = @intFromFloat(std.math.clamp(pixel[3] + 0.5, 0.0, MAX_COUNT));
+            std.mem.writeIntLittle(u64, bytes[0..8], encodeRgb15e5(mean) | count << 50);
+        }
+    }
+
+    fn encodeRgb15e5(rgb: [3]f32) u64 {
+        const max_c = @max(rgb[0], @max(rgb[1], rgb[2]));
+        if (!(max_c > 0.0)) return 0;
+        var exponent = @max(-EXPONENT_BIAS - 1, @as(i32, @intFromFloat(@floor(std.math.log2(max_c))))) + 1 + EXPONENT_BIAS;
+        var scale = std.math.pow(f32, 2.0, @floatFromInt(EXPONENT_BIAS + MANTISSA_BITS - exponent));
+        if (@floor(max_c * scale + 0.5) >= 1 << MANTISSA_BITS) {
+            exponent += 1;
+            scale *= 0.5;
+        }
+        var result: u64 = @as(u64, @intCast(exponent)) << 45;
+        for (rgb, 0..) |c, j| {
+            const mantissa: u64 = @min(@as(u64, @intFromFloat(c * scale + 0.5)), (1 << MANTISSA_BITS) - 1);
+            result |= mantissa << @intCast(MANTISSA_BITS * j);
+        }
+        return result;
+    }
+};
@@ -5,34 +5,71 @@ const wgpu = @import("wgpu.zig");
 const util = @import("../util.zig");
 const gpu_structs = @import("../gpu_structs.zig");
 const WgpuError = @import("device_state.zig").WgpuError;
+const Denoiser = @import("../denoiser.zig").Denoiser;
+const Checkpoint = @import("../checkpoint.zig").Checkpoint;
 
 pub const WORKGROUP_SIZE: u32 = 256;
 
 pub const Target = struct {
     const Self = @This();
+    allocator: std.mem.Allocator,
     buffer: Storage(gpu_structs.Vector4),
     accumulation_buffer: Storage(gpu_structs.Vector4),
+    second_moment_buffer: Storage(f32),
+    albedo_buffer: Storage(gpu_structs.Vector4),
+    normal_buffer: Storage(gpu_structs.Vector4),
+    denoised_buffer: Storage(gpu_structs.Vector4),
+    position_buffer: Storage(gpu_structs.Vector4),
+    history_accumulation_buffer: Storage(gpu_structs.Vector4),
+    history_second_moment_buffer: Storage(f32),
+    history_position_buffer: Storage(gpu_structs.Vector4),
     rng_state_buffer: Storage(u32),
+    render_stats_buffer: Storage(gpu_structs.RenderStats),
     map_buffer: webgpu.Buffer,
+    render_stats_map_buffer: webgpu.Buffer,
+    // host copy of a packed frame buffer which getFrameBuffer decodes, empty for rgba32f
+    staging: []u8,
     resolution: util.Resolution,
+    output_format: util.OutputFormat,
     workgroups: u32,
 
-    pub fn init(allocator: std.mem.Allocator, device: webgpu.Device, resolution: util.Resolution) !Self {
+    pub fn init(allocator: std.mem.Allocator, device: webgpu.Device, resolution: util.Resolution, output_format: util.OutputFormat) !Self {
         const pixels_count = resolution.pixel_count();
-        const buffer = Storage(gpu_structs.Vector4).init(device, true, .{ .element_count = pixels_count });
-        const accumulation_buffer = Storage(gpu_structs.Vector4).init(device, false, .{ .element_count = pixels_count });
+        // the shader writes the pixels of output_format as u32 words, Vector4 elements keep the viewport binding of rgba32f
+        const buffer = Storage(gpu_structs.Vector4).init(device, true, .{
+            .element_count = (pixels_count * output_format.bytesPerPixel() + @sizeOf(gpu_structs.Vector4) - 1) / @sizeOf(gpu_structs.Vector4),
+        });
+        // copyable for the denoiser readback
+        const accumulation_buffer = Storage(gpu_structs.Vector4).init(device, true, .{ .element_count = pixels_count });
+        const second_moment_buffer = Storage(f32).init(device, true, .{ .element_count = pixels_count });
+        const albedo_buffer = Storage(gpu_structs.Vector4).init(device, true, .{ .element_count = pixels_count });
+        const normal_buffer = Storage(gpu_structs.Vector4).init(device, true, .{ .element_count = pixels_count });
+        const denoised_buffer = Storage(gpu_structs.Vector4).init(device, true, .{ .element_count = pixels_count });
+        const position_buffer = Storage(gpu_structs.Vector4).init(device, true, .{ .element_count = pixels_count });
+        const history_accumulation_buffer = Storage(gpu_structs.Vector4).init(device, true, .{ .element_count = pixels_count });
+        const history_second_moment_buffer = Storage(f32).init(device, true, .{ .element_count = pixels_count });
+        const history_position_buffer = Storage(gpu_structs.Vector4).init(device, true, .{ .element_count = pixels_count });
+        const render_stats_buffer = Storage(gpu_structs.RenderStats).init(device, true, .{ .data = &.{.{}} });
 
         var rng_seed = try allocator.alloc(u32, pixels_count);
         defer allocator.free(rng_seed);
         for (rng_seed, 0..) |*value, index| {
             value.* = @truncate(index);
         }
-        const rng_state_buffer = Storage(u32).init(device, false, .{ .data = rng_seed });
+        // copyable for checkpoints
+        const rng_state_buffer = Storage(u32).init(device, true, .{ .data = rng_seed });
+        var staging: []u8 = &.{};
+        if (output_format != .rgba32f) staging = try allocator.alloc(u8, pixels_count * output_format.bytesPerPixel());
 
         const map_buffer = device.createBuffer(.{
             .label = "[ornament] []" ++ @typeName(gpu_structs.Vector4) ++ " map buffer",
             .usage = .{ .map_read = true, .copy_dst = true },
-            .size = buffer.padded_size_in_bytes,
+            .size = accumulation_buffer.padded_size_in_bytes,
+        });
+        const render_stats_map_buffer = device.createBuffer(.{
+            .label = "[ornament] " ++ @typeName(gpu_structs.RenderStats) ++ " map buffer",
+            .usage = .{ .map_read = true, .copy_dst = true },
+            .size = render_stats_buffer.padded_size_in_bytes,
         });
 
         var workgroups = pixels_count / WORKGROUP_SIZE;
@@ -41,19 +78,52 @@ pub const Target = struct {
         }
 
         return .{
+            .allocator = allocator,
             .buffer = buffer,
             .accumulation_buffer = accumulation_buffer,
+            .second_moment_buffer = second_moment_buffer,
+            .albedo_buffer = albedo_buffer,
+            .normal_buffer = normal_buffer,
+            .denoised_buffer = denoised_buffer,
+            .position_buffer = position_buffer,
+            .history_accumulation_buffer = history_accumulation_buffer,
+            .history_second_moment_buffer = history_second_moment_buffer,
+            .history_position_buffer = history_position_buffer,
             .rng_state_buffer = rng_state_buffer,
+            .render_stats_buffer = render_stats_buffer,
             .map_buffer = map_buffer,
+            .render_stats_map_buffer = render_stats_map_buffer,
+            .staging = staging,
             .resolution = resolution,
+            .output_format = output_format,
             .workgroups = workgroups,
         };
     }
+    // Device bytes of the buffers, with the map buffers.
+    pub fn memoryBytes(self: *const Self) usize {
+        var bytes: usize = self.accumulation_buffer.padded_size_in_bytes + self.render_stats_buffer.padded_size_in_bytes;
+        inline for (@typeInfo(Self).Struct.fields) |field| {
+            if (@typeInfo(field.type) == .Struct and @hasField(field.type, "padded_size_in_bytes")) bytes += @field(self, field.name).padded_size_in_bytes;
+        }
+        return bytes;
+    }
+
     pub fn deinit(self: *Self) void {
         self.buffer.deinit();
         self.accumulation_buffer.deinit();
+        self.second_moment_buffer.deinit();
+        self.albedo_buffer.deinit();
+        self.normal_buffer.deinit();
+        self.denoised_buffer.deinit();
+        self.position_buffer.deinit();
+        self.history_accumulation_buffer.deinit();
+        self.history_second_moment_buffer.deinit();
+        self.history_position_buffer.deinit();
         self.rng_state_buffer.deinit();
+        self.render_stats_buffer.deinit();
         self.map_buffer.release();
+        self.render_stats_map_buffer.release();
+        self.allocator.free(self.staging);
     }
 
     pub fn layout(self: *const Self, binding_id: u32, visibility: webgpu.ShaderStage, read_only: bool) webgpu.BindGroupLayoutEntry {
@@ -64,12 +134,90 @@ pub const Target = struct {
         return self.buffer.binding(binding_id);
     }
 
-    pub fn getFrameBuffer(self: *const Self, device: webgpu.Device, queue: webgpu.Queue, dst: []gpu_structs.Vector4) !void {
+    // dst takes the pixels of output_format.
+    pub fn getFrameBuffer(self: *const Self, device: webgpu.Device, queue: webgpu.Queue, dst: []u8) !void {
+        try readBytes(device, queue, self.buffer.handle, self.buffer.padded_size_in_bytes, self.map_buffer, dst);
+    }
+
+    // Workgroups covering every pixel_stride-th pixel in both directions.
+    pub fn stridedWorkgroups(self: *const Self, pixel_stride: u32) u32 {
+        const width = (self.resolution.width + pixel_stride - 1) / pixel_stride;
+        const height = (self.resolution.height + pixel_stride - 1) / pixel_stride;
+        return (width * height + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+    }
+
+    pub fn resetRenderStats(self: *const Self, queue: webgpu.Queue) void {
+        self.render_stats_buffer.write(queue, &.{.{}});
+    }
+
+    pub fn resetCycleStats(self: *const Self, queue: webgpu.Queue) void {
+        const zeros = [_]u32{0} ** (gpu_structs.RenderStats.RAY_COUNT_OFFSET / @sizeOf(u32));
+        queue.writeBuffer(self.render_stats_buffer.handle, 0, u32, &zeros);
+    }
+
+    pub fn resetRayCount(self: *const Self, queue: webgpu.Queue) void {
+        const zeros = [_]u32{0} ** ((@sizeOf(gpu_structs.RenderStats) - gpu_structs.RenderStats.RAY_COUNT_OFFSET) / @sizeOf(u32));
+        queue.writeBuffer(self.render_stats_buffer.handle, gpu_structs.RenderStats.RAY_COUNT_OFFSET, u32, &zeros);
+    }
+
+    pub fn getRenderStats(self: *const Self, device: webgpu.Device, queue: webgpu.Queue) !gpu_structs.RenderStats {
+        var stats = [_]gpu_structs.RenderStats{.{}};
+        try readBuffer(gpu_structs.RenderStats, device, queue, &self.render_stats_buffer, self.render_stats_map_buffer, &stats);
+        return stats[0];
+    }
+
+    // Keeps the accumulation for the reprojection after a camera move.
+    pub fn saveHistory(self: *const Self, device: webgpu.Device, queue: webgpu.Queue) void {
+        const encoder = device.createCommandEncoder(.{ .label = "[ornament] save history command encoder" });
+        defer encoder.release();
+        encoder.copyBufferToBuffer(self.accumulation_buffer.handle, 0, self.history_accumulation_buffer.handle, 0, self.accumulation_buffer.padded_size_in_bytes);
+        encoder.copyBufferToBuffer(self.second_moment_buffer.handle, 0, self.history_second_moment_buffer.handle, 0, self.second_moment_buffer.padded_size_in_bytes);
+        encoder.copyBufferToBuffer(self.position_buffer.handle, 0, self.history_position_buffer.handle, 0, self.position_buffer.padded_size_in_bytes);
+
+        const command = encoder.finish(.{});
+        defer command.release();
+        queue.submit(&[_]webgpu.CommandBuffer{command});
+    }
+
+    // The map buffer fits a Vector4 per pixel, so it is reused for all the per pixel buffers.
+    pub fn readDenoiserInputs(self: *const Self, device: webgpu.Device, queue: webgpu.Queue, denoiser: *Denoiser) !void {
+        try readBuffer(gpu_structs.Vector4, device, queue, &self.accumulation_buffer, self.map_buffer, denoiser.accumulation);
+        try readBuffer(gpu_structs.Vector4, device, queue, &self.albedo_buffer, self.map_buffer, denoiser.albedo);
+        try readBuffer(gpu_structs.Vector4, device, queue, &self.normal_buffer, self.map_buffer, denoiser.normal);
+        try readBuffer(f32, device, queue, &self.second_moment_buffer, self.map_buffer, denoiser.second_moment);
+    }
+
+    pub fn writeDenoised(self: *const Self, queue: webgpu.Queue, src: []const gpu_structs.Vector4) void {
+        self.denoised_buffer.write(queue, src);
+    }
+
+    pub fn readCheckpoint(self: *const Self, device: webgpu.Device, queue: webgpu.Queue, checkpoint: *Checkpoint) !void {
+        try readBuffer(gpu_structs.Vector4, device, queue, &self.accumulation_buffer, self.map_buffer, checkpoint.accumulation);
+        try readBuffer(f32, device, queue, &self.second_moment_buffer, self.map_buffer, checkpoint.second_moment);
+        try readBuffer(gpu_structs.Vector4, device, queue, &self.albedo_buffer, self.map_buffer, checkpoint.albedo);
+        try readBuffer(gpu_structs.Vector4, device, queue, &self.normal_buffer, self.map_buffer, checkpoint.normal);
+        try readBuffer(u32, device, queue, &self.rng_state_buffer, self.map_buffer, checkpoint.rng_state);
+    }
+
+    pub fn writeCheckpoint(self: *const Self, queue: webgpu.Queue, checkpoint: *const Checkpoint) void {
+        self.accumulation_buffer.write(queue, checkpoint.accumulation);
+        self.second_moment_buffer.write(queue, checkpoint.second_moment);
+        self.albedo_buffer.write(queue, checkpoint.albedo);
+        self.normal_buffer.write(queue, checkpoint.normal);
+        self.rng_state_buffer.write(queue, checkpoint.rng_state);
+    }
+
+    fn readBuffer(comptime T: type, device: webgpu.Device, queue: webgpu.Queue, src_buffer: *const Storage(T), map_buffer: webgpu.Buffer, dst: []T) !void {
+        const bytes = std.mem.sliceAsBytes(dst);
+        try readBytes(device, queue, src_buffer.handle, src_buffer.padded_size_in_bytes, map_buffer, bytes[0..@min(bytes.len, src_buffer.count * @sizeOf(T))]);
+    }
+
+    fn readBytes(device: webgpu.Device, queue: webgpu.Queue, src_buffer: webgpu.Buffer, padded_size_in_bytes: u64, map_buffer: webgpu.Buffer, dst: []u8) !void {
         // copy to map buffer
         {
-            const encoder = device.createCommandEncoder(.{ .label = "[ornament] copy frame buffer command encoder" });
+            const encoder = device.createCommandEncoder(.{ .label = "[ornament] copy buffer command encoder" });
             defer encoder.release();
-            encoder.copyBufferToBuffer(self.buffer.handle, 0, self.map_buffer, 0, self.buffer.padded_size_in_bytes);
+            encoder.copyBufferToBuffer(src_buffer, 0, map_buffer, 0, padded_size_in_bytes);
 
             const command = encoder.finish(.{});
             defer command.release();
@@ -77,16 +225,16 @@ pub const Target = struct {
         }
 
         var response = MapResponse{};
-        self.map_buffer.mapAsync(.{ .read = true }, 0, self.buffer.padded_size_in_bytes, mappedCallback, @ptrCast(&response));
-        defer self.map_buffer.unmap();
+        map_buffer.mapAsync(.{ .read = true }, 0, padded_size_in_bytes, mappedCallback, @ptrCast(&response));
+        defer map_buffer.unmap();
 
         _ = wgpu.wgpuDevicePoll(device, true, null);
         if (response.status != .success) {
             return WgpuError.AdapterRequestFailed;
         }
 
-        if (self.map_buffer.getConstMappedRange(gpu_structs.Vector4, 0, self.buffer.count)) |src| {
-            std.mem.copy(gpu_structs.Vector4, dst, src);
+        if (map_buffer.getConstMappedRange(u8, 0, dst.len)) |src| {
+            @memcpy(dst, src);
         }
     }
 
@@ -173,6 +321,10 @@ pub fn Storage(comptime T: type) type {
         pub fn write(self: *const Self, queue: webgpu.Queue, data: []const T) void {
             queue.writeBuffer(self.handle, 0, T, data);
         }
+
+        pub fn bytes(self: *const Self) usize {
+            return self.padded_size_in_bytes;
+        }
     };
 }
 
@@ -227,6 +379,8 @@ pub const Textures = struct {
     texture_views: std.ArrayList(webgpu.TextureView),
     samplers: std.ArrayList(webgpu.Sampler),
     len: u32 = 0,
+    // texels of the textures, the formats keep the layout of the loaded data
+    bytes: usize = 0,
 
     pub fn init(allocator: std.mem.Allocator, textures: []const *ornament.Texture, device: webgpu.Device, queue: webgpu.Queue) !Self {
         var self = Self{
@@ -299,6 +453,7 @@ pub const Textures = struct {
         try self.texture_views.append(texture.createView(&.{}));
         try self.samplers.append(device.createSampler(.{}));
         self.len += 1;
+        self.bytes += ornament_texture.bytes_per_row * ornament_texture.height;
     }
 
     pub fn deinit(self: *Self) void {
@@ -313,6 +468,10 @@ pub const Textures = struct {
         self.len = 0;
     }
 
+    pub fn memoryBytes(self: *const Self) usize {
+        return self.bytes;
+    }
+
     fn imageInfoToTextureFormat(num_components: u32, bytes_per_component: u32, is_hdr: bool) webgpu.TextureFormat {
         std.debug.assert(num_components == 1 or num_components == 2 or num_components == 4);
         std.debug.assert(bytes_per_component == 1 or bytes_per_component == 2);
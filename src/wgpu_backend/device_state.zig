@@ -5,8 +5,13 @@ pub const WgpuError = error{
     AdapterRequestFailed,
     DeviceRequestFailed,
     MapFailed,
+    UnsupportedLimits,
+    UnsupportedAccumulationFormat,
 };
 
+// storage buffers of the bind groups 0 and 2 of the path tracer shader
+const MAX_STORAGE_BUFFERS_PER_SHADER_STAGE = 23;
+
 pub const DeviceState = struct {
     const Self = @This();
     instance: webgpu.Instance,
@@ -38,7 +43,8 @@ pub const DeviceState = struct {
         std.log.debug("[ornament] adapter type: {s}", .{@tagName(properties.adapter_type)});
         std.log.debug("[ornament] adapter backend type: {s}", .{@tagName(properties.backend_type)});
 
-        if (adapter.getLimits()) |limits| {
+        const supported_limits = adapter.getLimits();
+        if (supported_limits) |limits| {
             std.log.debug("[ornament] supported limit max_bind_groups: {any}", .{limits.limits.max_bind_groups});
             std.log.debug("[ornament] supported limit max_bindings_per_bind_group: {any}", .{limits.limits.max_bindings_per_bind_group});
             std.log.debug("[ornament] supported limit max_dynamic_uniform_buffers_per_pipeline_layout: {any}", .{limits.limits.max_dynamic_uniform_buffers_per_pipeline_layout});
@@ -75,10 +81,12 @@ pub const DeviceState = struct {
             @panic("Adapter doesn't support required features.");
         }
 
+        const required_limits: ?webgpu.RequiredLimits = if (supported_limits) |limits| .{ .limits = try requiredLimits(limits.limits) } else null;
         const device = try requestDevice(adapter, .{
             .label = "[ornament] wgpu device",
             .required_feature_count = required_features.len,
             .required_features = required_features.ptr,
+            .required_limits = if (required_limits) |*limits| @ptrCast(limits) else null,
         });
         device.setUncapturedErrorCallback(onUncapturedError, null);
 
@@ -91,6 +99,27 @@ pub const DeviceState = struct {
         };
     }
 
+    // The limits which are not raised stay undefined and get their default values.
+    // The path tracer binds more storage buffers than the default limit allows,
+    // and the scene textures are bound as arrays as large as the adapter supports.
+    fn requiredLimits(supported: webgpu.Limits) !webgpu.Limits {
+        var limits: webgpu.Limits = undefined;
+        inline for (@typeInfo(webgpu.Limits).Struct.fields) |field| {
+            @field(limits, field.name) = std.math.maxInt(field.type);
+        }
+        if (supported.max_storage_buffers_per_shader_stage < MAX_STORAGE_BUFFERS_PER_SHADER_STAGE) {
+            std.log.err("[ornament] adapter supports {d} storage buffers per shader stage, {d} are required", .{
+                supported.max_storage_buffers_per_shader_stage,
+                MAX_STORAGE_BUFFERS_PER_SHADER_STAGE,
+            });
+            return WgpuError.UnsupportedLimits;
+        }
+        limits.max_storage_buffers_per_shader_stage = MAX_STORAGE_BUFFERS_PER_SHADER_STAGE;
+        limits.max_sampled_textures_per_shader_stage = supported.max_sampled_textures_per_shader_stage;
+        limits.max_samplers_per_shader_stage = supported.max_samplers_per_shader_stage;
+        return limits;
+    }
+
     pub fn deinit(self: *Self) void {
         self.queue.release();
         self.device.release();
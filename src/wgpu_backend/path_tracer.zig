@@ -10,6 +10,11 @@ const util = @import("../util.zig");
 const Bvh = @import("../bvh.zig").Bvh;
 const State = @import("../state.zig").State;
 const Scene = @import("../scene.zig").Scene;
+const WgpuError = @import("device_state.zig").WgpuError;
+const Denoiser = @import("../denoiser.zig").Denoiser;
+const checkpoint = @import("../checkpoint.zig");
+const trace = @import("../trace.zig");
+const PeakAllocator = @import("../peak_allocator.zig").PeakAllocator;
 
 pub const PathTracer = struct {
     pub const Self = @This();
@@ -34,8 +39,23 @@ pub const PathTracer = struct {
     transforms_buffer: buffers.Storage(gpu_structs.Transform),
     tlas_nodes_buffer: buffers.Storage(gpu_structs.BvhNode),
     blas_nodes_buffer: buffers.Storage(gpu_structs.BvhNode),
+    light_nodes_buffer: buffers.Storage(gpu_structs.LightNode),
+    lights_buffer: buffers.Storage(gpu_structs.Light),
+    environment_alias_table_buffer: buffers.Storage(gpu_structs.AliasEntry),
+    environment_map: gpu_structs.EnvironmentMap,
+    // identifies the scene of checkpoints, see checkpoint.renderHash
+    scene_hash: u64,
+    bvh_memory: util.BvhMemory,
+    denoiser: Denoiser,
+    cancellation: util.Cancellation,
+    // camera of the last rendered iteration, null when there is no history to reproject
+    history_camera: ?gpu_structs.Camera,
+    // camera of the saved history while pixels take their first samples after a move
+    reprojection: ?gpu_structs.Camera,
 
     pub fn init(allocator: std.mem.Allocator, scene: ornament.Scene, surface_descriptor: ?webgpu.SurfaceDescriptor) !Self {
+        const span = trace.begin("wgpu.init");
+        defer span.end();
         const device_state = try DeviceState.init(
             allocator,
             &.{
@@ -45,15 +65,24 @@ pub const PathTracer = struct {
             surface_descriptor,
         );
 
+        var bvh_allocator = PeakAllocator.init(allocator);
+        var bvh = try Bvh.init(bvh_allocator.allocator(), &scene, false);
+        defer bvh.deinit();
+
         var state = State.init();
+        const upload = trace.begin("wgpu.upload");
         const constant_params_buffer = buffers.Uniform(gpu_structs.ConstantParams).init(
             device_state.device,
             false,
-            gpu_structs.ConstantParams.from(&scene.camera, &state, @truncate(scene.textures.items.len)),
+            gpu_structs.ConstantParams.from(
+                &scene.camera,
+                null,
+                &state,
+                @truncate(scene.textures.items.len),
+                @truncate(bvh.light_nodes.items.len),
+                bvh.environment_map,
+            ),
         );
-
-        var bvh = try Bvh.init(allocator, &scene, false);
-        defer bvh.deinit();
         const textures = try buffers.Textures.init(allocator, bvh.textures.items, device_state.device, device_state.queue);
 
         const materials_buffer = buffers.Storage(gpu_structs.Material).init(device_state.device, false, .{ .data = bvh.materials.items });
@@ -64,6 +93,10 @@ pub const PathTracer = struct {
         const uvs_buffer = buffers.Storage(gpu_structs.Uv).init(device_state.device, false, .{ .data = bvh.uvs.items });
         const uv_indices_buffer = buffers.Storage(u32).init(device_state.device, false, .{ .data = bvh.uv_indices.items });
         const transforms_buffer = buffers.Storage(gpu_structs.Transform).init(device_state.device, false, .{ .data = bvh.transforms.items });
+        const light_nodes_buffer = buffers.Storage(gpu_structs.LightNode).init(device_state.device, false, .{ .data = bvh.light_nodes.items });
+        const lights_buffer = buffers.Storage(gpu_structs.Light).init(device_state.device, false, .{ .data = bvh.lights.items });
+        const environment_alias_table_buffer = buffers.Storage(gpu_structs.AliasEntry).init(device_state.device, false, .{ .data = bvh.environment_alias_table.items });
+        upload.end();
 
         log("materials_buffer", bvh.materials.items.len, materials_buffer.padded_size_in_bytes);
         log("tlas_nodes_buffer", bvh.tlas_nodes.items.len, tlas_nodes_buffer.padded_size_in_bytes);
@@ -73,6 +106,9 @@ pub const PathTracer = struct {
         log("uvs_buffer", bvh.uvs.items.len, uvs_buffer.padded_size_in_bytes);
         log("uv_indices_buffer", bvh.uv_indices.items.len, uv_indices_buffer.padded_size_in_bytes);
         log("transforms_buffer", bvh.transforms.items.len, transforms_buffer.padded_size_in_bytes);
+        log("light_nodes_buffer", bvh.light_nodes.items.len, light_nodes_buffer.padded_size_in_bytes);
+        log("lights_buffer", bvh.lights.items.len, lights_buffer.padded_size_in_bytes);
+        log("environment_alias_table_buffer", bvh.environment_alias_table.items.len, environment_alias_table_buffer.padded_size_in_bytes);
         const bytes = materials_buffer.padded_size_in_bytes +
             tlas_nodes_buffer.padded_size_in_bytes +
             blas_nodes_buffer.padded_size_in_bytes +
@@ -80,7 +116,10 @@ pub const PathTracer = struct {
             normal_indices_buffer.padded_size_in_bytes +
             uvs_buffer.padded_size_in_bytes +
             uv_indices_buffer.padded_size_in_bytes +
-            transforms_buffer.padded_size_in_bytes;
+            transforms_buffer.padded_size_in_bytes +
+            light_nodes_buffer.padded_size_in_bytes +
+            lights_buffer.padded_size_in_bytes +
+            environment_alias_table_buffer.padded_size_in_bytes;
         std.log.debug("[ornament], all buff bytes = {d}, mb = {d}", .{ bytes, bytes / (1024 * 1024) });
 
         return .{
@@ -103,6 +142,16 @@ pub const PathTracer = struct {
             .transforms_buffer = transforms_buffer,
             .tlas_nodes_buffer = tlas_nodes_buffer,
             .blas_nodes_buffer = blas_nodes_buffer,
+            .light_nodes_buffer = light_nodes_buffer,
+            .lights_buffer = lights_buffer,
+            .environment_alias_table_buffer = environment_alias_table_buffer,
+            .environment_map = bvh.environment_map,
+            .scene_hash = checkpoint.sceneHash(&bvh),
+            .bvh_memory = .{ .bytes = bvh.memoryBytes(), .build_peak_bytes = bvh_allocator.getPeakBytes() },
+            .denoiser = Denoiser.init(allocator),
+            .cancellation = .{},
+            .history_camera = null,
+            .reprojection = null,
         };
     }
 
@@ -119,6 +168,10 @@ pub const PathTracer = struct {
         self.transforms_buffer.deinit();
         self.tlas_nodes_buffer.deinit();
         self.blas_nodes_buffer.deinit();
+        self.light_nodes_buffer.deinit();
+        self.lights_buffer.deinit();
+        self.environment_alias_table_buffer.deinit();
+        self.denoiser.deinit();
 
         self.constant_params_buffer.deinit();
         self.shader_module.release();
@@ -135,10 +188,14 @@ pub const PathTracer = struct {
         const code = @embedFile("shaders/pathtracer.wgsl") ++ "\n" ++
             @embedFile("shaders/bvh.wgsl") ++ "\n" ++
             @embedFile("shaders/camera.wgsl") ++ "\n" ++
+            @embedFile("shaders/dynamic_resolution.wgsl") ++ "\n" ++
+            @embedFile("shaders/environment_map.wgsl") ++ "\n" ++
             @embedFile("shaders/hitrecord.wgsl") ++ "\n" ++
+            @embedFile("shaders/lights.wgsl") ++ "\n" ++
             @embedFile("shaders/material.wgsl") ++ "\n" ++
             @embedFile("shaders/random.wgsl") ++ "\n" ++
             @embedFile("shaders/ray.wgsl") ++ "\n" ++
+            @embedFile("shaders/reprojection.wgsl") ++ "\n" ++
             @embedFile("shaders/states.wgsl") ++ "\n" ++
             @embedFile("shaders/transform.wgsl") ++ "\n" ++
             @embedFile("shaders/utility.wgsl");
@@ -153,19 +210,36 @@ pub const PathTracer = struct {
         });
     }
 
-    fn getWorkGroups(self: *Self) !u32 {
+    fn getWorkGroups(self: *Self, pixel_stride: u32) !u32 {
         const target = try self.getOrCreateTargetBuffer();
-        return target.workgroups;
+        return target.stridedWorkgroups(pixel_stride);
     }
 
+    // Pixels of packed output formats are expanded to floats, see getFrameBufferBytes to read them as they are.
     pub fn getFrameBuffer(self: *Self, dst: []gpu_structs.Vector4) !void {
+        const span = trace.begin("wgpu.getFrameBuffer");
+        defer span.end();
+        const tb = try self.getOrCreateTargetBuffer();
+        const output_format = tb.output_format;
+        if (output_format == .rgba32f) return self.getFrameBufferBytes(std.mem.sliceAsBytes(dst));
+        const bytes = tb.staging[0 .. dst.len * output_format.bytesPerPixel()];
+        try self.getFrameBufferBytes(bytes);
+        output_format.decode(bytes, dst);
+    }
+
+    // dst takes pixel_count * bytesPerPixel of the output format.
+    pub fn getFrameBufferBytes(self: *Self, dst: []u8) !void {
+        const span = trace.begin("wgpu.getFrameBufferBytes");
+        defer span.end();
         const tb = try self.getOrCreateTargetBuffer();
         try tb.getFrameBuffer(self.device_state.device, self.device_state.queue, dst);
     }
 
     pub fn getOrCreateTargetBuffer(self: *Self) !*buffers.Target {
         if (self.target_buffer == null) {
-            self.target_buffer = try buffers.Target.init(self.allocator, self.device_state.device, self.state.resolution);
+            const span = trace.begin("wgpu.createTarget");
+            defer span.end();
+            self.target_buffer = try buffers.Target.init(self.allocator, self.device_state.device, self.state.resolution, self.state.getOutputFormat());
             std.log.debug("[ornament] target buffer was created", .{});
         }
 
@@ -189,6 +263,9 @@ pub const PathTracer = struct {
                 &self.transforms_buffer,
                 &self.tlas_nodes_buffer,
                 &self.blas_nodes_buffer,
+                &self.light_nodes_buffer,
+                &self.lights_buffer,
+                &self.environment_alias_table_buffer,
             );
         }
 
@@ -196,7 +273,12 @@ pub const PathTracer = struct {
     }
 
     pub fn setResolution(self: *Self, resolution: util.Resolution) !void {
-        if (!std.meta.eql(self.state.getResolution(), resolution)) {
+        // the shaders accumulate only rgba32f
+        if (self.state.requested_accumulation_format != .rgba32f) {
+            std.log.err("[ornament] accumulation format {s} is not supported by the wgpu backend", .{@tagName(self.state.requested_accumulation_format)});
+            return WgpuError.UnsupportedAccumulationFormat;
+        }
+        if (!std.meta.eql(self.state.getResolution(), resolution) or self.state.output_format != self.state.requested_output_format) {
             self.state.setResolution(resolution);
             if (self.target_buffer) |*tb| {
                 tb.deinit();
@@ -206,25 +288,157 @@ pub const PathTracer = struct {
                 p.deinit();
                 self.pipeline = null;
             }
+            self.history_camera = null;
+            self.reprojection = null;
         }
     }
 
-    fn update(self: *Self) void {
+    // Keeps adding samples while the next iteration is expected to fit into the budget,
+    // at least one iteration is always rendered.
+    pub fn renderFor(self: *Self, budget_ns: u64) !util.RenderProgress {
+        const pipeline = try self.getOrCreatePipeline();
+        self.state.nextFrame(self.scene.camera.dirty);
+        (try self.getOrCreateTargetBuffer()).resetRayCount(self.device_state.queue);
+        const generation = self.cancellation.getGeneration();
+        var timer = try std.time.Timer.start();
+        var previous_ns: u64 = 0;
+        var iterations: u32 = 0;
+        // one iteration until its time is known, then as many as fit into the budget up to the check interval
+        var batch: u32 = 1;
+        var stats: gpu_structs.RenderStats = undefined;
+        while (true) {
+            var i: u32 = 0;
+            while (i < batch) : (i += 1) {
+                try self.update();
+                try self.runPipeline(pipeline.path_tracing, pipeline.bind_groups, try self.getWorkGroups(self.state.pixel_stride), "path tracing");
+            }
+            // waits for the iterations of the batch to finish
+            stats = try self.getRenderStats();
+            iterations += batch;
+
+            const elapsed_ns = timer.read();
+            const iteration_ns = @max((elapsed_ns - previous_ns) / batch, 1);
+            previous_ns = elapsed_ns;
+            if ((stats.active_pixel_count == 0 and self.state.isCycleEnd()) or self.cancellation.isCancelled(generation)) break;
+            const fitting = (budget_ns -| elapsed_ns) / iteration_ns;
+            if (fitting == 0) break;
+            batch = @intCast(@min(fitting, self.state.iterationsToCycleEnd(util.CONVERGENCE_CHECK_INTERVAL)));
+        }
+        try self.postProcessing(pipeline);
+
+        return .{
+            .samples = @intFromFloat(self.state.current_iteration),
+            .iterations = iterations,
+            .estimated_error = stats.meanError(self.state.cyclePixelCount()),
+            .cancelled = self.cancellation.isCancelled(generation),
+        };
+    }
+
+    fn postProcessing(self: *Self, pipeline: *const Pipeline) !void {
+        const span = trace.begin("wgpu.postProcessing");
+        defer span.end();
+        if (self.state.isDenoised()) {
+            const tb = try self.getOrCreateTargetBuffer();
+            try self.denoiser.resize(tb.resolution);
+            try tb.readDenoiserInputs(self.device_state.device, self.device_state.queue, &self.denoiser);
+            self.denoiser.denoise();
+            tb.writeDenoised(self.device_state.queue, self.denoiser.output);
+        }
+        try self.runPipeline(pipeline.post_processing, pipeline.bind_groups, try self.getWorkGroups(1), "post processing");
+    }
+
+    // See checkpoint.save.
+    pub fn saveCheckpoint(self: *Self, writer: *checkpoint.CheckpointWriter) !bool {
+        return checkpoint.save(self, writer);
+    }
+
+    // See checkpoint.load.
+    pub fn loadCheckpoint(self: *Self, path: []const u8) !void {
+        return checkpoint.load(self, path);
+    }
+
+    // Used by checkpoint.save.
+    pub fn readCheckpointBuffers(self: *Self, snapshot: *checkpoint.Checkpoint) !void {
+        const tb = try self.getOrCreateTargetBuffer();
+        try tb.readCheckpoint(self.device_state.device, self.device_state.queue, snapshot);
+    }
+
+    // Used by checkpoint.load.
+    pub fn writeCheckpointBuffers(self: *Self, snapshot: *const checkpoint.Checkpoint) !void {
+        const tb = try self.getOrCreateTargetBuffer();
+        tb.writeCheckpoint(self.device_state.queue, snapshot);
+    }
+
+    // Stats of the last path tracing iteration.
+    pub fn getRenderStats(self: *Self) !gpu_structs.RenderStats {
+        const tb = try self.getOrCreateTargetBuffer();
+        return tb.getRenderStats(self.device_state.device, self.device_state.queue);
+    }
+
+    // Bytes held by the scene, by the bvh built at init and by the buffers of the backend.
+    pub fn memoryReport(self: *const Self) util.MemoryReport {
+        return util.memoryReport(self, "_buffer");
+    }
+
+    // The shaders don't count the traversal, same API as the other backends built without options.traversal_stats.
+    pub fn getTraversalStats(self: *Self) !gpu_structs.TraversalTotals {
+        _ = self;
+        return error.TraversalStatsDisabled;
+    }
+
+    pub fn getTraversalHeatmap(self: *Self, dst: []gpu_structs.TraversalStats) !void {
+        _ = self;
+        _ = dst;
+        return error.TraversalStatsDisabled;
+    }
+
+    fn isConverged(self: *Self) !bool {
+        // the stats cover every pixel only at the end of a stride cycle
+        if (!self.state.isCycleEnd()) return false;
+        const stats = try self.getRenderStats();
+        return stats.active_pixel_count == 0;
+    }
+
+    fn update(self: *Self) !void {
+        const span = trace.begin("wgpu.update");
+        defer span.end();
         var dirty = false;
         if (self.scene.camera.dirty) {
             dirty = true;
             self.scene.camera.dirty = false;
         }
 
-        if (dirty) self.state.reset();
+        const tb = try self.getOrCreateTargetBuffer();
+        if (dirty) {
+            self.reprojection = null;
+            if (self.state.temporal_reprojection and self.state.current_iteration > 0.0) {
+                self.reprojection = self.history_camera;
+                if (self.reprojection != null) tb.saveHistory(self.device_state.device, self.device_state.queue);
+            }
+            self.state.reset();
+        }
         self.state.nextIteration();
+        // with a pixel stride the first samples, which take the history, span several iterations
+        if (!self.state.isFirstCycle()) self.reprojection = null;
+        self.history_camera = gpu_structs.Camera.from(&self.scene.camera);
+        if (self.state.isCycleStart()) tb.resetCycleStats(self.device_state.queue);
         self.constant_params_buffer.write(
             self.device_state.queue,
-            gpu_structs.ConstantParams.from(&self.scene.camera, &self.state, @truncate(self.scene.textures.items.len)),
+            gpu_structs.ConstantParams.from(
+                &self.scene.camera,
+                self.reprojection,
+                &self.state,
+                @truncate(self.scene.textures.items.len),
+                @truncate(self.light_nodes_buffer.count),
+                self.environment_map,
+            ),
         );
     }
 
-    fn runPipeline(self: *Self, pipeline: webgpu.ComputePipeline, bind_groups: [4]webgpu.BindGroup, comptime pipeline_name: []const u8) !void {
+    fn runPipeline(self: *Self, pipeline: webgpu.ComputePipeline, bind_groups: [4]webgpu.BindGroup, workgroups: u32, comptime pipeline_name: []const u8) !void {
+        // waits for the pipeline to finish
+        const span = trace.begin("wgpu.runPipeline " ++ pipeline_name);
+        defer span.end();
         const encoder = self.device_state.device.createCommandEncoder(.{ .label = "[ornament] " ++ pipeline_name ++ "command encoder" });
         defer encoder.release();
 
@@ -239,7 +453,7 @@ pub const PathTracer = struct {
             inline for (bind_groups, 0..) |bg, i| {
                 pass.setBindGroup(i, bg, null);
             }
-            pass.dispatchWorkgroups(try self.getWorkGroups(), 1, 1);
+            pass.dispatchWorkgroups(workgroups, 1, 1);
         }
 
         const command = encoder.finish(.{ .label = "[ornament] " ++ pipeline_name ++ " command buffer" });
@@ -249,18 +463,35 @@ pub const PathTracer = struct {
         _ = wgpu.wgpuDevicePoll(self.device_state.device, true, null);
     }
 
+    // Stops the running render or renderFor at the next cancellation point, so a new camera or scene
+    // doesn't wait for the stale iterations. May be called from any thread, renders started later are not affected.
+    pub fn cancel(self: *Self) void {
+        self.cancellation.cancel();
+    }
+
     pub fn render(self: *Self) !void {
         const pipeline = try self.getOrCreatePipeline();
-        if (self.state.iterations > 1) {
+        self.state.nextFrame(self.scene.camera.dirty);
+        (try self.getOrCreateTargetBuffer()).resetRayCount(self.device_state.queue);
+        if (self.state.iterations > 1 or self.state.denoise or self.state.dynamic_resolution) {
+            const generation = self.cancellation.getGeneration();
             var i: u32 = 0;
+            // iterations since the last read of the render stats
+            var unchecked: u32 = 0;
             while (i < self.state.iterations) : (i += 1) {
-                self.update();
-                try self.runPipeline(pipeline.path_tracing, pipeline.bind_groups, "path tracing");
+                try self.update();
+                try self.runPipeline(pipeline.path_tracing, pipeline.bind_groups, try self.getWorkGroups(self.state.pixel_stride), "path tracing");
+                unchecked += 1;
+                if (self.state.adaptive_sampling and unchecked >= util.CONVERGENCE_CHECK_INTERVAL and self.state.isCycleEnd()) {
+                    unchecked = 0;
+                    if (try self.isConverged()) break;
+                }
+                if (self.cancellation.isCancelled(generation)) break;
             }
-            try self.runPipeline(pipeline.post_processing, pipeline.bind_groups, "post processing");
+            try self.postProcessing(pipeline);
         } else {
-            self.update();
-            try self.runPipeline(pipeline.path_tracing_and_post_processing, pipeline.bind_groups, "path tracing and post processing");
+            try self.update();
+            try self.runPipeline(pipeline.path_tracing_and_post_processing, pipeline.bind_groups, try self.getWorkGroups(1), "path tracing and post processing");
         }
     }
 };
@@ -286,6 +517,9 @@ pub const Pipeline = struct {
         transforms_buffer: *const buffers.Storage(gpu_structs.Transform),
         tlas_nodes_buffer: *const buffers.Storage(gpu_structs.BvhNode),
         blas_nodes_buffer: *const buffers.Storage(gpu_structs.BvhNode),
+        light_nodes_buffer: *const buffers.Storage(gpu_structs.LightNode),
+        lights_buffer: *const buffers.Storage(gpu_structs.Light),
+        environment_alias_table_buffer: *const buffers.Storage(gpu_structs.AliasEntry),
     ) Self {
         const compute_visibility: webgpu.ShaderStage = .{ .compute = true };
         var bind_groups: [4]webgpu.BindGroup = undefined;
@@ -297,6 +531,15 @@ pub const Pipeline = struct {
                 target_buffer.buffer.layout(0, compute_visibility, false),
                 target_buffer.accumulation_buffer.layout(1, compute_visibility, false),
                 target_buffer.rng_state_buffer.layout(2, compute_visibility, false),
+                target_buffer.second_moment_buffer.layout(3, compute_visibility, false),
+                target_buffer.render_stats_buffer.layout(4, compute_visibility, false),
+                target_buffer.albedo_buffer.layout(5, compute_visibility, false),
+                target_buffer.normal_buffer.layout(6, compute_visibility, false),
+                target_buffer.denoised_buffer.layout(7, compute_visibility, true),
+                target_buffer.position_buffer.layout(8, compute_visibility, false),
+                target_buffer.history_accumulation_buffer.layout(9, compute_visibility, true),
+                target_buffer.history_second_moment_buffer.layout(10, compute_visibility, true),
+                target_buffer.history_position_buffer.layout(11, compute_visibility, true),
             };
             const bgl = device.createBindGroupLayout(.{
                 .label = "[ornament] target bgl",
@@ -308,6 +551,15 @@ pub const Pipeline = struct {
                 target_buffer.buffer.binding(0),
                 target_buffer.accumulation_buffer.binding(1),
                 target_buffer.rng_state_buffer.binding(2),
+                target_buffer.second_moment_buffer.binding(3),
+                target_buffer.render_stats_buffer.binding(4),
+                target_buffer.albedo_buffer.binding(5),
+                target_buffer.normal_buffer.binding(6),
+                target_buffer.denoised_buffer.binding(7),
+                target_buffer.position_buffer.binding(8),
+                target_buffer.history_accumulation_buffer.binding(9),
+                target_buffer.history_second_moment_buffer.binding(10),
+                target_buffer.history_position_buffer.binding(11),
             };
             const bg = device.createBindGroup(.{
                 .label = "[ornament] target bg",
@@ -352,6 +604,9 @@ pub const Pipeline = struct {
                 transforms_buffer.layout(5, compute_visibility, true),
                 tlas_nodes_buffer.layout(6, compute_visibility, true),
                 blas_nodes_buffer.layout(7, compute_visibility, true),
+                light_nodes_buffer.layout(8, compute_visibility, true),
+                lights_buffer.layout(9, compute_visibility, true),
+                environment_alias_table_buffer.layout(10, compute_visibility, true),
             };
             const bgl = device.createBindGroupLayout(.{
                 .label = "[ornament] materials bvhnodes bgl",
@@ -368,6 +623,9 @@ pub const Pipeline = struct {
                 transforms_buffer.binding(5),
                 tlas_nodes_buffer.binding(6),
                 blas_nodes_buffer.binding(7),
+                light_nodes_buffer.binding(8),
+                lights_buffer.binding(9),
+                environment_alias_table_buffer.binding(10),
             };
             const bg = device.createBindGroup(.{
                 .label = "[ornament] materials bvhnodes bg",
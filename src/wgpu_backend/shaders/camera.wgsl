@@ -20,4 +20,20 @@ fn camera_get_ray(s: f32, t: f32) -> Ray {
             - constant_params.camera.origin
             - offset
     );
+}
+
+// Inverse of camera_get_ray for a pinhole: screen coordinates of a direction from the origin.
+fn camera_project(camera: Camera, direction: vec3<f32>, st: ptr<function, vec2<f32>>) -> bool {
+    let forward = -dot(direction, camera.w);
+    if forward <= 0.0 {
+        return false;
+    }
+
+    let focus_dist = dot(camera.origin - camera.lower_left_corner, camera.w);
+    let on_focus_plane = direction * (focus_dist / forward) + camera.origin - camera.lower_left_corner;
+    (*st) = vec2<f32>(
+        dot(on_focus_plane, camera.horizontal) / dot(camera.horizontal, camera.horizontal),
+        dot(on_focus_plane, camera.vertical) / dot(camera.vertical, camera.vertical)
+    );
+    return true;
 }
\ No newline at end of file
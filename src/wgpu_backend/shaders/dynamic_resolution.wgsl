@@ -0,0 +1,44 @@
+// Iterations after a reset trace the pixels with one offset of the stride pattern each,
+// an offset is (x % pixel_stride, y % pixel_stride) and its index is y_offset * pixel_stride + x_offset.
+fn pixel_offset_index() -> u32 {
+    let stride = constant_params.pixel_stride;
+    return (u32(constant_params.current_iteration) - 1u) % (stride * stride);
+}
+
+// The first sample of every pixel is taken during the first pixel_stride^2 iterations.
+fn is_first_cycle() -> bool {
+    let stride = constant_params.pixel_stride;
+    return constant_params.current_iteration <= f32(stride * stride);
+}
+
+// Maps an invocation of the reduced grid to the pixel it traces this iteration.
+fn strided_pixel_id(global_id: u32, pixel_id: ptr<function, u32>) -> bool {
+    let stride = constant_params.pixel_stride;
+    let strided_width = (constant_params.width + stride - 1u) / stride;
+    let strided_height = (constant_params.height + stride - 1u) / stride;
+    if global_id >= strided_width * strided_height {
+        return false;
+    }
+
+    let offset = pixel_offset_index();
+    let x = (global_id % strided_width) * stride + offset % stride;
+    let y = (global_id / strided_width) * stride + offset / stride;
+    if x >= constant_params.width || y >= constant_params.height {
+        return false;
+    }
+
+    (*pixel_id) = y * constant_params.width + x;
+    return true;
+}
+
+// Pixel whose accumulation is shown at xy, pixels not traced since the reset
+// take the pixel of their stride block traced by the first iteration.
+fn traced_pixel_id(xy: vec2<u32>) -> u32 {
+    let stride = constant_params.pixel_stride;
+    let x_offset = xy.x % stride;
+    let y_offset = xy.y % stride;
+    if y_offset * stride + x_offset < u32(constant_params.current_iteration) {
+        return xy.y * constant_params.width + xy.x;
+    }
+    return (xy.y - y_offset) * constant_params.width + (xy.x - x_offset);
+}
@@ -0,0 +1,77 @@
+struct AliasEntry {
+    q: f32,
+    alias_index: u32, // "alias" is a reserved word
+    pdf: f32,
+    _padding: u32,
+}
+
+fn power_heuristic(pdf_a: f32, pdf_b: f32) -> f32 {
+    let a2 = pdf_a * pdf_a;
+    let b2 = pdf_b * pdf_b;
+    if a2 + b2 > 0.0 {
+        return a2 / (a2 + b2);
+    }
+    return 0.0;
+}
+
+// Equirectangular environment map, uses the same uv mapping as spheres.
+fn environment_map_enabled() -> bool {
+    return constant_params.environment_map_texture_id != 0xffffffffu;
+}
+
+fn environment_map_direction_to_uv(direction: vec3<f32>) -> vec2<f32> {
+    let theta = acos(-direction.y);
+    let phi = atan2(-direction.z, direction.x) + pi;
+    return vec2<f32>(phi / (2.0 * pi), theta / pi);
+}
+
+fn environment_map_eval_uv(uv: vec2<f32>) -> vec3<f32> {
+    let texture_id = constant_params.environment_map_texture_id;
+    return textureSampleLevel(textures[texture_id], samplers[texture_id], uv, 0.0).xyz;
+}
+
+fn environment_map_eval(direction: vec3<f32>) -> vec3<f32> {
+    return environment_map_eval_uv(environment_map_direction_to_uv(direction));
+}
+
+// Solid angle pdf of sampling the normalized direction.
+fn environment_map_pdf(direction: vec3<f32>) -> f32 {
+    let uv = environment_map_direction_to_uv(direction);
+    let width = constant_params.environment_map_width;
+    let height = constant_params.environment_map_height;
+    let x = min(u32(uv.x * f32(width)), width - 1u);
+    let y = min(u32(uv.y * f32(height)), height - 1u);
+    let sin_theta = sqrt(max(0.0, 1.0 - direction.y * direction.y));
+    if sin_theta == 0.0 {
+        return 0.0;
+    }
+    return environment_alias_table[y * width + x].pdf * f32(width * height) / (2.0 * pi * pi * sin_theta);
+}
+
+fn environment_map_sample(direction: ptr<function, vec3<f32>>, radiance: ptr<function, vec3<f32>>, pdf: ptr<function, f32>) -> bool {
+    let width = constant_params.environment_map_width;
+    let height = constant_params.environment_map_height;
+    let texels_count = width * height;
+    var index = min(u32(random_f32() * f32(texels_count)), texels_count - 1u);
+    var entry = environment_alias_table[index];
+    if random_f32() >= entry.q {
+        index = entry.alias_index;
+        entry = environment_alias_table[index];
+    }
+
+    // uniformly inside of the texel
+    let uv = vec2<f32>(
+        (f32(index % width) + random_f32()) / f32(width),
+        (f32(index / width) + random_f32()) / f32(height)
+    );
+    let theta = uv.y * pi;
+    let phi = uv.x * 2.0 * pi;
+    let sin_theta = sin(theta);
+    if sin_theta == 0.0 {
+        return false;
+    }
+    (*direction) = vec3<f32>(-sin_theta * cos(phi), -cos(theta), sin_theta * sin(phi));
+    (*pdf) = entry.pdf * f32(texels_count) / (2.0 * pi * pi * sin_theta);
+    (*radiance) = environment_map_eval_uv(uv);
+    return (*pdf) > 0.0;
+}
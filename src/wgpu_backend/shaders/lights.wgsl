@@ -0,0 +1,245 @@
+struct LightNode {
+    aabb_min: vec3<f32>,
+    left_or_light_id: u32, // internal left node id / light id
+    aabb_max: vec3<f32>,
+    right: u32,
+    axis: vec3<f32>,
+    node_type: u32, // 0 internal node, 1 light
+    power: f32,
+    cos_theta_o: f32,
+    cos_theta_e: f32,
+    _padding: u32,
+}
+
+struct Light {
+    v0_or_center: vec3<f32>,
+    light_type: u32, // 0 sphere, 1 triangle
+    v1: vec3<f32>,
+    material_index: u32,
+    v2: vec3<f32>,
+    triangle_id: u32,
+    radius: f32,
+    area: f32,
+    _padding0: u32,
+    _padding1: u32,
+}
+
+struct LightSample {
+    direction: vec3<f32>,
+    distance: f32,
+    radiance: vec3<f32>,
+    // solid angle pdf, includes the probability to pick the light
+    pdf: f32,
+}
+
+const one_minus_epsilon: f32 = 0.99999994;
+
+fn safe_sqrt(x: f32) -> f32 {
+    return sqrt(max(x, 0.0));
+}
+
+// cos(max(0, theta_a - theta_b))
+fn cos_sub_clamped(sin_a: f32, cos_a: f32, sin_b: f32, cos_b: f32) -> f32 {
+    if cos_a > cos_b {
+        return 1.0;
+    }
+    return cos_a * cos_b + sin_a * sin_b;
+}
+
+// sin(max(0, theta_a - theta_b))
+fn sin_sub_clamped(sin_a: f32, cos_a: f32, sin_b: f32, cos_b: f32) -> f32 {
+    if cos_a > cos_b {
+        return 0.0;
+    }
+    return sin_a * cos_b - cos_a * sin_b;
+}
+
+// Conservative estimate of the light a node sends to the point p with the normal n.
+fn light_node_importance(node: LightNode, p: vec3<f32>, n: vec3<f32>) -> f32 {
+    let pc = 0.5 * (node.aabb_min + node.aabb_max);
+    let pc_to_p = p - pc;
+    let bounds_radius = 0.5 * length(node.aabb_max - node.aabb_min);
+    let d2 = length_squared(pc_to_p);
+    let d2_clamped = max(d2, bounds_radius);
+
+    // angle between the cone axis and the direction to the point, lights are two sided
+    var wi = vec3<f32>(0.0);
+    if d2 > 0.0 {
+        wi = pc_to_p / sqrt(d2);
+    }
+    let cos_theta_w = abs(dot(node.axis, wi));
+    let sin_theta_w = safe_sqrt(1.0 - cos_theta_w * cos_theta_w);
+
+    // angle subtended by the bounds as seen from the point
+    var cos_theta_b = -1.0;
+    if d2 > bounds_radius * bounds_radius {
+        cos_theta_b = safe_sqrt(1.0 - bounds_radius * bounds_radius / d2);
+    }
+    let sin_theta_b = safe_sqrt(1.0 - cos_theta_b * cos_theta_b);
+
+    let sin_theta_o = safe_sqrt(1.0 - node.cos_theta_o * node.cos_theta_o);
+    let cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, node.cos_theta_o);
+    let sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, node.cos_theta_o);
+    let cos_theta_p = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+    if cos_theta_p <= node.cos_theta_e {
+        return 0.0;
+    }
+
+    let cos_theta_i = abs(dot(wi, n));
+    let sin_theta_i = safe_sqrt(1.0 - cos_theta_i * cos_theta_i);
+    let cos_theta_pi = cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+
+    return max(node.power * cos_theta_p * cos_theta_pi / d2_clamped, 0.0);
+}
+
+// Stochastic traversal, every step picks a child proportionally to its importance.
+fn light_bvh_pick_light(p: vec3<f32>, n: vec3<f32>, light_id: ptr<function, u32>, pmf: ptr<function, f32>) -> bool {
+    let num_nodes = constant_params.light_nodes_count;
+    if num_nodes == 0u {
+        return false;
+    }
+
+    var u = random_f32();
+    var addr = num_nodes - 1u;
+    (*pmf) = 1.0;
+    loop {
+        let node = light_nodes[addr];
+        if node.node_type == 1u {
+            // a single light in the scene hasn't been tested yet
+            if addr == num_nodes - 1u && light_node_importance(node, p, n) == 0.0 {
+                return false;
+            }
+            (*light_id) = node.left_or_light_id;
+            return true;
+        }
+
+        let left = light_node_importance(light_nodes[node.left_or_light_id], p, n);
+        let right = light_node_importance(light_nodes[node.right], p, n);
+        if left == 0.0 && right == 0.0 {
+            return false;
+        }
+
+        let left_probability = left / (left + right);
+        if u < left_probability {
+            addr = node.left_or_light_id;
+            (*pmf) *= left_probability;
+            u = min(u / left_probability, one_minus_epsilon);
+        } else {
+            addr = node.right;
+            (*pmf) *= 1.0 - left_probability;
+            u = min((u - left_probability) / (1.0 - left_probability), one_minus_epsilon);
+        }
+    }
+    return false;
+}
+
+fn light_sample_triangle(light: Light, p: vec3<f32>, uv: ptr<function, vec2<f32>>, ls: ptr<function, LightSample>) -> bool {
+    // uniform sampling of the triangle area
+    let su0 = sqrt(random_f32());
+    let b1 = 1.0 - su0;
+    let b2 = random_f32() * su0;
+    let b0 = 1.0 - b1 - b2;
+    let x = b0 * light.v0_or_center + b1 * light.v1 + b2 * light.v2;
+
+    let to_light = x - p;
+    let dist2 = length_squared(to_light);
+    if dist2 == 0.0 {
+        return false;
+    }
+    (*ls).distance = sqrt(dist2);
+    (*ls).direction = to_light / (*ls).distance;
+
+    let normal = normalize(cross(light.v1 - light.v0_or_center, light.v2 - light.v0_or_center));
+    let cos_light = abs(dot(normal, (*ls).direction));
+    if cos_light == 0.0 {
+        return false;
+    }
+    (*ls).pdf = dist2 / (cos_light * light.area);
+
+    let uv0 = uvs[uv_indices[light.triangle_id]];
+    let uv1 = uvs[uv_indices[light.triangle_id + 1u]];
+    let uv2 = uvs[uv_indices[light.triangle_id + 2u]];
+    (*uv) = b0 * uv0 + b1 * uv1 + b2 * uv2;
+    return true;
+}
+
+fn light_sample_sphere(light: Light, p: vec3<f32>, uv: ptr<function, vec2<f32>>, ls: ptr<function, LightSample>) -> bool {
+    let center = light.v0_or_center;
+    let radius = light.radius;
+    let p_to_center = center - p;
+    let dc2 = length_squared(p_to_center);
+    var x: vec3<f32>;
+    if dc2 <= radius * radius {
+        // the point is inside of the sphere, sample its area uniformly
+        x = center + radius * random_unit_vector();
+        let to_light = x - p;
+        let dist2 = length_squared(to_light);
+        if dist2 == 0.0 {
+            return false;
+        }
+        (*ls).distance = sqrt(dist2);
+        (*ls).direction = to_light / (*ls).distance;
+        let cos_light = abs(dot(normalize(x - center), (*ls).direction));
+        if cos_light == 0.0 {
+            return false;
+        }
+        (*ls).pdf = dist2 / (cos_light * light.area);
+    } else {
+        // sample the cone of directions subtended by the sphere
+        let sin_theta_max2 = radius * radius / dc2;
+        let cos_theta_max = safe_sqrt(1.0 - sin_theta_max2);
+        let cos_theta = 1.0 - random_f32() * (1.0 - cos_theta_max);
+        let sin_theta = safe_sqrt(1.0 - cos_theta * cos_theta);
+        let phi = 2.0 * pi * random_f32();
+
+        let w = p_to_center / sqrt(dc2);
+        var a = vec3<f32>(1.0, 0.0, 0.0);
+        if abs(w.x) > 0.9 {
+            a = vec3<f32>(0.0, 1.0, 0.0);
+        }
+        let t = normalize(cross(a, w));
+        let b = cross(w, t);
+        (*ls).direction = normalize(sin_theta * cos(phi) * t + sin_theta * sin(phi) * b + cos_theta * w);
+
+        let half_b = -dot(p_to_center, (*ls).direction);
+        let discriminant = half_b * half_b - (dc2 - radius * radius);
+        (*ls).distance = -half_b - safe_sqrt(discriminant);
+        if (*ls).distance <= 0.0 {
+            return false;
+        }
+        x = p + (*ls).distance * (*ls).direction;
+        (*ls).pdf = 1.0 / (2.0 * pi * (1.0 - cos_theta_max));
+    }
+
+    let outward_normal = normalize(x - center);
+    let theta = acos(-outward_normal.y);
+    let phi = atan2(-outward_normal.z, outward_normal.x) + pi;
+    (*uv) = vec2<f32>(phi / (2.0 * pi), theta / pi);
+    return true;
+}
+
+// Samples a direction towards a light for the point p with the normal n.
+fn light_bvh_sample(p: vec3<f32>, n: vec3<f32>, ls: ptr<function, LightSample>) -> bool {
+    var light_id: u32;
+    var pmf: f32;
+    if !light_bvh_pick_light(p, n, &light_id, &pmf) {
+        return false;
+    }
+
+    let light = lights[light_id];
+    var hit: HitRecord;
+    hit.material_index = light.material_index;
+    var sampled: bool;
+    if light.light_type == 1u {
+        sampled = light_sample_triangle(light, p, &hit.uv, ls);
+    } else {
+        sampled = light_sample_sphere(light, p, &hit.uv, ls);
+    }
+    if !sampled {
+        return false;
+    }
+
+    (*ls).radiance = material_emit(hit);
+    (*ls).pdf *= pmf;
+    return (*ls).pdf > 0.0;
+}
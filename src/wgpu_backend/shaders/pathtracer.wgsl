@@ -1,6 +1,16 @@
-@group(0) @binding(0) var<storage, read_write> framebuffer : array<vec4<f32>>;
+// pixels of constant_params.output_format, see write_framebuffer
+@group(0) @binding(0) var<storage, read_write> framebuffer : array<u32>;
 @group(0) @binding(1) var<storage, read_write> accumulation_buffer: array<vec4<f32>>;
 @group(0) @binding(2) var<storage, read_write> rng_state_buffer: array<u32>;
+@group(0) @binding(3) var<storage, read_write> second_moment_buffer: array<f32>;
+@group(0) @binding(4) var<storage, read_write> render_stats: RenderStats;
+@group(0) @binding(5) var<storage, read_write> albedo_buffer: array<vec4<f32>>;
+@group(0) @binding(6) var<storage, read_write> normal_buffer: array<vec4<f32>>;
+@group(0) @binding(7) var<storage, read> denoised_buffer: array<vec4<f32>>;
+@group(0) @binding(8) var<storage, read_write> position_buffer: array<vec4<f32>>;
+@group(0) @binding(9) var<storage, read> history_accumulation_buffer: array<vec4<f32>>;
+@group(0) @binding(10) var<storage, read> history_second_moment_buffer: array<f32>;
+@group(0) @binding(11) var<storage, read> history_position_buffer: array<vec4<f32>>;
 
 @group(1) @binding(0) var<uniform> constant_params: ConstantParams;
 
@@ -12,18 +22,31 @@
 @group(2) @binding(5) var<storage, read> transforms: array<mat4x4<f32>>;
 @group(2) @binding(6) var<storage, read> bvh_tlas_nodes: array<BvhNode>;
 @group(2) @binding(7) var<storage, read> bvh_blas_nodes: array<BvhNode>;
+@group(2) @binding(8) var<storage, read> light_nodes: array<LightNode>;
+@group(2) @binding(9) var<storage, read> lights: array<Light>;
+@group(2) @binding(10) var<storage, read> environment_alias_table: array<AliasEntry>;
 
 @group(3) @binding(0) var textures: binding_array<texture_2d<f32>>;
 @group(3) @binding(1) var samplers: binding_array<sampler>;
 
+// Written for the denoiser and the reprojection.
+struct FirstHit {
+    albedo: vec3<f32>,
+    normal: vec3<f32>,
+    // hit position, or the ray direction with w = 0 for misses
+    position: vec4<f32>,
+}
+
 const finished_traverse_blas: u32 = 0xffffffffu;
 const max_bvh_depth = 64;
 var<private> node_stack: array<u32, max_bvh_depth>;
+// bvh_hit calls of the pixel sample, the camera ray, the bounces and the shadow rays
+var<private> traced_rays: u32;
 
 @compute @workgroup_size(256, 1, 1)
 fn main_render(@builtin(global_invocation_id) inv_id: vec3<u32>) {
-    let inv_id_x = inv_id.x;
-    if inv_id_x >= arrayLength(&accumulation_buffer) {
+    var inv_id_x: u32;
+    if !strided_pixel_id(inv_id.x, &inv_id_x) {
         return;
     }
 
@@ -42,7 +65,12 @@ fn main_post_processing(@builtin(global_invocation_id) inv_id: vec3<u32>) {
 
     init_rng_state(inv_id_x);
     let xy = vec2<u32>(inv_id_x % constant_params.width, inv_id_x / constant_params.width);
-    post_processing(inv_id_x, xy, accumulation_buffer[inv_id_x]);
+    let traced_id = traced_pixel_id(xy);
+    var accumulated_rgba = accumulation_buffer[traced_id];
+    if constant_params.denoise != 0u {
+        accumulated_rgba = denoised_buffer[traced_id];
+    }
+    post_processing(inv_id_x, xy, accumulated_rgba);
     save_rng_state(inv_id_x);
 }
 
@@ -62,39 +90,128 @@ fn main(@builtin(global_invocation_id) inv_id: vec3<u32>) {
 }
 
 fn render(inv_id_x: u32, xy: vec2<u32>) -> vec4<f32> {
+    let first_iteration = is_first_cycle();
+    if !first_iteration && constant_params.adaptive_sampling != 0u {
+        let accumulated_rgba = accumulation_buffer[inv_id_x];
+        let error = estimate_relative_error(accumulated_rgba, second_moment_buffer[inv_id_x]);
+        if is_converged(accumulated_rgba, error) {
+            record_render_stats(error, true, 0u);
+            return accumulated_rgba;
+        }
+    }
+
     let u = (f32(xy.x) + random_f32()) / f32(constant_params.width - 1u);
     let v = (f32(xy.y) + random_f32()) / f32(constant_params.height - 1u);
     // mock tracing
     // var rgb = vec3<f32>(u, v, 0.0);
     // var accumulated_rgba = vec4<f32>(rgb, 1.0);
     let r = camera_get_ray(u, v);
-    var rgb = ray_color(r);
+    var first_hit: FirstHit;
+    traced_rays = 0u;
+    var rgb = ray_color(r, &first_hit);
+    position_buffer[inv_id_x] = first_hit.position;
+    let l = luminance(rgb);
     var accumulated_rgba = vec4<f32>(rgb, 1.0);
+    var second_moment = l * l;
+    // denoiser guides, averaged with the same sample count as the color
+    var accumulated_albedo = vec4<f32>(first_hit.albedo, 0.0);
+    var accumulated_normal = vec4<f32>(first_hit.normal, 0.0);
     
-    if constant_params.current_iteration > 1.0 {
+    if !first_iteration {
         accumulated_rgba = accumulation_buffer[inv_id_x] + accumulated_rgba;
+        second_moment += second_moment_buffer[inv_id_x];
+        accumulated_albedo = albedo_buffer[inv_id_x] + accumulated_albedo;
+        accumulated_normal = normal_buffer[inv_id_x] + accumulated_normal;
+    } else if constant_params.reproject != 0u {
+        var history_rgba: vec4<f32>;
+        var history_second_moment: f32;
+        if reproject_history(first_hit.position, &history_rgba, &history_second_moment) {
+            accumulated_rgba = history_rgba + accumulated_rgba;
+            second_moment += history_second_moment;
+            // the history saw the same surface, so its guides are taken from the new sample
+            accumulated_albedo = accumulated_albedo * accumulated_rgba.w;
+            accumulated_normal = accumulated_normal * accumulated_rgba.w;
+        }
     }
+    second_moment_buffer[inv_id_x] = second_moment;
+    albedo_buffer[inv_id_x] = accumulated_albedo;
+    normal_buffer[inv_id_x] = accumulated_normal;
 
+    let error = estimate_relative_error(accumulated_rgba, second_moment);
+    // the camera ray is counted by the host
+    record_render_stats(error, is_converged(accumulated_rgba, error), max(traced_rays, 1u) - 1u);
     return accumulated_rgba;
 }
 
 fn post_processing(inv_id_x: u32, xy: vec2<u32>, accumulated_rgba: vec4<f32>) {
-    var rgba = accumulated_rgba / constant_params.current_iteration;
+    // alpha keeps the number of samples of the pixel
+    var rgba = accumulated_rgba / accumulated_rgba.w;
     rgba = clamp(rgba, vec4<f32>(0.0), vec4<f32>(1.0));
-    rgba.x = pow(rgba.x, constant_params.inverted_gamma);
-    rgba.y = pow(rgba.y, constant_params.inverted_gamma);
-    rgba.z = pow(rgba.z, constant_params.inverted_gamma);
+    if constant_params.output_format == output_format_rgba8_srgb {
+        rgba = vec4<f32>(linear_to_srgb(rgba.x), linear_to_srgb(rgba.y), linear_to_srgb(rgba.z), rgba.w);
+    } else {
+        rgba.x = pow(rgba.x, constant_params.inverted_gamma);
+        rgba.y = pow(rgba.y, constant_params.inverted_gamma);
+        rgba.z = pow(rgba.z, constant_params.inverted_gamma);
+    }
     if constant_params.flip_y < 1u {
-        framebuffer[inv_id_x] = rgba;
+        write_framebuffer(inv_id_x, rgba);
     } else {
         let y_flipped = constant_params.height - xy.y - 1u;
-        framebuffer[constant_params.width * y_flipped + xy.x] = rgba;
+        write_framebuffer(constant_params.width * y_flipped + xy.x, rgba);
     }
 }
 
-fn ray_color(first_ray: Ray) -> vec3<f32> {
+// Pixel formats of the framebuffer, same values as OutputFormat of src/util.zig.
+const output_format_rgba32f: u32 = 0u;
+const output_format_rgba8_srgb: u32 = 1u;
+const output_format_rgba16f: u32 = 2u;
+const output_format_rgb10a2: u32 = 3u;
+
+fn linear_to_srgb(c: f32) -> f32 {
+    if c <= 0.0031308 {
+        return 12.92 * c;
+    }
+    return 1.055 * pow(c, 1.0 / 2.4) - 0.055;
+}
+
+// rgba is clamped to [0, 1] and already gamma or sRGB encoded.
+// The case selectors are the literal values of the output_format constants.
+fn write_framebuffer(index: u32, rgba: vec4<f32>) {
+    switch constant_params.output_format {
+        case 1u: {
+            framebuffer[index] = pack4x8unorm(rgba);
+        }
+        case 2u: {
+            framebuffer[2u * index] = pack2x16float(rgba.xy);
+            framebuffer[2u * index + 1u] = pack2x16float(rgba.zw);
+        }
+        case 3u: {
+            let c = vec4<u32>(rgba * vec4<f32>(1023.0, 1023.0, 1023.0, 3.0) + 0.5);
+            framebuffer[index] = c.x | (c.y << 10u) | (c.z << 20u) | (c.w << 30u);
+        }
+        default: {
+            let bits = bitcast<vec4<u32>>(rgba);
+            framebuffer[4u * index] = bits.x;
+            framebuffer[4u * index + 1u] = bits.y;
+            framebuffer[4u * index + 2u] = bits.z;
+            framebuffer[4u * index + 3u] = bits.w;
+        }
+    }
+}
+
+// Misses and emitters report their radiance as the first hit albedo and a zero normal.
+fn ray_color(first_ray: Ray, first_hit: ptr<function, FirstHit>) -> vec3<f32> {
     var ray = first_ray;
-    var final_color = vec3<f32>(1.0);
+    var radiance = vec3<f32>(0.0);
+    var throughput = vec3<f32>(1.0);
+    // emitters reached after a diffuse bounce are already counted by the light sampling
+    var count_emission = true;
+    // pdf of the last lambertian bounce, used to weight environment hits
+    var bsdf_pdf = 0.0;
+    (*first_hit).albedo = vec3<f32>(0.0);
+    (*first_hit).normal = vec3<f32>(0.0);
+    (*first_hit).position = vec4<f32>(0.0);
 
     for (var i = 0u; i < constant_params.depth; i = i + 1u) {
         var t: f32;
@@ -103,11 +220,25 @@ fn ray_color(first_ray: Ray) -> vec3<f32> {
         var inverted_transform_id: u32;
         var tri_id: u32;
         var uv: vec2<f32>;
+        traced_rays += 1u;
         if !bvh_hit(ray, &t, &material_index, &node_type, &inverted_transform_id, &tri_id, &uv) {
             var unit_direction = normalize(ray.direction);
-            var tt = 0.5 * (unit_direction.y + 1.0);
-            final_color *= (1.0 - tt) * vec3<f32>(1.0) + tt * vec3<f32>(0.5, 0.7, 1.0);
-            //final_color = vec3<f32>(0.0);
+            var background: vec3<f32>;
+            var weight = 1.0;
+            if environment_map_enabled() {
+                background = environment_map_eval(unit_direction);
+                if !count_emission {
+                    weight = power_heuristic(bsdf_pdf, environment_map_pdf(unit_direction));
+                }
+            } else {
+                var tt = 0.5 * (unit_direction.y + 1.0);
+                background = (1.0 - tt) * vec3<f32>(1.0) + tt * vec3<f32>(0.5, 0.7, 1.0);
+            }
+            radiance += throughput * weight * background;
+            if i == 0u {
+                (*first_hit).albedo = background;
+                (*first_hit).position = vec4<f32>(unit_direction, 0.0);
+            }
             break;
         } 
 
@@ -145,17 +276,96 @@ fn ray_color(first_ray: Ray) -> vec3<f32> {
             }
             default: { break; }
         }
+        if i == 0u {
+            (*first_hit).normal = hit.normal;
+            (*first_hit).position = vec4<f32>(hit.p, 1.0);
+        }
 
         var attenuation: vec3<f32>;
         var scattered: Ray;
         if material_scatter(ray, hit, &attenuation, &scattered) {
+            if i == 0u {
+                (*first_hit).albedo = attenuation;
+            }
+            count_emission = materials[hit.material_index].material_type != 0u;
+            if !count_emission {
+                // lambertian scatter is cosine weighted, so attenuation is the albedo
+                radiance += throughput * attenuation * (sample_direct_light(hit) + sample_environment_light(hit));
+                bsdf_pdf = max(dot(hit.normal, normalize(scattered.direction)), 0.0) / pi;
+            }
             ray = scattered;
-            final_color *= attenuation;
+            throughput *= attenuation;
         } else {
-            final_color *= material_emit(hit);
+            let emitted = material_emit(hit);
+            if count_emission {
+                radiance += throughput * emitted;
+            }
+            if i == 0u {
+                (*first_hit).albedo = emitted;
+            }
             break;
         }
     }
 
-    return final_color;
+    return radiance;
+}
+
+fn sample_direct_light(hit: HitRecord) -> vec3<f32> {
+    var ls: LightSample;
+    if !light_bvh_sample(hit.p, hit.normal, &ls) {
+        return vec3<f32>(0.0);
+    }
+
+    let cos_theta = dot(hit.normal, ls.direction);
+    if cos_theta <= 0.0 {
+        return vec3<f32>(0.0);
+    }
+
+    var t: f32;
+    var material_index: u32;
+    var node_type: u32;
+    var inverted_transform_id: u32;
+    var tri_id: u32;
+    var uv: vec2<f32>;
+    let shadow_ray = Ray(hit.p, ls.direction);
+    traced_rays += 1u;
+    if bvh_hit(shadow_ray, &t, &material_index, &node_type, &inverted_transform_id, &tri_id, &uv) && t < ls.distance * 0.999 {
+        return vec3<f32>(0.0);
+    }
+
+    // lambertian brdf without albedo: 1 / pi
+    return ls.radiance * (cos_theta / (pi * ls.pdf));
+}
+
+fn sample_environment_light(hit: HitRecord) -> vec3<f32> {
+    if !environment_map_enabled() {
+        return vec3<f32>(0.0);
+    }
+
+    var direction: vec3<f32>;
+    var env_radiance: vec3<f32>;
+    var env_pdf: f32;
+    if !environment_map_sample(&direction, &env_radiance, &env_pdf) {
+        return vec3<f32>(0.0);
+    }
+
+    let cos_theta = dot(hit.normal, direction);
+    if cos_theta <= 0.0 {
+        return vec3<f32>(0.0);
+    }
+
+    var t: f32;
+    var material_index: u32;
+    var node_type: u32;
+    var inverted_transform_id: u32;
+    var tri_id: u32;
+    var uv: vec2<f32>;
+    let shadow_ray = Ray(hit.p, direction);
+    traced_rays += 1u;
+    if bvh_hit(shadow_ray, &t, &material_index, &node_type, &inverted_transform_id, &tri_id, &uv) {
+        return vec3<f32>(0.0);
+    }
+
+    let weight = power_heuristic(env_pdf, cos_theta / pi);
+    return env_radiance * (weight * cos_theta / (pi * env_pdf));
 }
\ No newline at end of file
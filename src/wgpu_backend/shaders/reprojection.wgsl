@@ -0,0 +1,43 @@
+// max distance between the reprojected and the history first hits, relative to the distance to the camera
+const reprojection_tolerance: f32 = 0.05;
+
+// Finds the history pixel which saw the same first hit and returns its samples,
+// clamped to constant_params.temporal_history_limit.
+// position is the first hit position, or the ray direction with w = 0 for misses.
+fn reproject_history(position: vec4<f32>, history_rgba: ptr<function, vec4<f32>>, history_second_moment: ptr<function, f32>) -> bool {
+    let camera = constant_params.previous_camera;
+    let hit = position.w != 0.0;
+    var direction = position.xyz;
+    if hit {
+        direction = position.xyz - camera.origin;
+    }
+    var st: vec2<f32>;
+    if !camera_project(camera, direction, &st) {
+        return false;
+    }
+
+    // pixels are sampled by (xy + jitter) / (resolution - 1)
+    let x = floor(st.x * f32(constant_params.width - 1u));
+    let y = floor(st.y * f32(constant_params.height - 1u));
+    if x < 0.0 || y < 0.0 || x >= f32(constant_params.width) || y >= f32(constant_params.height) {
+        return false;
+    }
+    let index = u32(y) * constant_params.width + u32(x);
+
+    let history_position = history_position_buffer[index];
+    if (history_position.w != 0.0) != hit {
+        return false;
+    }
+    if hit && length(history_position.xyz - position.xyz) > reprojection_tolerance * length(direction) {
+        return false;
+    }
+
+    let rgba = history_accumulation_buffer[index];
+    if rgba.w <= 0.0 {
+        return false;
+    }
+    let scale = min(1.0, f32(constant_params.temporal_history_limit) / rgba.w);
+    (*history_rgba) = rgba * scale;
+    (*history_second_moment) = history_second_moment_buffer[index] * scale;
+    return true;
+}
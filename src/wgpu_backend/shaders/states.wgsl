@@ -1,5 +1,6 @@
 struct ConstantParams {
     camera: Camera,
+    previous_camera: Camera,
     depth: u32,
     width: u32,
     height: u32,
@@ -8,4 +9,77 @@ struct ConstantParams {
     ray_cast_epsilon: f32,
     textures_count: u32,
     current_iteration : f32,
+    light_nodes_count: u32,
+    environment_map_texture_id: u32,
+    environment_map_width: u32,
+    environment_map_height: u32,
+    adaptive_sampling: u32,
+    adaptive_threshold: f32,
+    adaptive_min_samples: u32,
+    denoise: u32,
+    reproject: u32,
+    temporal_history_limit: u32,
+    pixel_stride: u32,
+    output_format: u32,
+    accumulation_format: u32,
+    _padding0: u32,
+    _padding1: u32,
+    _padding2: u32,
+}
+
+struct RenderStats {
+    active_pixel_count: atomic<u32>,
+    // 64 bit sum, a u32 overflows above about 16.7M pixels
+    error_sum_low: atomic<u32>,
+    error_sum_high: atomic<u32>,
+    // summed over the iterations of a render
+    secondary_ray_count_low: atomic<u32>,
+    secondary_ray_count_high: atomic<u32>,
+}
+
+const render_stats_error_scale: f32 = 256.0;
+
+fn luminance(rgb: vec3<f32>) -> f32 {
+    return 0.2126 * rgb.x + 0.7152 * rgb.y + 0.0722 * rgb.z;
+}
+
+// Standard error of the mean luminance relative to the mean, clamped to 1.
+// accumulated_rgba.w is the number of samples of the pixel.
+fn estimate_relative_error(accumulated_rgba: vec4<f32>, second_moment: f32) -> f32 {
+    let n = accumulated_rgba.w;
+    if n < 2.0 {
+        return 1.0;
+    }
+
+    let mean = luminance(accumulated_rgba.xyz) / n;
+    let variance = max(second_moment / n - mean * mean, 0.0) * n / (n - 1.0);
+    // small absolute term keeps dark pixels from never converging
+    let error = sqrt(variance / n) / (mean + 0.01);
+    return min(error, 1.0);
+}
+
+fn is_converged(accumulated_rgba: vec4<f32>, error: f32) -> bool {
+    return constant_params.adaptive_sampling != 0u
+        && accumulated_rgba.w >= f32(constant_params.adaptive_min_samples)
+        && error < constant_params.adaptive_threshold;
+}
+
+// secondary_rays are the rays of the sample traced after the camera ray, the bounces and the shadow rays.
+fn record_render_stats(error: f32, converged: bool, secondary_rays: u32) {
+    let quantized_error = u32(error * render_stats_error_scale);
+    if quantized_error > 0u {
+        let previous = atomicAdd(&render_stats.error_sum_low, quantized_error);
+        if previous + quantized_error < previous {
+            atomicAdd(&render_stats.error_sum_high, 1u);
+        }
+    }
+    if !converged {
+        atomicAdd(&render_stats.active_pixel_count, 1u);
+    }
+    if secondary_rays > 0u {
+        let previous = atomicAdd(&render_stats.secondary_ray_count_low, secondary_rays);
+        if previous + secondary_rays < previous {
+            atomicAdd(&render_stats.secondary_ray_count_high, 1u);
+        }
+    }
 }
\ No newline at end of file